@@ -0,0 +1,47 @@
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+
+#include "src/app/palette.h"
+
+struct FrameData {
+  FrameData() {
+    for (int i = 0; i < 256 * 240; i++) {
+      colors[i] = (uint8_t)(rand() % 64);
+    }
+  }
+
+  uint8_t colors[256 * 240];
+  Pixel   pixels[256 * 240];
+};
+
+static void convert_frame(benchmark::State &state) {
+  static FrameData frame;
+  for (auto _ : state) {
+    for (int row = 0; row < 240; row++) {
+      convert_colors(
+          &frame.pixels[row * 256], &frame.colors[row * 256], 256, row % 8
+      );
+    }
+    benchmark::DoNotOptimize(frame.pixels);
+  }
+  state.SetItemsProcessed(state.iterations() * 256 * 240);
+}
+
+// Plain table lookups, for comparison.
+static void convert_frame_scalar(benchmark::State &state) {
+  static FrameData frame;
+  for (auto _ : state) {
+    for (int row = 0; row < 240; row++) {
+      const Pixel *palette = PALETTE[row % 8];
+      for (int col = 0; col < 256; col++) {
+        int i           = row * 256 + col;
+        frame.pixels[i] = palette[frame.colors[i]];
+      }
+    }
+    benchmark::DoNotOptimize(frame.pixels);
+  }
+  state.SetItemsProcessed(state.iterations() * 256 * 240);
+}
+
+BENCHMARK(convert_frame);
+BENCHMARK(convert_frame_scalar);
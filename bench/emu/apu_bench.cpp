@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <benchmark/benchmark.h>
+
+#include "src/emu/nes.h"
+
+static constexpr int64_t CPU_HZ = 1789773;
+
+// CPU cycles to run between draining the output, short enough that the buffer
+// can't overflow.
+static constexpr int64_t BATCH_CYCLES = 8192;
+
+// Runs the APU alone for a second at a time, with the pulse, triangle and
+// noise channels all playing.
+static void apu_second(benchmark::State &state, bool audio_enabled) {
+  Nes nes;
+  nes.load_cart("test_data/nestest.nes");
+  nes.power_on();
+
+  Apu &apu = nes.apu();
+  apu.set_audio_enabled(audio_enabled);
+  apu.write_4015(0x0f);
+  apu.write_4000(0xbf);
+  apu.write_4002(0xfd);
+  apu.write_4003(0x00);
+  apu.write_4004(0x7f);
+  apu.write_4006(0x54);
+  apu.write_4007(0x01);
+  apu.write_4008(0xff);
+  apu.write_400A(0x80);
+  apu.write_400B(0x00);
+  apu.write_400C(0x3f);
+  apu.write_400E(0x04);
+  apu.write_400F(0x00);
+
+  for (auto _ : state) {
+    int64_t end = apu.cycles() + CPU_HZ;
+    while (apu.cycles() < end) {
+      apu.run_until(std::min(apu.cycles() + BATCH_CYCLES, end));
+      auto &out = apu.output();
+      while (out.available() > 0) {
+        benchmark::DoNotOptimize(out.read());
+      }
+    }
+  }
+}
+
+BENCHMARK_CAPTURE(apu_second, audio_on, true)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(apu_second, audio_off, false)->Unit(benchmark::kMillisecond);
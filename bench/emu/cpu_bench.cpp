@@ -0,0 +1,79 @@
+#include <benchmark/benchmark.h>
+
+#include "src/emu/apu.h"
+#include "src/emu/cart.h"
+#include "src/emu/cpu.h"
+#include "src/emu/ppu.h"
+
+// Instructions in nestest's automated run (see test_data/nestest.log).
+static constexpr int NESTEST_INSTRUCTIONS = 8991;
+static constexpr int NESTEST_CYCLES       = 26548;
+
+static void cpu_nestest(benchmark::State &state) {
+  Cart cart;
+  Apu  apu;
+  Cpu  cpu;
+  Ppu  ppu;
+
+  cpu.set_cart(&cart);
+  cpu.set_apu(&apu);
+  cpu.set_ppu(&ppu);
+  apu.set_cpu(&cpu);
+  ppu.set_cpu(&cpu);
+  cart.set_cpu(&cpu);
+
+  cart.load_cart("test_data/nestest.nes");
+  cart.power_on(); // N.B., maps PRG ROM into the CPU
+  cpu.power_on();
+  cpu.registers().PC = 0xc000;
+
+  // N.B., the run only checks the results of its own instructions, so it can
+  // be started over without clearing RAM.
+  auto start = cpu.registers();
+  for (auto _ : state) {
+    cpu.registers() = start;
+    for (int i = 0; i < NESTEST_INSTRUCTIONS; i++) {
+      cpu.step();
+    }
+  }
+  state.counters["instructions"] = benchmark::Counter(
+      (double)state.iterations() * NESTEST_INSTRUCTIONS,
+      benchmark::Counter::kIsRate
+  );
+}
+BENCHMARK(cpu_nestest);
+
+// Runs the same code in batches, as Nes::run_until does, under each
+// dispatcher.
+static void cpu_run(benchmark::State &state, Cpu::Dispatch dispatch) {
+  Cart cart;
+  Apu  apu;
+  Cpu  cpu;
+  Ppu  ppu;
+
+  cpu.set_cart(&cart);
+  cpu.set_apu(&apu);
+  cpu.set_ppu(&ppu);
+  cpu.set_dispatch(dispatch);
+  apu.set_cpu(&cpu);
+  ppu.set_cpu(&cpu);
+  cart.set_cpu(&cpu);
+
+  cart.load_cart("test_data/nestest.nes");
+  cart.power_on(); // N.B., maps PRG ROM into the CPU
+  cpu.power_on();
+  cpu.registers().PC = 0xc000;
+
+  auto start = cpu.registers();
+  for (auto _ : state) {
+    cpu.registers() = start;
+    cpu.run(cpu.cycles() + NESTEST_CYCLES);
+  }
+  state.counters["instructions"] = benchmark::Counter(
+      (double)state.iterations() * NESTEST_INSTRUCTIONS,
+      benchmark::Counter::kIsRate
+  );
+}
+BENCHMARK_CAPTURE(cpu_run, switch, Cpu::SWITCH);
+BENCHMARK_CAPTURE(cpu_run, threaded, Cpu::THREADED);
+BENCHMARK_CAPTURE(cpu_run, jit, Cpu::JIT);
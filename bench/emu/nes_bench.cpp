@@ -0,0 +1,27 @@
+#include <benchmark/benchmark.h>
+
+#include "src/emu/nes.h"
+
+// Runs each of the bundled ROMs end to end, the way the app does.
+static void nes_frame(benchmark::State &state, const char *rom) {
+  Nes nes;
+  nes.load_cart(rom);
+  nes.power_on();
+
+  for (auto _ : state) {
+    nes.run_until(nes.cpu().cycles() + CPU_CYCLES_PER_FRAME);
+    benchmark::DoNotOptimize(nes.audio().available());
+    nes.audio().reset();
+  }
+  state.counters["fps"] = benchmark::Counter(
+      (double)state.iterations(), benchmark::Counter::kIsRate
+  );
+}
+
+BENCHMARK_CAPTURE(nes_frame, nestest, "test_data/nestest.nes");
+BENCHMARK_CAPTURE(nes_frame, mmc3_1, "test_data/mmc3_1_clocking.nes");
+BENCHMARK_CAPTURE(nes_frame, mmc3_2, "test_data/mmc3_2_details.nes");
+BENCHMARK_CAPTURE(nes_frame, mmc3_3, "test_data/mmc3_3_a12_clocking.nes");
+BENCHMARK_CAPTURE(nes_frame, mmc3_4, "test_data/mmc3_4_scanline_timing.nes");
+BENCHMARK_CAPTURE(nes_frame, mmc3_5, "test_data/mmc3_5_mmc3.nes");
+BENCHMARK_CAPTURE(nes_frame, mmc3_6, "test_data/mmc3_6_mmc3_alt.nes");
@@ -0,0 +1,110 @@
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+
+#include "src/emu/nes.h"
+
+// N.B., benchmarks must be run from the repository root so that the ROMs in
+// test_data can be found.
+
+static constexpr int64_t PPU_CYCLES_PER_FRAME = 341 * 262;
+
+// Runs the PPU alone, a frame at a time, over a nametable filled with
+// nestest's tiles and sprites scattered across the screen.
+static void ppu_frame(
+    benchmark::State &state,
+    uint8_t           mask,
+    bool              scanline_renderer,
+    Ppu::RenderLevel  level
+) {
+  Cart cart;
+  Ppu  ppu;
+  cart.load_cart("test_data/nestest.nes");
+  cart.power_on();
+  ppu.set_cart(&cart);
+  ppu.set_scanline_renderer(scanline_renderer);
+  ppu.set_render_level(level, level == Ppu::RENDER_SKIP_FRAMES ? 3 : 0);
+  ppu.power_on();
+  ppu.set_ready(true);
+
+  srand(0);
+  for (uint16_t addr = 0x2000; addr < 0x2800; addr++) {
+    ppu.poke(addr, (uint8_t)rand());
+  }
+  for (uint16_t addr = 0x3f00; addr < 0x3f20; addr++) {
+    ppu.poke(addr, (uint8_t)(rand() & 0x3f));
+  }
+  ppu.write_OAMADDR(0);
+  for (int i = 0; i < 256; i++) {
+    ppu.write_OAMDATA((uint8_t)rand());
+  }
+  ppu.write_PPUMASK(mask);
+
+  for (auto _ : state) {
+    ppu.run_until(ppu.cycles() + PPU_CYCLES_PER_FRAME);
+  }
+  state.counters["fps"] = benchmark::Counter(
+      (double)state.iterations(), benchmark::Counter::kIsRate
+  );
+}
+
+BENCHMARK_CAPTURE(ppu_frame, rendering_off, 0x00, true, Ppu::RENDER_FULL);
+BENCHMARK_CAPTURE(ppu_frame, rendering_on, 0x1e, true, Ppu::RENDER_FULL);
+BENCHMARK_CAPTURE(
+    ppu_frame, rendering_on_skip_3, 0x1e, true, Ppu::RENDER_SKIP_FRAMES
+);
+BENCHMARK_CAPTURE(
+    ppu_frame, rendering_on_timing_only, 0x1e, true, Ppu::RENDER_TIMING_ONLY
+);
+BENCHMARK_CAPTURE(
+    ppu_frame, rendering_on_dots, 0x1e, false, Ppu::RENDER_FULL
+);
+
+static void run_frames(
+    benchmark::State &state,
+    const char       *rom,
+    Ppu::RenderLevel  level,
+    int               frame_skip
+) {
+  Nes nes;
+  nes.load_cart(rom);
+  nes.power_on();
+  nes.ppu().set_render_level(level, frame_skip);
+
+  for (auto _ : state) {
+    nes.run_until(nes.cpu().cycles() + CPU_CYCLES_PER_FRAME);
+  }
+  state.counters["fps"] = benchmark::Counter(
+      (double)state.iterations(), benchmark::Counter::kIsRate
+  );
+}
+
+BENCHMARK_CAPTURE(
+    run_frames, nrom_full, "test_data/nestest.nes", Ppu::RENDER_FULL, 0
+);
+BENCHMARK_CAPTURE(
+    run_frames, nrom_skip_3, "test_data/nestest.nes", Ppu::RENDER_SKIP_FRAMES, 3
+);
+BENCHMARK_CAPTURE(
+    run_frames,
+    nrom_timing_only,
+    "test_data/nestest.nes",
+    Ppu::RENDER_TIMING_ONLY,
+    0
+);
+BENCHMARK_CAPTURE(
+    run_frames, mmc3_full, "test_data/mmc3_5_mmc3.nes", Ppu::RENDER_FULL, 0
+);
+BENCHMARK_CAPTURE(
+    run_frames,
+    mmc3_skip_3,
+    "test_data/mmc3_5_mmc3.nes",
+    Ppu::RENDER_SKIP_FRAMES,
+    3
+);
+BENCHMARK_CAPTURE(
+    run_frames,
+    mmc3_timing_only,
+    "test_data/mmc3_5_mmc3.nes",
+    Ppu::RENDER_TIMING_ONLY,
+    0
+);
@@ -0,0 +1,33 @@
+#include <benchmark/benchmark.h>
+#include <vector>
+
+#include "src/emu/nes.h"
+
+static void save_state(benchmark::State &state) {
+  Nes nes;
+  nes.load_cart("test_data/mmc3_5_mmc3.nes");
+  nes.power_on();
+  nes.run_until(60 * CPU_CYCLES_PER_FRAME);
+
+  std::vector<uint8_t> buf;
+  for (auto _ : state) {
+    nes.save_state(buf);
+    benchmark::DoNotOptimize(buf.data());
+  }
+  state.counters["bytes"] = (double)buf.size();
+}
+BENCHMARK(save_state);
+
+static void load_state(benchmark::State &state) {
+  Nes nes;
+  nes.load_cart("test_data/mmc3_5_mmc3.nes");
+  nes.power_on();
+  nes.run_until(60 * CPU_CYCLES_PER_FRAME);
+
+  std::vector<uint8_t> buf;
+  nes.save_state(buf);
+  for (auto _ : state) {
+    nes.load_state(buf);
+  }
+}
+BENCHMARK(load_state);
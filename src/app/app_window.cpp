@@ -1,6 +1,7 @@
 #include <SDL.h>
 #include <SDL_filesystem.h>
 #include <chrono>
+#include <cstring>
 #include <imgui.h>
 #include <imgui_impl_sdl2.h>
 #include <imgui_impl_sdlrenderer2.h>
@@ -11,9 +12,31 @@
 static constexpr int WINDOW_WIDTH  = 784;
 static constexpr int WINDOW_HEIGHT = 539;
 
+static constexpr int64_t CPU_HZ = 1789773;
+static constexpr auto    FRAME_DURATION =
+    std::chrono::nanoseconds(CPU_CYCLES_PER_FRAME * 1000000000 / CPU_HZ);
+
+// Rewind history: a state every REWIND_FRAMES frames, kept within
+// REWIND_BUDGET bytes. States are pushed after whichever timer batch finishes
+// a frame, so they hold the rows drawn so far of the next one (see
+// Ppu::save_state): ~13 KB raw with 8 KB of CHR RAM, plus up to 60 KB of
+// pixels. The states between keyframes mostly encode well under 1 KB, so
+// that's half an hour's worth or more.
+static constexpr int64_t REWIND_BUDGET            = 64 << 20;
+static constexpr int     REWIND_FRAMES            = 2;
+static constexpr int     REWIND_KEYFRAME_INTERVAL = 60;
+
 AppWindow::AppWindow()
     : paused_(false),
+      rewind_(REWIND_BUDGET, REWIND_KEYFRAME_INTERVAL),
+      rewind_frame_(0),
+      rewinding_(false),
+      run_ahead_frame_(0),
       show_gg_window_(false),
+      emu_stopping_(false),
+      emu_failed_(false),
+      frames_drawn_(-1),
+      frame_seq_(0),
       window_(
           "teeny-nes",
           (int)(WINDOW_WIDTH * sdl_.scale_factor()),
@@ -21,8 +44,8 @@ AppWindow::AppWindow()
       ),
       renderer_(window_.get()),
       imgui_(window_.get(), renderer_.get()),
-      game_window_(nes_, renderer_.get()),
-      gg_window_(nes_) {
+      game_window_(nes_, frames_, renderer_.get()),
+      gg_window_(nes_, nes_mutex_) {
   nes_.input().set_controller(&keyboard_, 0);
 
   ImGui::GetIO().FontGlobalScale = sdl_.scale_factor();
@@ -46,20 +69,52 @@ static void show_error_dialog(const std::exception &e, SDL_Window *window) {
 
 void AppWindow::run() {
   try {
-    SDL_PauseAudioDevice(audio_dev_.get(), 0);
+    emu_thread_ = std::thread([this] { run_emulator(); });
 
     while (process_events()) {
-      step();
-      queue_audio();
+      if (emu_failed_) {
+        std::rethrow_exception(emu_error_);
+      }
+      keyboard_.update(game_window_.focused());
       render();
     }
 
+    stop_emulator();
     save_rom_state();
   } catch (const std::exception &e) {
+    stop_emulator();
     show_error_dialog(e, window_.get());
   }
 }
 
+// Body of the emulator thread. N.B., Timer::run works out how many cycles to
+// run from the time elapsed, so the sleep between batches only affects
+// latency.
+void AppWindow::run_emulator() {
+  try {
+    while (!emu_stopping_) {
+      {
+        std::lock_guard lock(nes_mutex_);
+        step();
+        publish_frame();
+        publish_stats();
+        queue_audio();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  } catch (...) {
+    emu_error_  = std::current_exception();
+    emu_failed_ = true;
+  }
+}
+
+void AppWindow::stop_emulator() {
+  if (emu_thread_.joinable()) {
+    emu_stopping_ = true;
+    emu_thread_.join();
+  }
+}
+
 bool AppWindow::process_events() {
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
@@ -81,8 +136,63 @@ void AppWindow::step() {
   if (paused_) {
     return;
   }
-  keyboard_.set_enabled(game_window_.focused());
+
+  rewinding_ = keyboard_.rewinding() && !nes_.nsf();
+  if (rewinding_) {
+    step_back();
+    return;
+  }
+
   timer_.run(nes_);
+  if (nes_.ppu().frames() - rewind_frame_ >= REWIND_FRAMES) {
+    rewind_.push(nes_);
+    rewind_frame_ = nes_.ppu().frames();
+  }
+  if (nes_.ppu().frames() != run_ahead_frame_) {
+    run_ahead_.run(nes_);
+    run_ahead_frame_ = nes_.ppu().frames();
+  }
+}
+
+void AppWindow::step_back() {
+  // N.B., the timer is held back so that there's no rush to catch up once the
+  // rewind key is let go.
+  timer_.reset();
+  auto now = std::chrono::high_resolution_clock::now();
+  if (now < next_rewind_) {
+    return;
+  }
+  next_rewind_ = now + REWIND_FRAMES * FRAME_DURATION;
+
+  if (!rewind_.pop(nes_)) {
+    return;
+  }
+  // States are pushed partway into a frame, so run on past the end of it to
+  // have a picture to show. Its audio is dropped.
+  nes_.run_until(nes_.cpu().cycles() + CPU_CYCLES_PER_FRAME);
+  nes_.audio().reset();
+  rewind_frame_ = nes_.ppu().frames();
+}
+
+void AppWindow::publish_frame() {
+  Ppu &ppu = nes_.ppu();
+  if (ppu.frames_drawn() == frames_drawn_) {
+    return;
+  }
+  frames_drawn_ = ppu.frames_drawn();
+
+  Frame &frame = frames_.back();
+  frame.seq    = ++frame_seq_;
+  std::memcpy(frame.pixels, ppu.frame(), sizeof(frame.pixels));
+  std::memcpy(frame.emphasis, ppu.frame_emphasis(), sizeof(frame.emphasis));
+  frames_.publish();
+}
+
+void AppWindow::publish_stats() {
+  EmuStats &stats = stats_.back();
+  stats.rewind    = rewind_.stats();
+  stats.run_ahead = run_ahead_.stats();
+  stats_.publish();
 }
 
 void AppWindow::render() {
@@ -117,7 +227,11 @@ void AppWindow::render_imgui() {
   render_imgui_menu();
 
   if (nes_.is_powered_on()) {
-    game_window_.render();
+    if (nes_.nsf()) {
+      render_imgui_nsf_window();
+    } else {
+      game_window_.render();
+    }
   }
   if (show_gg_window_) {
     gg_window_.render();
@@ -133,15 +247,20 @@ void AppWindow::render_imgui_menu() {
         open_rom();
       }
       ImGui::Separator();
-      bool prev_paused = paused_;
-      ImGui::MenuItem("Pause", nullptr, &paused_, nes_.is_powered_on());
-      if (prev_paused && !paused_) {
-        timer_.reset();
+      bool paused = paused_;
+      if (ImGui::MenuItem("Pause", nullptr, &paused, nes_.is_powered_on())) {
+        std::lock_guard lock(nes_mutex_);
+        if (paused_ && !paused) {
+          timer_.reset();
+        }
+        paused_ = paused;
       }
       if (ImGui::MenuItem("Reset", nullptr, false, nes_.is_powered_on())) {
+        std::lock_guard lock(nes_mutex_);
         reset();
       }
       if (ImGui::MenuItem("Power Off", nullptr, false, nes_.is_powered_on())) {
+        std::lock_guard lock(nes_mutex_);
         power_off();
       }
       ImGui::Separator();
@@ -150,61 +269,131 @@ void AppWindow::render_imgui_menu() {
       );
       ImGui::EndMenu();
     }
+    render_imgui_audio_menu();
+    stats_.update();
+    render_imgui_rewind_menu();
+    render_imgui_run_ahead_menu();
     ImGui::EndMainMenuBar();
   }
 }
 
-void AppWindow::open_rom() {
-  nfdu8filteritem_t filters[1] = {{"NES ROMs", "nes"}};
-  auto              result     = nfd_.open_dialog(filters, 1);
-  if (result.has_value()) {
-    power_off();
-    nes_.load_cart(*result);
-    rom_name_ = result->stem();
-    power_on();
+void AppWindow::render_imgui_audio_menu() {
+  if (ImGui::BeginMenu("Audio")) {
+    int latency = audio_.target_latency();
+    if (ImGui::SliderInt(
+            "Target Latency (ms)",
+            &latency,
+            AudioOutput::MIN_LATENCY_MS,
+            AudioOutput::MAX_LATENCY_MS
+        )) {
+      audio_.set_target_latency(latency);
+    }
+    ImGui::Separator();
+    auto stats = audio_.stats();
+    ImGui::Text("Latency: %.1f ms", stats.latency_ms);
+    ImGui::Text("Sample Rate: %d Hz", stats.sample_rate);
+    ImGui::Text("Underruns: %lld", (long long)stats.underruns);
+    ImGui::Text("Overruns: %lld", (long long)stats.overruns);
+    ImGui::EndMenu();
   }
 }
 
-static constexpr int AUDIO_QUEUE_TARGET = 2048;
-
-void AppWindow::queue_audio() {
-  if (paused_ || !nes_.is_powered_on()) {
-    return;
+void AppWindow::render_imgui_rewind_menu() {
+  if (ImGui::BeginMenu("Rewind")) {
+    auto &stats   = stats_.front().rewind;
+    auto  history = stats.states * REWIND_FRAMES * FRAME_DURATION;
+    ImGui::Text("Hold Backspace to rewind.");
+    ImGui::Separator();
+    ImGui::Text(
+        "History: %.1f s", std::chrono::duration<double>(history).count()
+    );
+    ImGui::Text(
+        "Memory: %.1f of %lld MB",
+        (double)stats.bytes_used / (1 << 20),
+        (long long)(REWIND_BUDGET >> 20)
+    );
+    ImGui::Text("Bytes/Frame: %.0f", stats.bytes_per_state / REWIND_FRAMES);
+    ImGui::Text("Encode: %.1f us", stats.encode_us);
+    ImGui::Text("Decode: %.1f us", stats.decode_us);
+    ImGui::EndMenu();
   }
+}
 
-  auto &output = nes_.apu().output();
-  float samples[ApuBuffer::CAPACITY];
-  int   available = output.available();
-  assert(available <= (int)ApuBuffer::CAPACITY);
-  if (available == 0) {
-    return;
+void AppWindow::render_imgui_run_ahead_menu() {
+  if (ImGui::BeginMenu("Run-Ahead")) {
+    // N.B., only the UI thread changes the number of frames.
+    int   frames = run_ahead_.frames();
+    auto &stats  = stats_.front().run_ahead;
+    if (ImGui::SliderInt("Frames", &frames, 0, RunAhead::MAX_FRAMES)) {
+      std::lock_guard lock(nes_mutex_);
+      run_ahead_.set_frames(frames);
+    }
+    ImGui::Separator();
+    ImGui::Text("Overhead: %.2f ms/frame", stats.overhead_ms);
+    ImGui::Text("Save + Load: %.1f us", stats.save_load_us);
+    ImGui::EndMenu();
   }
+}
 
-  for (int i = 0; i < available; i++) {
-    samples[i] = output.read();
+void AppWindow::render_imgui_nsf_window() {
+  auto flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
+               ImGuiWindowFlags_NoSavedSettings |
+               ImGuiWindowFlags_NoBringToFrontOnFocus;
+
+  const ImGuiViewport *viewport = ImGui::GetMainViewport();
+  ImGui::SetNextWindowPos(viewport->WorkPos);
+  ImGui::SetNextWindowSize(viewport->WorkSize);
+
+  if (ImGui::Begin("NSF", nullptr, flags)) {
+    const NsfHeader &nsf = *nes_.nsf();
+    ImGui::Text("%.*s", (int)nsf.title().size(), nsf.title().data());
+    ImGui::Text("%.*s", (int)nsf.artist().size(), nsf.artist().data());
+    ImGui::Text("%.*s", (int)nsf.copyright().size(), nsf.copyright().data());
+    ImGui::Separator();
+
+    int song = nes_.song();
+    ImGui::Text("Song %d of %d", song + 1, nsf.songs());
+    ImGui::BeginDisabled(song == 0);
+    if (ImGui::Button("Previous")) {
+      std::lock_guard lock(nes_mutex_);
+      nes_.select_song(song - 1);
+      paused_ = false;
+    }
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    ImGui::BeginDisabled(song + 1 == nsf.songs());
+    if (ImGui::Button("Next")) {
+      std::lock_guard lock(nes_mutex_);
+      nes_.select_song(song + 1);
+      paused_ = false;
+    }
+    ImGui::EndDisabled();
   }
+  ImGui::End();
+}
 
-  // Dynamically adjust sample rate per ideas in this thread:
-  // https://forums.nesdev.org/viewtopic.php?f=3&t=11612.
-  int queued = (int)(SDL_GetQueuedAudioSize(audio_dev_.get()) / sizeof(float));
-  constexpr int rate_eps = 100;
-  if (queued > AUDIO_QUEUE_TARGET) {
-    nes_.apu().set_sample_rate(SDLAudioDeviceRes::OUTPUT_RATE - rate_eps);
-  } else {
-    nes_.apu().set_sample_rate(SDLAudioDeviceRes::OUTPUT_RATE + rate_eps);
+void AppWindow::open_rom() {
+  nfdu8filteritem_t filters[1] = {{"NES ROMs and NSF Music", "nes,nsf"}};
+  auto              result     = nfd_.open_dialog(filters, 1);
+  if (result.has_value()) {
+    std::lock_guard lock(nes_mutex_);
+    power_off();
+    if (result->extension() == ".nsf") {
+      nes_.load_nsf(*result);
+    } else {
+      nes_.load_cart(*result);
+    }
+    rom_name_ = result->stem();
+    power_on();
   }
+}
 
-  // if (queued == 0) {
-  //   std::cout << "underflow detected!\n";
-  // }
-
-  int ret =
-      SDL_QueueAudio(audio_dev_.get(), samples, available * sizeof(float));
-  if (ret != 0) {
-    throw std::runtime_error(
-        std::format("audio failed to queue: {}", SDL_GetError())
-    );
+void AppWindow::queue_audio() {
+  if (paused_ || rewinding_ || !nes_.is_powered_on()) {
+    audio_.pause();
+    return;
   }
+  audio_.queue(nes_);
 }
 
 void AppWindow::power_on() {
@@ -214,6 +403,8 @@ void AppWindow::power_on() {
   load_rom_state();
   nes_.power_on();
   timer_.reset();
+  rewind_.clear();
+  rewind_frame_ = 0;
 }
 
 void AppWindow::power_off() {
@@ -232,6 +423,8 @@ void AppWindow::reset() {
   save_rom_state();
   nes_.reset();
   paused_ = false;
+  rewind_.clear();
+  rewind_frame_ = 0;
 }
 
 static std::filesystem::path make_codes_path(
@@ -1,15 +1,23 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <exception>
 #include <filesystem>
+#include <mutex>
+#include <thread>
 
+#include "src/app/audio_output.h"
 #include "src/app/game_genie_window.h"
 #include "src/app/game_window.h"
 #include "src/app/imgui.h"
 #include "src/app/keyboard.h"
 #include "src/app/nfd.h"
 #include "src/app/sdl.h"
+#include "src/app/triple_buffer.h"
 #include "src/emu/nes.h"
+#include "src/emu/rewind.h"
+#include "src/emu/run_ahead.h"
 #include "src/emu/timer.h"
 
 class AppWindow {
@@ -21,11 +29,27 @@ public:
 private:
   using Timestamp = std::chrono::time_point<std::chrono::high_resolution_clock>;
 
+  // Stats shown in the menus, as handed off from the emulator thread to the UI
+  // thread (see publish_stats).
+  struct EmuStats {
+    RewindBuffer::Stats rewind;
+    RunAhead::Stats     run_ahead;
+  };
+
   bool process_events();
+  void run_emulator();
+  void stop_emulator();
   void step();
+  void step_back();
+  void publish_frame();
+  void publish_stats();
   void render();
   void render_imgui();
   void render_imgui_menu();
+  void render_imgui_audio_menu();
+  void render_imgui_rewind_menu();
+  void render_imgui_run_ahead_menu();
+  void render_imgui_nsf_window();
   void open_rom();
   void queue_audio();
 
@@ -41,17 +65,43 @@ private:
   Timer              timer_;
   bool               paused_;
 
+  // A state is pushed every few frames, and popped at the same pace while the
+  // rewind key is held.
+  RewindBuffer rewind_;
+  int64_t      rewind_frame_;
+  Timestamp    next_rewind_;
+  bool         rewinding_;
+
+  // Runs ahead after every frame, see RunAhead.
+  RunAhead run_ahead_;
+  int64_t  run_ahead_frame_;
+
   std::filesystem::path pref_path_;
   std::string           rom_name_;
 
   bool show_gg_window_;
 
-  Nfd               nfd_;
-  SDLRes            sdl_;
-  SDLWindowRes      window_;
-  SDLRendererRes    renderer_;
-  SDLAudioDeviceRes audio_dev_;
-  ImguiRes          imgui_;
-  GameWindow        game_window_;
-  GameGenieWindow   gg_window_;
+  // The emulator runs on its own thread (see run_emulator). nes_mutex_ guards
+  // everything that thread touches (nes_, timer_, paused_ and the rewind and
+  // run-ahead state), and the UI thread only needs to hold it while changing
+  // any of these. Frames and stats are handed off to the UI thread without
+  // locking, so rendering only waits on the emulator to make a change.
+  std::thread            emu_thread_;
+  std::mutex             nes_mutex_;
+  std::atomic<bool>      emu_stopping_;
+  std::atomic<bool>      emu_failed_;
+  std::exception_ptr     emu_error_;
+  FrameBuffer            frames_;
+  int64_t                frames_drawn_;
+  int64_t                frame_seq_;
+  TripleBuffer<EmuStats> stats_;
+
+  Nfd             nfd_;
+  SDLRes          sdl_;
+  SDLWindowRes    window_;
+  SDLRendererRes  renderer_;
+  AudioOutput     audio_;
+  ImguiRes        imgui_;
+  GameWindow      game_window_;
+  GameGenieWindow gg_window_;
 };
@@ -0,0 +1,148 @@
+#include <SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "src/app/audio_output.h"
+
+static constexpr int DEFAULT_LATENCY_MS = 60;
+
+// Largest relative change to the APU's sample rate. At half a percent the
+// change in pitch is inaudible, but it's still plenty to make up for the
+// emulator running slightly faster or slower than the audio device.
+static constexpr double MAX_RATE_DELTA = 0.005;
+
+// The ring's fill level jumps around with every batch the emulator runs, so
+// the rate control works off a moving average of it.
+static constexpr double FILL_SMOOTHING = 0.01;
+
+// Smoothing for the latency measurements, which vary with where in a batch and
+// in a callback the timed sample happens to fall.
+static constexpr double LATENCY_SMOOTHING = 0.1;
+
+static int64_t now_nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()
+  )
+      .count();
+}
+
+AudioOutput::AudioOutput()
+    : device_(callback, this),
+      playing_(false),
+      fill_(0),
+      last_sample_(0),
+      queued_(0),
+      consumed_(0),
+      probe_pending_(false),
+      probe_sample_(0),
+      probe_nanos_(0),
+      target_latency_ms_(DEFAULT_LATENCY_MS),
+      underruns_(0),
+      overruns_(0),
+      latency_ms_(0),
+      sample_rate_(SDLAudioDeviceRes::OUTPUT_RATE) {}
+
+void AudioOutput::set_target_latency(int ms) {
+  target_latency_ms_ = std::clamp(ms, MIN_LATENCY_MS, MAX_LATENCY_MS);
+}
+
+AudioOutput::Stats AudioOutput::stats() const {
+  return {
+      .underruns   = underruns_,
+      .overruns    = overruns_,
+      .latency_ms  = latency_ms_,
+      .sample_rate = sample_rate_,
+  };
+}
+
+void AudioOutput::queue(Nes &nes) {
+  auto &output = nes.audio();
+  float samples[ApuBuffer::CAPACITY];
+  int   available = output.available();
+  for (int i = 0; i < available; i++) {
+    samples[i] = output.read();
+  }
+  int written = ring_.write(samples, available);
+  if (written < available) {
+    overruns_++;
+  }
+  queued_ += written;
+  if (written > 0 && !probe_pending_.load(std::memory_order_acquire)) {
+    probe_sample_ = queued_ - 1;
+    probe_nanos_  = now_nanos();
+    probe_pending_.store(true, std::memory_order_release);
+  }
+
+  // Dynamically adjust sample rate per ideas in this thread:
+  // https://forums.nesdev.org/viewtopic.php?f=3&t=11612. N.B., the adjustment
+  // is proportional to the distance from the target, so that the rate settles
+  // instead of flip-flopping around it.
+  constexpr int rate   = SDLAudioDeviceRes::OUTPUT_RATE;
+  double        target = target_latency_ms_ * rate / 1000.0;
+  fill_ += (ring_.size() - fill_) * FILL_SMOOTHING;
+  double error = std::clamp((target - fill_) / target, -1.0, 1.0);
+  sample_rate_ = (int)std::lround(rate * (1 + MAX_RATE_DELTA * error));
+  nes.apu().set_sample_rate(sample_rate_);
+
+  // Hold off playing until the ring has filled up to the target, rather than
+  // starting out with a string of underruns.
+  if (!playing_ && ring_.size() >= target) {
+    SDL_PauseAudioDevice(device_.get(), 0);
+    playing_ = true;
+  }
+}
+
+void AudioOutput::pause() {
+  if (playing_) {
+    SDL_PauseAudioDevice(device_.get(), 1);
+    playing_ = false;
+  }
+  // N.B., the time spent paused isn't latency. The callback can't be running
+  // once the device is paused.
+  probe_pending_.store(false, std::memory_order_release);
+}
+
+void AudioOutput::callback(void *userdata, uint8_t *stream, int len) {
+  auto *self    = (AudioOutput *)userdata;
+  auto *samples = (float *)stream;
+  int   count   = len / (int)sizeof(float);
+  int   read    = self->ring_.read(samples, count);
+  if (read > 0) {
+    self->last_sample_ = samples[read - 1];
+    self->measure_latency(read);
+  }
+  if (read < count) {
+    // N.B., holding the last sample rather than dropping to silence avoids an
+    // audible pop.
+    std::fill(samples + read, samples + count, self->last_sample_);
+    self->underruns_++;
+  }
+}
+
+void AudioOutput::measure_latency(int read) {
+  int64_t start = consumed_;
+  consumed_    += read;
+  if (!probe_pending_.load(std::memory_order_acquire)) {
+    return;
+  }
+  int64_t probe = probe_sample_;
+  if (probe >= consumed_) {
+    return;
+  }
+  if (probe < start) {
+    // N.B., the sample got read before it was marked, so its time is unknown.
+    probe_pending_.store(false, std::memory_order_release);
+    return;
+  }
+
+  // The timed sample plays once the device is through what it already holds
+  // (one buffer) and the samples before it in this one.
+  constexpr int rate    = SDLAudioDeviceRes::OUTPUT_RATE;
+  int64_t       ahead   = SDLAudioDeviceRes::BUFFER_SAMPLES + (probe - start);
+  double        ring_ms = (double)(now_nanos() - probe_nanos_) / 1e6;
+  double        ms      = ring_ms + (double)ahead * 1000 / rate;
+  double        prev    = latency_ms_;
+  latency_ms_ = prev == 0 ? ms : prev + (ms - prev) * LATENCY_SMOOTHING;
+  probe_pending_.store(false, std::memory_order_release);
+}
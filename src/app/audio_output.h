@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "src/app/audio_ring.h"
+#include "src/app/sdl.h"
+#include "src/emu/nes.h"
+
+// Plays the emulator's audio through an SDL audio callback. The emulator
+// thread queues samples into a lock-free ring, and the callback drains it. To
+// keep the ring near its target latency without ever dropping or repeating
+// samples, the APU's sample rate is nudged up or down slightly depending on
+// how full the ring is (see queue).
+class AudioOutput {
+public:
+  static constexpr int MIN_LATENCY_MS = 20;
+  static constexpr int MAX_LATENCY_MS = 150;
+
+  struct Stats {
+    int64_t underruns;   // callbacks that ran out of samples
+    int64_t overruns;    // batches of samples that didn't fit in the ring
+    double  latency_ms;  // measured from the APU to the speakers
+    int     sample_rate; // as currently requested from the APU
+  };
+
+  AudioOutput();
+
+  // Any thread.
+  void  set_target_latency(int ms);
+  int   target_latency() const { return target_latency_ms_; }
+  Stats stats() const;
+
+  // Emulator thread. Moves the samples produced so far into the ring, and
+  // adjusts the APU's sample rate to steer the ring towards the target.
+  void queue(Nes &nes);
+  void pause();
+
+private:
+  static void callback(void *userdata, uint8_t *stream, int len);
+
+  void measure_latency(int read);
+
+  AudioRing<8192>   ring_;
+  SDLAudioDeviceRes device_;
+  bool              playing_;
+  double            fill_;
+  float             last_sample_;
+  int64_t           queued_;   // samples written to the ring (emulator thread)
+  int64_t           consumed_; // samples read from the ring (callback)
+
+  // Latency is measured by timing one sample at a time, from when it's queued
+  // until the callback hands it to the device. Once the callback is done with
+  // it, the emulator thread picks the next one.
+  std::atomic<bool>    probe_pending_;
+  std::atomic<int64_t> probe_sample_;
+  std::atomic<int64_t> probe_nanos_;
+
+  std::atomic<int>     target_latency_ms_;
+  std::atomic<int64_t> underruns_;
+  std::atomic<int64_t> overruns_;
+  std::atomic<double>  latency_ms_;
+  std::atomic<int>     sample_rate_;
+};
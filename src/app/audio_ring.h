@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free queue of audio samples from a single writer thread to a single
+// reader thread (e.g., the SDL audio callback). Neither side ever waits for
+// the other: samples that don't fit are dropped, and reads may come up short.
+template <std::size_t CAPACITY> class AudioRing {
+  static_assert(std::has_single_bit(CAPACITY));
+
+public:
+  // Writer side. Returns the number of samples actually written.
+  int write(const float *samples, int count) {
+    int64_t w = write_.load(std::memory_order_relaxed);
+    int64_t r = read_.load(std::memory_order_acquire);
+    count     = std::min(count, (int)(CAPACITY - (w - r)));
+    for (int i = 0; i < count; i++) {
+      buffer_[(w + i) & (CAPACITY - 1)] = samples[i];
+    }
+    write_.store(w + count, std::memory_order_release);
+    return count;
+  }
+
+  // Reader side. Returns the number of samples actually read.
+  int read(float *samples, int count) {
+    int64_t r = read_.load(std::memory_order_relaxed);
+    int64_t w = write_.load(std::memory_order_acquire);
+    count     = std::min(count, (int)(w - r));
+    for (int i = 0; i < count; i++) {
+      samples[i] = buffer_[(r + i) & (CAPACITY - 1)];
+    }
+    read_.store(r + count, std::memory_order_release);
+    return count;
+  }
+
+  // Number of samples queued (either side may call this).
+  int size() const {
+    // N.B., read_ is loaded first so that the result can't go negative.
+    int64_t r = read_.load(std::memory_order_acquire);
+    int64_t w = write_.load(std::memory_order_acquire);
+    return (int)(w - r);
+  }
+
+private:
+  alignas(64) std::atomic<int64_t> write_            = 0;
+  alignas(64) std::atomic<int64_t> read_             = 0;
+  alignas(64) float                buffer_[CAPACITY] = {};
+};
@@ -91,6 +91,7 @@ void GameGenieWindow::render() {
     }
 
     if (should_sync) {
+      std::lock_guard lock(nes_mutex_);
       sync_codes();
     }
   }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -8,7 +9,11 @@ class Nes;
 
 class GameGenieWindow {
 public:
-  GameGenieWindow(Nes &nes) : nes_(nes) {}
+  // N.B., nes_mutex must be held while the codes are loaded (but not during
+  // render, which takes it itself when needed).
+  GameGenieWindow(Nes &nes, std::mutex &nes_mutex)
+      : nes_(nes),
+        nes_mutex_(nes_mutex) {}
 
   void render();
 
@@ -26,6 +31,7 @@ private:
   void sanitize_code(Code &code);
 
   Nes              &nes_;
+  std::mutex       &nes_mutex_;
   std::vector<Code> codes_;
   bool              new_enabled_  = true;
   char              new_code_[9]  = {0};
@@ -11,10 +11,12 @@ static constexpr int   FRAME_HEIGHT = 240 - OVERSCAN * 2;
 static constexpr float FRAME_ASPECT =
     (FRAME_WIDTH * 4.0f) / (FRAME_HEIGHT * 3.0f);
 
-GameWindow::GameWindow(Nes &nes, SDL_Renderer *renderer)
+GameWindow::GameWindow(Nes &nes, FrameBuffer &frames, SDL_Renderer *renderer)
     : nes_(nes),
+      frames_(frames),
       frame_(renderer, FRAME_WIDTH, FRAME_HEIGHT),
-      focused_(false) {}
+      focused_(false),
+      frame_seq_(-1) {}
 
 void GameWindow::render() {
   if (!nes_.is_powered_on()) {
@@ -57,22 +59,28 @@ void GameWindow::render() {
 }
 
 void GameWindow::prepare_frame() {
+  // N.B., the emulator may not have produced anything new since the last call
+  // (e.g., when paused or skipping frames).
+  frames_.update();
+  const Frame &frame = frames_.front();
+  if (frame.seq == frame_seq_) {
+    return;
+  }
+  frame_seq_ = frame.seq;
+
   int    pitch;
   Pixel *dst;
-  int    emphasis = nes_.ppu().color_emphasis();
-  auto   src      = nes_.ppu().frame();
-  auto   palette  = PALETTE[emphasis];
-
-  assert(emphasis >= 0 && emphasis < 8);
 
   SDL_LockTexture(frame_.get(), nullptr, (void **)&dst, &pitch);
   pitch /= 4;
   for (int row = 0; row < FRAME_HEIGHT; row++) {
-    for (int col = 0; col < FRAME_WIDTH; col++) {
-      int src_idx  = (row + OVERSCAN) * 256 + col;
-      int dst_idx  = row * pitch + col;
-      dst[dst_idx] = palette[src[src_idx]];
-    }
+    int src_row = row + OVERSCAN;
+    convert_colors(
+        &dst[row * pitch],
+        &frame.pixels[src_row * 256],
+        FRAME_WIDTH,
+        frame.emphasis[src_row]
+    );
   }
   SDL_UnlockTexture(frame_.get());
 }
@@ -1,11 +1,22 @@
 #pragma once
 
 #include "src/app/sdl.h"
+#include "src/app/triple_buffer.h"
 #include "src/emu/nes.h"
 
+// A completed frame along with the color emphasis of each scanline, as handed
+// off from the emulator thread to the UI thread (see AppWindow::publish_frame).
+struct Frame {
+  int64_t seq; // increases with every frame published
+  uint8_t pixels[256 * 240];
+  uint8_t emphasis[240];
+};
+
+using FrameBuffer = TripleBuffer<Frame>;
+
 class GameWindow {
 public:
-  GameWindow(Nes &nes, SDL_Renderer *renderer);
+  GameWindow(Nes &nes, FrameBuffer &frames, SDL_Renderer *renderer);
 
   bool focused() const { return focused_; }
   void render();
@@ -14,6 +25,8 @@ private:
   void prepare_frame();
 
   Nes          &nes_;
+  FrameBuffer  &frames_;
   SDLTextureRes frame_;
   bool          focused_;
+  int64_t       frame_seq_;
 };
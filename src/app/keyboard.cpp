@@ -16,18 +16,16 @@ static constexpr SDL_Scancode KEYMAP[] = {
     SDL_SCANCODE_Z,
 };
 
-int KeyboardController::poll() {
-  if (!enabled_) {
-    return 0;
-  }
-
-  SDL_PumpEvents();
+void KeyboardController::update(bool enabled) {
   const Uint8 *states = SDL_GetKeyboardState(NULL);
   int          result = 0;
-  for (int i = 0; i < 10; i++) {
+  for (int i = 0; enabled && i < 10; i++) {
     if (states[KEYMAP[i]]) {
       result |= 1u << i;
     }
   }
-  return result;
+  buttons_.store(result, std::memory_order_relaxed);
+  rewinding_.store(
+      enabled && states[SDL_SCANCODE_BACKSPACE], std::memory_order_relaxed
+  );
 }
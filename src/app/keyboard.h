@@ -1,13 +1,22 @@
 #pragma once
 
+#include <atomic>
+
 #include "src/emu/input.h"
 
 class KeyboardController : public Controller {
 public:
-  void set_enabled(bool enabled) { enabled_ = enabled; }
+  // Samples the keyboard state. N.B., SDL only lets the main thread handle
+  // events, so this is called from the UI loop and poll (called from the
+  // emulator thread) just returns the latest sample.
+  void update(bool enabled);
+
+  int poll() override { return buttons_.load(std::memory_order_relaxed); }
 
-  int poll() override;
+  // Whether the rewind key is held (see AppWindow::step_back).
+  bool rewinding() const { return rewinding_.load(std::memory_order_relaxed); }
 
 private:
-  bool enabled_ = true;
+  std::atomic<int>  buttons_   = 0;
+  std::atomic<bool> rewinding_ = false;
 };
@@ -1,5 +1,9 @@
 #include <cassert>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "src/app/palette.h"
 
 const Pixel RAW_PALETTE[512] = {
@@ -229,3 +233,25 @@ const Pixel RAW_PALETTE[512] = {
 };
 
 const Pixel (*PALETTE)[64] = (Pixel(*)[64])RAW_PALETTE;
+
+void convert_colors(Pixel *dst, const uint8_t *src, int count, int emphasis) {
+  assert(emphasis >= 0 && emphasis < 8);
+
+  // N.B., colors are masked since palette RAM only has 6 bits per entry, but
+  // the PPU doesn't bother to mask them on writes.
+  const Pixel *palette = PALETTE[emphasis];
+  int          i       = 0;
+#ifdef __AVX2__
+  // Looks up 8 colors at a time with a gather.
+  const __m256i mask = _mm256_set1_epi32(0x3f);
+  for (; i + 8 <= count; i += 8) {
+    __m128i colors  = _mm_loadl_epi64((const __m128i *)&src[i]);
+    __m256i indices = _mm256_and_si256(_mm256_cvtepu8_epi32(colors), mask);
+    __m256i pixels  = _mm256_i32gather_epi32((const int *)palette, indices, 4);
+    _mm256_storeu_si256((__m256i *)&dst[i], pixels);
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i] = palette[src[i] & 0x3f];
+  }
+}
@@ -1,4 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
 #include "src/app/pixel.h"
 
 extern const Pixel RAW_PALETTE[512];
 extern const Pixel (*PALETTE)[64];
+
+// Converts count NES colors (as found in Ppu::frame) to pixels, using the
+// given color emphasis bits (see Ppu::color_emphasis).
+void convert_colors(Pixel *dst, const uint8_t *src, int count, int emphasis);
@@ -87,14 +87,17 @@ void clear_texture(SDL_Texture *texture, int height) {
   SDL_UnlockTexture(texture);
 }
 
-SDLAudioDeviceRes::SDLAudioDeviceRes() {
+SDLAudioDeviceRes::SDLAudioDeviceRes(
+    SDL_AudioCallback callback, void *userdata
+) {
   SDL_AudioSpec audio_spec;
   SDL_zero(audio_spec);
   audio_spec.freq     = OUTPUT_RATE;
   audio_spec.format   = AUDIO_F32SYS;
   audio_spec.channels = 1;
-  audio_spec.samples  = 1024;
-  audio_spec.callback = NULL;
+  audio_spec.samples  = BUFFER_SAMPLES;
+  audio_spec.callback = callback;
+  audio_spec.userdata = userdata;
 
   device_ = SDL_OpenAudioDevice(NULL, 0, &audio_spec, NULL, 0);
   if (!device_) {
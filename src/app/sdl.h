@@ -53,9 +53,11 @@ void clear_texture(SDL_Texture *texture, int height);
 
 class SDLAudioDeviceRes {
 public:
-  static constexpr int OUTPUT_RATE = 44100;
+  static constexpr int OUTPUT_RATE    = 44100;
+  static constexpr int BUFFER_SAMPLES = 512;
 
-  SDLAudioDeviceRes();
+  // N.B., the callback runs on SDL's audio thread.
+  SDLAudioDeviceRes(SDL_AudioCallback callback, void *userdata);
   ~SDLAudioDeviceRes();
 
   SDL_AudioDeviceID get() const { return device_; }
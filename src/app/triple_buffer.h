@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of values from a single writer thread to a single reader
+// thread. The writer fills in back() and then publishes it, and the reader
+// picks up the most recently published value with update(). Neither side ever
+// waits for the other, and values that the reader doesn't get to in time are
+// simply dropped.
+template <typename T> class TripleBuffer {
+public:
+  // Writer side.
+  T   &back() { return slots_[back_]; }
+  void publish() {
+    back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  // Reader side. Returns whether a new value was published since the last call.
+  const T &front() const { return slots_[front_]; }
+  bool     update() {
+    if (!(middle_.load(std::memory_order_relaxed) & FRESH)) {
+      return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+
+private:
+  static constexpr uint8_t INDEX = 0b011;
+  static constexpr uint8_t FRESH = 0b100;
+
+  // N.B., the slot in the middle is owned by neither side. Publishing swaps it
+  // with the back slot, and updating swaps it with the front slot.
+  T                                slots_[3] = {};
+  alignas(64) std::atomic<uint8_t> middle_   = 1;
+  uint8_t                          back_     = 0;
+  uint8_t                          front_    = 2;
+};
@@ -1,8 +1,17 @@
 #include <bit>
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <numbers>
+#include <stdexcept>
 
 #include "src/emu/apu.h"
 #include "src/emu/cpu.h"
+#include "src/emu/state.h"
 
 // References:
 // Forum thread #1: https://forums.nesdev.org/viewtopic.php?f=3&t=13749
@@ -269,6 +278,111 @@ static constexpr uint8_t get_bits(uint8_t x) {
 
 static constexpr int64_t APU_HZ = 1789773;
 
+static constexpr int NEVER = std::numeric_limits<int>::max();
+
+template <std::size_t N>
+static std::array<int, N> make_mixer_amps(const float (&lut)[N]) {
+  std::array<int, N> amps;
+  for (std::size_t i = 0; i < N; i++) {
+    amps[i] = (int)std::lround(lut[i] * ApuBlip::AMP_UNIT);
+  }
+  return amps;
+}
+
+static const auto MIXER_PULSE_AMPS = make_mixer_amps(MIXER_PULSE_LUT);
+static const auto MIXER_TND_AMPS   = make_mixer_amps(MIXER_TND_LUT);
+
+static constexpr int BLIP_WIDTH       = 2 * ApuBlip::HALF_WIDTH;
+static constexpr int BLIP_PHASE_BITS  = 6;
+static constexpr int BLIP_PHASES      = 1 << BLIP_PHASE_BITS;
+static constexpr int BLIP_FRAC_BITS   = 32;
+static constexpr int BLIP_PHASE_SHIFT = BLIP_FRAC_BITS - BLIP_PHASE_BITS;
+static constexpr int BLIP_KERNEL_UNIT = 1 << 15;
+
+static constexpr double BLIP_CUTOFF = 0.9; // fraction of Nyquist
+
+using BlipKernel = std::array<std::array<int, BLIP_WIDTH>, BLIP_PHASES>;
+
+static double sinc(double x) {
+  return x == 0 ? 1 : std::sin(std::numbers::pi * x) / (std::numbers::pi * x);
+}
+
+static double blackman(double t) {
+  double w = std::numbers::pi * t / ApuBlip::HALF_WIDTH;
+  return 0.42 + 0.5 * std::cos(w) + 0.08 * std::cos(2 * w);
+}
+
+// Windowed sinc impulses, one per sub-sample phase. Each phase is rounded so
+// that its taps sum to exactly BLIP_KERNEL_UNIT, i.e., a delta integrates to
+// exactly its own size.
+static BlipKernel make_blip_kernel() {
+  BlipKernel kernel;
+  for (int phase = 0; phase < BLIP_PHASES; phase++) {
+    double taps[BLIP_WIDTH];
+    double sum = 0;
+    for (int i = 0; i < BLIP_WIDTH; i++) {
+      double t = i - (ApuBlip::HALF_WIDTH - 0.5) - (double)phase / BLIP_PHASES;
+      taps[i]  = sinc(BLIP_CUTOFF * t) * blackman(t);
+      sum += taps[i];
+    }
+    int total = 0;
+    for (int i = 0; i < BLIP_WIDTH; i++) {
+      kernel[phase][i] = (int)std::lround(taps[i] / sum * BLIP_KERNEL_UNIT);
+      total += kernel[phase][i];
+    }
+    kernel[phase][ApuBlip::HALF_WIDTH] += BLIP_KERNEL_UNIT - total;
+  }
+  return kernel;
+}
+
+static const BlipKernel BLIP_KERNEL = make_blip_kernel();
+
+void ApuBlip::set_sample_rate(int64_t sample_rate) {
+  if (sample_rate <= 0 || sample_rate > MAX_SAMPLE_RATE) {
+    throw std::runtime_error(
+        std::format("unsupported sample rate: {}", sample_rate)
+    );
+  }
+  sample_rate_ = sample_rate;
+}
+
+void ApuBlip::reset() {
+  std::memset(deltas_, 0, sizeof(deltas_));
+  integrator_ = 0;
+  offset_     = 0;
+  factor_     = (sample_rate_ << BLIP_FRAC_BITS) / APU_HZ;
+}
+
+void ApuBlip::add_delta(int time, int delta) {
+  assert(time >= 0 && time < MAX_FRAME_CYCLES);
+  int64_t pos   = offset_ + time * factor_;
+  int     index = (int)(pos >> BLIP_FRAC_BITS);
+  int     phase = (int)(pos >> BLIP_PHASE_SHIFT) & (BLIP_PHASES - 1);
+  assert(index + BLIP_WIDTH <= (int)std::size(deltas_));
+  const auto &kernel = BLIP_KERNEL[phase];
+  for (int i = 0; i < BLIP_WIDTH; i++) {
+    deltas_[index + i] += (int64_t)kernel[i] * delta;
+  }
+}
+
+void ApuBlip::end_frame(int time, ApuBuffer &out) {
+  assert(time >= 0 && time <= MAX_FRAME_CYCLES);
+  offset_ += time * factor_;
+
+  // N.B., later deltas can only land at or after the new frame start, so every
+  // sample before it is final.
+  int   count = (int)(offset_ >> BLIP_FRAC_BITS);
+  float scale = 1.0f / ((float)BLIP_KERNEL_UNIT * AMP_UNIT);
+  for (int i = 0; i < count; i++) {
+    integrator_ += deltas_[i];
+    out.write((float)integrator_ * scale);
+  }
+  std::memmove(deltas_, deltas_ + count, BLIP_WIDTH * sizeof(deltas_[0]));
+  std::memset(deltas_ + BLIP_WIDTH, 0, count * sizeof(deltas_[0]));
+  offset_ -= (int64_t)count << BLIP_FRAC_BITS;
+  factor_ = (sample_rate_ << BLIP_FRAC_BITS) / APU_HZ;
+}
+
 void Apu::set_cpu(Cpu *cpu) {
   cpu_ = cpu;
   dmc_.set_cpu(cpu);
@@ -282,10 +396,13 @@ void Apu::power_on() {
   noise_.power_on();
   dmc_.power_on();
   fc_.power_on();
+  blip_.reset();
   out_.reset();
-  cycles_         = 0;
-  sample_counter_ = APU_HZ;
-  output_ema_     = 0;
+  cycles_    = 0;
+  mix_pulse_ = 0;
+  mix_tnd_   = 0;
+  blip_time_ = 0;
+  mix();
 }
 
 void Apu::reset() {
@@ -295,32 +412,101 @@ void Apu::reset() {
   noise_.reset();
   dmc_.reset();
   fc_.reset();
+  blip_.reset();
   out_.reset();
-  cycles_         = 0;
-  sample_counter_ = APU_HZ;
-  output_ema_     = 0;
+  cycles_    = 0;
+  mix_pulse_ = 0;
+  mix_tnd_   = 0;
+  blip_time_ = 0;
+  mix();
 }
 
-void Apu::write_4000(uint8_t x) { pulse_1_.write_R0(x); }
-void Apu::write_4001(uint8_t x) { pulse_1_.write_R1(x); }
-void Apu::write_4002(uint8_t x) { pulse_1_.write_R2(x); }
-void Apu::write_4003(uint8_t x) { pulse_1_.write_R3(x); }
+void Apu::save_state(StateWriter &w) const {
+  pulse_1_.save_state(w);
+  pulse_2_.save_state(w);
+  triangle_.save_state(w);
+  noise_.save_state(w);
+  dmc_.save_state(w);
+  fc_.save_state(w);
+  w.write(cycles_);
+}
 
-void Apu::write_4004(uint8_t x) { pulse_2_.write_R0(x); }
-void Apu::write_4005(uint8_t x) { pulse_2_.write_R1(x); }
-void Apu::write_4006(uint8_t x) { pulse_2_.write_R2(x); }
-void Apu::write_4007(uint8_t x) { pulse_2_.write_R3(x); }
+void Apu::load_state(StateReader &r) {
+  pulse_1_.load_state(r);
+  pulse_2_.load_state(r);
+  triangle_.load_state(r);
+  noise_.load_state(r);
+  dmc_.load_state(r);
+  fc_.load_state(r);
+  r.read(cycles_);
+  mix();
+}
 
-void Apu::write_4008(uint8_t x) { triangle_.write_4008(x); }
-void Apu::write_400A(uint8_t x) { triangle_.write_400A(x); }
-void Apu::write_400B(uint8_t x) { triangle_.write_400B(x); }
+void Apu::write_4000(uint8_t x) {
+  pulse_1_.write_R0(x);
+  update_pulse();
+}
+void Apu::write_4001(uint8_t x) {
+  pulse_1_.write_R1(x);
+  update_pulse();
+}
+void Apu::write_4002(uint8_t x) {
+  pulse_1_.write_R2(x);
+  update_pulse();
+}
+void Apu::write_4003(uint8_t x) {
+  pulse_1_.write_R3(x);
+  update_pulse();
+}
 
-void Apu::write_400C(uint8_t x) { noise_.write_400C(x); }
-void Apu::write_400E(uint8_t x) { noise_.write_400E(x); }
-void Apu::write_400F(uint8_t x) { noise_.write_400F(x); }
+void Apu::write_4004(uint8_t x) {
+  pulse_2_.write_R0(x);
+  update_pulse();
+}
+void Apu::write_4005(uint8_t x) {
+  pulse_2_.write_R1(x);
+  update_pulse();
+}
+void Apu::write_4006(uint8_t x) {
+  pulse_2_.write_R2(x);
+  update_pulse();
+}
+void Apu::write_4007(uint8_t x) {
+  pulse_2_.write_R3(x);
+  update_pulse();
+}
+
+void Apu::write_4008(uint8_t x) {
+  triangle_.write_4008(x);
+  update_tnd();
+}
+void Apu::write_400A(uint8_t x) {
+  triangle_.write_400A(x);
+  update_tnd();
+}
+void Apu::write_400B(uint8_t x) {
+  triangle_.write_400B(x);
+  update_tnd();
+}
+
+void Apu::write_400C(uint8_t x) {
+  noise_.write_400C(x);
+  update_tnd();
+}
+void Apu::write_400E(uint8_t x) {
+  noise_.write_400E(x);
+  update_tnd();
+}
+void Apu::write_400F(uint8_t x) {
+  noise_.write_400F(x);
+  update_tnd();
+}
 
 void Apu::write_4010(uint8_t x) { dmc_.write_4010(x); }
-void Apu::write_4011(uint8_t x) { dmc_.write_4011(x); }
+void Apu::write_4011(uint8_t x) {
+  dmc_.write_4011(x);
+  update_tnd();
+}
 void Apu::write_4012(uint8_t x) { dmc_.write_4012(x); }
 void Apu::write_4013(uint8_t x) { dmc_.write_4013(x); }
 
@@ -348,6 +534,7 @@ static int get_fc_cycles_left(int next_step, bool mode) {
 void Apu::write_4017(uint8_t x) {
   auto clock = fc_.write_4017(x);
   clock_frame_counter(clock);
+  mix();
 }
 
 void Apu::write_4015(uint8_t x) {
@@ -356,6 +543,7 @@ void Apu::write_4015(uint8_t x) {
   triangle_.set_enabled(get_bit<2>(x));
   noise_.set_enabled(get_bit<3>(x));
   dmc_.set_enabled(get_bit<4>(x));
+  mix();
 }
 
 uint8_t Apu::read_4015() {
@@ -400,28 +588,123 @@ void Apu::step() {
   auto clock = fc_.step();
   clock_frame_counter(clock);
 
+  mix();
   cycles_++;
 
-  // Reference: https://www.nesdev.org/wiki/APU_Mixer#Lookup_Table
-  uint8_t pulse1   = pulse_1_.output();
-  uint8_t pulse2   = pulse_2_.output();
-  uint8_t triangle = triangle_.output(cycles_ & 1);
+  if (audio_enabled_ && ++blip_time_ == ApuBlip::MAX_FRAME_CYCLES) {
+    blip_.end_frame(blip_time_, out_);
+    blip_time_ = 0;
+  }
+}
+
+void Apu::run_until(int64_t cycles) {
+  while (cycles_ < cycles) {
+    int64_t n = std::min(cycles - cycles_, cycles_until_event());
+    skip((int)n - 1);
+    step();
+  }
+}
+
+int64_t Apu::cycles_until_event() const {
+  // N.B., the pulse and noise timers only count down on odd cycles.
+  int odd    = (int)(cycles_ & 1);
+  int cycles = std::min({
+      triangle_.steps_until_clock(),
+      dmc_.steps_until_clock(),
+      2 * pulse_1_.steps_until_clock() - odd,
+      2 * pulse_2_.steps_until_clock() - odd,
+      2 * noise_.steps_until_clock() - odd,
+      fc_.steps_until_clock(),
+  });
+  if (audio_enabled_) {
+    cycles = std::min(cycles, ApuBlip::MAX_FRAME_CYCLES - blip_time_);
+  }
+  return cycles;
+}
+
+void Apu::skip(int cycles) {
+  int odd_cycles = (cycles + (int)(cycles_ & 1)) / 2;
+  pulse_1_.skip(odd_cycles);
+  pulse_2_.skip(odd_cycles);
+  triangle_.skip(cycles);
+  noise_.skip(odd_cycles);
+  dmc_.skip(cycles);
+  fc_.skip(cycles);
+
+  if (audio_enabled_ && triangle_.ultrasonic()) {
+    // N.B., an ultrasonic triangle still alternates between 7 and 8 on every
+    // cycle (see update_tnd), and nothing else in the TND group changes.
+    int nd     = noise_.output() * 2 + dmc_.output();
+    int amp[2] = {MIXER_TND_AMPS[7 * 3 + nd], MIXER_TND_AMPS[8 * 3 + nd]};
+    for (int i = 0; i < cycles; i++) {
+      int next = amp[!(cycles_ & 1)];
+      if (next != mix_tnd_) {
+        blip_.add_delta(blip_time_, next - mix_tnd_);
+        mix_tnd_ = next;
+      }
+      cycles_++;
+      blip_time_++;
+    }
+  } else {
+    cycles_ += cycles;
+    if (audio_enabled_) {
+      blip_time_ += cycles;
+    }
+  }
+}
+
+// Reference: https://www.nesdev.org/wiki/APU_Mixer#Lookup_Table
+//
+// N.B., the mixer is non-linear within the pulse and TND groups, so deltas are
+// taken per group rather than per channel.
+void Apu::mix() {
+  update_pulse();
+  update_tnd();
+}
+
+void Apu::update_pulse() {
+  if (!audio_enabled_) {
+    return;
+  }
+  uint8_t pulse1 = pulse_1_.output();
+  uint8_t pulse2 = pulse_2_.output();
+  assert(pulse1 < 16 && pulse2 < 16);
+
+  int amp = MIXER_PULSE_AMPS[pulse1 + pulse2];
+  if (amp != mix_pulse_) {
+    blip_.add_delta(blip_time_, amp - mix_pulse_);
+    mix_pulse_ = amp;
+  }
+}
+
+void Apu::update_tnd() {
+  if (!audio_enabled_) {
+    return;
+  }
+  // N.B., the delta lands as of the end of the current step, which is also
+  // when an ultrasonic triangle flips between 7 and 8.
+  uint8_t triangle = triangle_.output(!(cycles_ & 1));
   uint8_t noise    = noise_.output();
   uint8_t dmc      = dmc_.output();
-  assert(pulse1 < 16 && pulse2 < 16 && triangle < 16 && noise < 16);
-  assert(dmc < 128);
-  float output = MIXER_PULSE_LUT[pulse1 + pulse2] +
-                 MIXER_TND_LUT[triangle * 3 + noise * 2 + dmc];
-  assert(output >= 0 && output <= 1);
-  output_ema_ = output * 0.05f + output_ema_ * 0.95f;
+  assert(triangle < 16 && noise < 16 && dmc < 128);
 
-  sample_counter_ -= sample_rate_;
-  if (sample_counter_ <= 0) {
-    out_.write(output_ema_);
-    sample_counter_ += APU_HZ;
+  int amp = MIXER_TND_AMPS[triangle * 3 + noise * 2 + dmc];
+  if (amp != mix_tnd_) {
+    blip_.add_delta(blip_time_, amp - mix_tnd_);
+    mix_tnd_ = amp;
   }
 }
 
+ApuBuffer &Apu::output() {
+  blip_.end_frame(blip_time_, out_);
+  blip_time_ = 0;
+  return out_;
+}
+
+int64_t Apu::cycles_until_irq() const {
+  return std::min(fc_.cycles_until_irq(), dmc_.cycles_until_irq());
+}
+
 void Apu::clock_frame_counter(ApuFrameCounter::Clock clock) {
   if (clock.quarter_frame) {
     pulse_1_.clock_quarter_frame();
@@ -465,6 +748,22 @@ void ApuPulse::reset() {
   freq_timer_       = 0;
 }
 
+void ApuPulse::save_state(StateWriter &w) const {
+  w.write(enabled_, duty_cycle_, duty_bit_, length_counter_, length_enabled_);
+  w.write(decay_loop_, decay_enabled_, decay_reset_flag_, decay_counter_);
+  w.write(decay_hidden_vol_, decay_vol_, sweep_counter_, sweep_timer_);
+  w.write(sweep_negate_, sweep_shift_, sweep_reload_, sweep_enabled_);
+  w.write(freq_counter_, freq_timer_);
+}
+
+void ApuPulse::load_state(StateReader &r) {
+  r.read(enabled_, duty_cycle_, duty_bit_, length_counter_, length_enabled_);
+  r.read(decay_loop_, decay_enabled_, decay_reset_flag_, decay_counter_);
+  r.read(decay_hidden_vol_, decay_vol_, sweep_counter_, sweep_timer_);
+  r.read(sweep_negate_, sweep_shift_, sweep_reload_, sweep_enabled_);
+  r.read(freq_counter_, freq_timer_);
+}
+
 void ApuPulse::set_enabled(bool enabled) {
   enabled_ = enabled;
   if (!enabled) {
@@ -516,6 +815,11 @@ void ApuPulse::step() {
   }
 }
 
+void ApuPulse::skip(int steps) {
+  assert(steps < steps_until_clock());
+  freq_counter_ = (uint16_t)(freq_counter_ - steps);
+}
+
 void ApuPulse::clock_quarter_frame() {
   if (decay_reset_flag_) {
     decay_reset_flag_ = false;
@@ -597,22 +901,48 @@ void ApuTriangle::reset() {
   freq_timer_     = 0;
 }
 
+void ApuTriangle::save_state(StateWriter &w) const {
+  w.write(enabled_, tri_step_, length_enabled_, length_counter_);
+  w.write(linear_control_, linear_reload_, linear_counter_, linear_load_);
+  w.write(freq_counter_, freq_timer_);
+}
+
+void ApuTriangle::load_state(StateReader &r) {
+  r.read(enabled_, tri_step_, length_enabled_, length_counter_);
+  r.read(linear_control_, linear_reload_, linear_counter_, linear_load_);
+  r.read(freq_counter_, freq_timer_);
+}
+
+bool ApuTriangle::clocking() const {
+  return length_counter_ != 0 && linear_counter_ != 0 && !ultrasonic();
+}
+
 void ApuTriangle::step() {
-  bool ultrasonic = freq_timer_ < 2 && freq_counter_ == 0;
-  bool clock_triunit;
-  if (length_counter_ == 0 || linear_counter_ == 0 || ultrasonic) {
-    clock_triunit = false;
+  if (!clocking()) {
+    return;
+  }
+
+  if (freq_counter_ > 0) {
+    freq_counter_--;
   } else {
-    clock_triunit = true;
+    freq_counter_ = freq_timer_;
+    tri_step_     = (tri_step_ + 1) & 0x1f;
   }
+}
 
-  if (clock_triunit) {
-    if (freq_counter_ > 0) {
-      freq_counter_--;
-    } else {
-      freq_counter_ = freq_timer_;
-      tri_step_     = (tri_step_ + 1) & 0x1f;
-    }
+int ApuTriangle::steps_until_clock() const {
+  if (!clocking()) {
+    return NEVER;
+  }
+  // N.B., with a period under 2, the counter running out makes the channel
+  // ultrasonic rather than reloading it.
+  return freq_timer_ < 2 ? freq_counter_ : freq_counter_ + 1;
+}
+
+void ApuTriangle::skip(int steps) {
+  assert(steps < steps_until_clock());
+  if (clocking()) {
+    freq_counter_ = (uint16_t)(freq_counter_ - steps);
   }
 }
 
@@ -634,9 +964,8 @@ void ApuTriangle::clock_half_frame() {
   }
 }
 
-uint8_t ApuTriangle::output(bool odd_cycle) {
-  bool ultrasonic = freq_timer_ < 2 && freq_counter_ == 0;
-  if (ultrasonic) {
+uint8_t ApuTriangle::output(bool odd_cycle) const {
+  if (ultrasonic()) {
     return 7 + odd_cycle;
   } else if (tri_step_ & 0x10) {
     return tri_step_ ^ 0x1f;
@@ -690,6 +1019,20 @@ void ApuNoise::reset() {
   noise_shift_      = 1;
 }
 
+void ApuNoise::save_state(StateWriter &w) const {
+  w.write(enabled_, length_counter_, length_enabled_, decay_loop_);
+  w.write(decay_enabled_, decay_reset_flag_, decay_counter_);
+  w.write(decay_hidden_vol_, decay_vol_, freq_counter_, freq_timer_);
+  w.write(shift_mode_, noise_shift_);
+}
+
+void ApuNoise::load_state(StateReader &r) {
+  r.read(enabled_, length_counter_, length_enabled_, decay_loop_);
+  r.read(decay_enabled_, decay_reset_flag_, decay_counter_);
+  r.read(decay_hidden_vol_, decay_vol_, freq_counter_, freq_timer_);
+  r.read(shift_mode_, noise_shift_);
+}
+
 void ApuNoise::step() {
   if (freq_counter_ > 0) {
     freq_counter_--;
@@ -706,6 +1049,11 @@ void ApuNoise::step() {
   }
 }
 
+void ApuNoise::skip(int steps) {
+  assert(steps < steps_until_clock());
+  freq_counter_ = (uint16_t)(freq_counter_ - steps);
+}
+
 void ApuNoise::clock_quarter_frame() {
   if (decay_reset_flag_) {
     decay_reset_flag_ = false;
@@ -773,6 +1121,10 @@ void ApuNoise::write_400F(uint8_t x) {
   decay_reset_flag_ = true;
 }
 
+static constexpr uint16_t DMC_FREQ_TABLE[] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
 void ApuDmc::power_on() { reset(); }
 
 void ApuDmc::reset() {
@@ -788,10 +1140,22 @@ void ApuDmc::reset() {
   addr_load_     = 0;
   length_        = 0;
   length_load_   = 0;
-  freq_timer_    = 0;
+  freq_timer_    = DMC_FREQ_TABLE[0]; // i.e., $4010 = 0
   freq_counter_  = 0;
 }
 
+void ApuDmc::save_state(StateWriter &w) const {
+  w.write(irq_enabled_, loop_, output_, output_shift_, output_silent_);
+  w.write(output_bits_, sample_buffer_, sample_empty_, addr_, addr_load_);
+  w.write(length_, length_load_, freq_timer_, freq_counter_);
+}
+
+void ApuDmc::load_state(StateReader &r) {
+  r.read(irq_enabled_, loop_, output_, output_shift_, output_silent_);
+  r.read(output_bits_, sample_buffer_, sample_empty_, addr_, addr_load_);
+  r.read(length_, length_load_, freq_timer_, freq_counter_);
+}
+
 void ApuDmc::set_enabled(bool enabled) {
   if (enabled) {
     if (length_ == 0) {
@@ -805,10 +1169,6 @@ void ApuDmc::set_enabled(bool enabled) {
   cpu_->clear_IRQ(Cpu::APU_DMC);
 }
 
-static constexpr uint16_t DMC_FREQ_TABLE[] = {
-    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
-};
-
 void ApuDmc::write_4010(uint8_t x) {
   irq_enabled_ = get_bit<7>(x);
   loop_        = get_bit<6>(x);
@@ -827,6 +1187,16 @@ void ApuDmc::write_4012(uint8_t x) {
 
 void ApuDmc::write_4013(uint8_t x) { length_load_ = (uint16_t)((x << 4) + 1); }
 
+int64_t ApuDmc::cycles_until_irq() const {
+  if (!irq_enabled_ || loop_ || length_ == 0) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  // N.B., the first two fetches can happen back to back (the sample buffer may
+  // be empty and the output shifter about to drain). After that, there's one
+  // fetch per 8 timer periods.
+  return std::max(length_ - 2, 0) * 8 * (freq_timer_ + 1);
+}
+
 void ApuDmc::step() {
   if (freq_counter_ > 0) {
     freq_counter_--;
@@ -866,6 +1236,19 @@ void ApuDmc::step() {
   }
 }
 
+int ApuDmc::steps_until_clock() const {
+  // N.B., an empty sample buffer gets refilled on the very next step.
+  if (length_ > 0 && sample_empty_) {
+    return 1;
+  }
+  return freq_counter_ + 1;
+}
+
+void ApuDmc::skip(int steps) {
+  assert(steps < steps_until_clock());
+  freq_counter_ = (uint16_t)(freq_counter_ - steps);
+}
+
 void ApuFrameCounter::power_on() { reset(); }
 
 void ApuFrameCounter::reset() {
@@ -875,6 +1258,14 @@ void ApuFrameCounter::reset() {
   cycles_left_ = 0;
 }
 
+void ApuFrameCounter::save_state(StateWriter &w) const {
+  w.write(mode_, irq_enabled_, next_step_, cycles_left_);
+}
+
+void ApuFrameCounter::load_state(StateReader &r) {
+  r.read(mode_, irq_enabled_, next_step_, cycles_left_);
+}
+
 ApuFrameCounter::Clock ApuFrameCounter::write_4017(uint8_t x) {
   mode_        = get_bit<7>(x);
   irq_enabled_ = !get_bit<6>(x);
@@ -892,6 +1283,17 @@ ApuFrameCounter::Clock ApuFrameCounter::write_4017(uint8_t x) {
   }
 }
 
+int64_t ApuFrameCounter::cycles_until_irq() const {
+  if (mode_ || !irq_enabled_) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  int64_t cycles = cycles_left_;
+  for (int step = next_step_ + 1; step <= 3; step++) {
+    cycles += get_fc_cycles_left(step, mode_) + 1;
+  }
+  return cycles;
+}
+
 ApuFrameCounter::Clock ApuFrameCounter::step() {
   if (cycles_left_ > 0) {
     cycles_left_--;
@@ -4,6 +4,8 @@
 #include <cstdint>
 
 class Cpu;
+class StateReader;
+class StateWriter;
 
 class ApuPulse {
 public:
@@ -11,7 +13,11 @@ public:
 
   void    power_on();
   void    reset();
+  void    save_state(StateWriter &w) const;
+  void    load_state(StateReader &r);
   void    step();
+  int     steps_until_clock() const { return freq_counter_ + 1; }
+  void    skip(int steps);
   void    clock_quarter_frame();
   void    clock_half_frame();
   uint8_t output();
@@ -58,10 +64,15 @@ class ApuTriangle {
 public:
   void    power_on();
   void    reset();
+  void    save_state(StateWriter &w) const;
+  void    load_state(StateReader &r);
   void    step();
+  int     steps_until_clock() const;
+  void    skip(int steps);
   void    clock_quarter_frame();
   void    clock_half_frame();
-  uint8_t output(bool odd_cycle);
+  bool    ultrasonic() const { return freq_timer_ < 2 && freq_counter_ == 0; }
+  uint8_t output(bool odd_cycle) const;
 
   uint8_t length_counter() const { return length_counter_; }
   void    set_enabled(bool enabled);
@@ -71,6 +82,8 @@ public:
   void write_400B(uint8_t x);
 
 private:
+  bool clocking() const;
+
   bool enabled_;
 
   uint8_t tri_step_;
@@ -91,7 +104,11 @@ class ApuNoise {
 public:
   void    power_on();
   void    reset();
+  void    save_state(StateWriter &w) const;
+  void    load_state(StateReader &r);
   void    step();
+  int     steps_until_clock() const { return freq_counter_ + 1; }
+  void    skip(int steps);
   void    clock_quarter_frame();
   void    clock_half_frame();
   uint8_t output();
@@ -129,11 +146,16 @@ public:
 
   void    power_on();
   void    reset();
+  void    save_state(StateWriter &w) const;
+  void    load_state(StateReader &r);
   void    step();
+  int     steps_until_clock() const;
+  void    skip(int steps);
   uint8_t output() { return output_; }
 
   uint16_t length_counter() const { return length_; }
   void     set_enabled(bool enabled);
+  int64_t  cycles_until_irq() const;
 
   void write_4010(uint8_t x);
   void write_4011(uint8_t x);
@@ -171,9 +193,14 @@ public:
 
   void set_cpu(Cpu *cpu) { cpu_ = cpu; }
 
-  void  power_on();
-  void  reset();
-  Clock step();
+  void    power_on();
+  void    reset();
+  void    save_state(StateWriter &w) const;
+  void    load_state(StateReader &r);
+  Clock   step();
+  int     steps_until_clock() const { return cycles_left_ + 1; }
+  void    skip(int steps) { cycles_left_ -= steps; }
+  int64_t cycles_until_irq() const;
 
   Clock write_4017(uint8_t x);
 
@@ -200,18 +227,73 @@ private:
   int64_t read_;
 };
 
+// Band-limited step synthesis in the style of blip_buf. Amplitude changes are
+// added as deltas at the APU cycle they happen on, and end_frame() resamples
+// everything up to that point into output samples. N.B., deltas and the
+// kernel are fixed point, so the integrated output never drifts.
+class ApuBlip {
+public:
+  static constexpr int     MAX_FRAME_CYCLES = 1 << 14;
+  static constexpr int     AMP_UNIT         = 1 << 15; // amplitude of 1.0
+  static constexpr int64_t MAX_SAMPLE_RATE  = 192000;
+  static constexpr int     HALF_WIDTH       = 8; // kernel taps either side
+
+  // Takes effect at the end of the current frame.
+  void set_sample_rate(int64_t sample_rate);
+
+  void reset();
+  void add_delta(int time, int delta);
+  void end_frame(int time, ApuBuffer &out);
+
+private:
+  static constexpr int BUF_SIZE = 2048;
+
+  int64_t deltas_[BUF_SIZE + 2 * HALF_WIDTH];
+  int64_t integrator_;
+  int64_t offset_; // frame start, in 32.32 fixed point samples
+  int64_t factor_; // samples per cycle, in 32.32 fixed point
+  int64_t sample_rate_ = 44100;
+};
+
 class Apu {
 public:
   void set_cpu(Cpu *cpu);
-  void set_sample_rate(int64_t sample_rate) { sample_rate_ = sample_rate; }
+  void set_sample_rate(int64_t sample_rate) {
+    blip_.set_sample_rate(sample_rate);
+  }
+
+  // Turns audio output off, e.g., while running ahead (see RunAhead). The
+  // channels still run as usual, but the mixer and resampler are left alone,
+  // so the output carries on from where it was once turned back on.
+  void set_audio_enabled(bool enabled) { audio_enabled_ = enabled; }
+  bool audio_enabled() const { return audio_enabled_; }
 
   void power_on();
   void reset();
   void step();
 
-  ApuBuffer &output() { return out_; }
+  // N.B., runs the cycles in between timer clocks in one go. Each channel's
+  // steps_until_clock() counts the steps up to and including the next one
+  // that clocks its timer (i.e., that may change its output), and skip() runs
+  // steps that don't. Produces the same audio as calling step() each cycle.
+  void run_until(int64_t cycles);
+
+  // See Nes::save_state. N.B., the resampler and output buffer belong to the
+  // host rather than the NES, so they're left alone.
+  void save_state(StateWriter &w) const;
+  void load_state(StateReader &r);
+
+  // N.B., resamples any audio that's still pending.
+  ApuBuffer &output();
   int64_t    cycles() { return cycles_; }
 
+  // Lower bound on the number of steps that can run before the APU signals
+  // an IRQ (used by the scheduler, see Nes::run_until).
+  int64_t cycles_until_irq() const;
+
+  // Whether the DMC has sample bytes left to fetch from PRG ROM.
+  bool dmc_active() const { return dmc_.length_counter() != 0; }
+
   void write_4000(uint8_t x);
   void write_4001(uint8_t x);
   void write_4002(uint8_t x);
@@ -241,7 +323,12 @@ public:
   uint8_t read_4015();
 
 private:
-  void clock_frame_counter(ApuFrameCounter::Clock clock);
+  void    clock_frame_counter(ApuFrameCounter::Clock clock);
+  int64_t cycles_until_event() const;
+  void    skip(int cycles);
+  void    mix();
+  void    update_pulse();
+  void    update_tnd();
 
   Cpu            *cpu_     = nullptr;
   ApuPulse        pulse_1_ = {true};
@@ -250,9 +337,15 @@ private:
   ApuNoise        noise_;
   ApuDmc          dmc_;
   ApuFrameCounter fc_;
+  ApuBlip         blip_;
   ApuBuffer       out_;
-  float           output_ema_;
   int64_t         cycles_;
-  int64_t         sample_rate_ = 44100;
-  int64_t         sample_counter_;
+
+  // Mixer outputs (in ApuBlip::AMP_UNIT) as of the last delta added to blip_,
+  // and the current cycle relative to the start of its frame.
+  int mix_pulse_;
+  int mix_tnd_;
+  int blip_time_;
+
+  bool audio_enabled_ = true;
 };
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <format>
@@ -5,12 +6,16 @@
 #include <iostream>
 
 #include "src/emu/cart.h"
+#include "src/emu/cpu.h"
 #include "src/emu/mapper/axrom.h"
 #include "src/emu/mapper/cnrom.h"
 #include "src/emu/mapper/mmc1.h"
 #include "src/emu/mapper/mmc3.h"
 #include "src/emu/mapper/nrom.h"
+#include "src/emu/mapper/nsf.h"
 #include "src/emu/mapper/uxrom.h"
+#include "src/emu/ppu.h"
+#include "src/emu/state.h"
 
 CartHeader read_header(std::ifstream &is) {
   uint8_t bytes[16];
@@ -60,11 +65,87 @@ CartMemory read_data(std::ifstream &is, const CartHeader &header) {
   return mem;
 }
 
+static constexpr int    NSF_BANK_SIZE     = 4 * 1024;
+static constexpr size_t MAX_NSF_DATA_SIZE = 255 * NSF_BANK_SIZE;
+
+NsfHeader read_nsf_header(std::ifstream &is) {
+  uint8_t bytes[NsfHeader::SIZE];
+  if (!is.read((char *)bytes, sizeof(bytes))) {
+    throw std::runtime_error("failed to read NSF header");
+  }
+  return NsfHeader(bytes);
+}
+
+CartMemory read_nsf_data(std::ifstream &is, const NsfHeader &header) {
+  std::vector<uint8_t> data(
+      (std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>()
+  );
+  if (data.empty()) {
+    throw std::runtime_error("failed to read NSF data");
+  }
+  if (data.size() > MAX_NSF_DATA_SIZE) {
+    throw std::runtime_error(
+        std::format("unsupported NSF format: {} bytes of data", data.size())
+    );
+  }
+
+  // Bankswitched data is split into 4K banks, the first of which is padded so
+  // that the load address falls at the right offset. Otherwise, the data is
+  // simply loaded into 32K at the load address.
+  int padding, size;
+  if (header.bankswitched()) {
+    padding = header.load_addr() & (NSF_BANK_SIZE - 1);
+    size    = padding + (int)data.size() + NSF_BANK_SIZE - 1;
+    size &= ~(NSF_BANK_SIZE - 1);
+  } else {
+    padding = header.load_addr() - 0x8000;
+    size    = 32 * 1024;
+  }
+  CartMemory mem;
+  mem.prg_rom_size = size;
+  mem.prg_rom      = std::make_unique<uint8_t[]>(mem.prg_rom_size);
+  std::memset(mem.prg_rom.get(), 0, mem.prg_rom_size);
+  std::memcpy(
+      mem.prg_rom.get() + padding,
+      data.data(),
+      std::min(data.size(), (size_t)(size - padding))
+  );
+
+  mem.chr_rom_size     = 8 * 1024;
+  mem.chr_rom_readonly = false;
+  mem.chr_rom          = std::make_unique<uint8_t[]>(mem.chr_rom_size);
+  std::memset(mem.chr_rom.get(), 0, mem.chr_rom_size);
+
+  mem.prg_ram_size = 8 * 1024;
+  mem.prg_ram      = std::make_unique<uint8_t[]>(mem.prg_ram_size);
+  std::memset(mem.prg_ram.get(), 0, mem.prg_ram_size);
+
+  mem.prg_ram_persistent = false;
+
+  return mem;
+}
+
 bool Cart::loaded() const { return mapper_.get() != nullptr; }
 void Cart::power_on() { mapper_->power_on(); }
-void Cart::power_off() { gg_codes_.clear(); }
+void Cart::power_off() { clear_gg_codes(); }
 void Cart::reset() { mapper_->reset(); }
 
+void Cart::save_state(StateWriter &w) const {
+  w.write_bytes(mem_.prg_ram.get(), mem_.prg_ram_size);
+  if (!mem_.chr_rom_readonly) {
+    w.write_bytes(mem_.chr_rom.get(), mem_.chr_rom_size);
+  }
+  mapper_->save_state(w);
+}
+
+void Cart::load_state(StateReader &r) {
+  r.read_bytes(mem_.prg_ram.get(), mem_.prg_ram_size);
+  if (!mem_.chr_rom_readonly) {
+    r.read_bytes(mem_.chr_rom.get(), mem_.chr_rom_size);
+  }
+  mapper_->load_state(r);
+}
+
 void Cart::step_ppu() {
   if (step_ppu_enabled_) {
     mapper_->step_ppu();
@@ -92,6 +173,53 @@ void Cart::poke_cpu(uint16_t addr, uint8_t x) {
   mapper_->poke_cpu(addr, x);
 }
 
+void Cart::map_prg(uint16_t addr, int size, uint8_t *mem, bool writable) {
+  assert(addr >= CPU_ADDR_START && !(addr & 0xff) && !(size & 0xff));
+  assert(addr + size <= 0x10000);
+  for (int offset = 0; offset < size; offset += 256) {
+    int page              = (addr + offset) >> 8;
+    prg_peek_pages_[page] = mem + offset;
+    prg_poke_pages_[page] = writable ? mem + offset : nullptr;
+    update_cpu_page(page);
+  }
+}
+
+void Cart::map_chr(uint16_t addr, int size, uint8_t *mem) {
+  if (ppu_) {
+    ppu_->map_chr(addr, size, mem);
+  }
+}
+
+void Cart::map_nt(int page, int vram_addr) {
+  if (ppu_) {
+    ppu_->map_nt(page, vram_addr);
+  }
+}
+
+void Cart::update_cpu_page(int page) {
+  if (!cpu_) {
+    return;
+  }
+  uint8_t *peek = prg_peek_pages_[page];
+  for (auto &code : gg_codes_) {
+    if ((code.addr() >> 8) == page) {
+      peek = nullptr;
+    }
+  }
+  int      code_offset = -1;
+  uint8_t *prg_rom     = mem_.prg_rom.get();
+  if (peek && peek >= prg_rom && peek < prg_rom + mem_.prg_rom_size) {
+    code_offset = (int)(peek - prg_rom);
+  }
+  cpu_->map_page((uint8_t)page, peek, prg_poke_pages_[page], code_offset);
+}
+
+void Cart::update_cpu_pages() {
+  for (int page = CPU_ADDR_START >> 8; page < 256; page++) {
+    update_cpu_page(page);
+  }
+}
+
 PeekPpu Cart::peek_ppu(uint16_t addr) {
   assert(addr < PPU_ADDR_END);
   return mapper_->peek_ppu(addr);
@@ -111,26 +239,82 @@ void Cart::load_cart(const std::filesystem::path &path) {
   }
 
   CartHeader header = read_header(is);
-  mem_              = read_data(is, header);
+  set_memory(read_data(is, header));
 
   switch (header.mapper()) {
-  case 0: mapper_ = std::make_unique<NRom>(header, mem_); break;
-  case 1: mapper_ = std::make_unique<Mmc1>(mem_); break;
-  case 2: mapper_ = std::make_unique<UxRom>(header, mem_); break;
-  case 3: mapper_ = std::make_unique<CnRom>(header, mem_); break;
-  case 4: mapper_ = std::make_unique<Mmc3>(header, mem_, *cpu_, *ppu_); break;
-  case 7: mapper_ = std::make_unique<AxRom>(mem_); break;
+  case 0: set_mapper(std::make_unique<NRom>(header, mem_)); break;
+  case 1: set_mapper(std::make_unique<Mmc1>(mem_)); break;
+  case 2: set_mapper(std::make_unique<UxRom>(header, mem_)); break;
+  case 3: set_mapper(std::make_unique<CnRom>(header, mem_)); break;
+  case 4: set_mapper(std::make_unique<Mmc3>(header, mem_, *cpu_, *ppu_)); break;
+  case 7: set_mapper(std::make_unique<AxRom>(mem_)); break;
   default:
     throw std::runtime_error(
         std::format("unsupported ROM format: mapper {}", header.mapper())
     );
   }
+}
+
+NsfHeader Cart::load_nsf(const std::filesystem::path &path) {
+  std::ifstream is(path, std::ios::binary);
+  if (!is) {
+    throw std::runtime_error(
+        std::format("failed to open file: {}", path.c_str())
+    );
+  }
 
+  NsfHeader header = read_nsf_header(is);
+  set_memory(read_nsf_data(is, header));
+  set_mapper(std::make_unique<Nsf>(header, mem_));
+  return header;
+}
+
+static uint64_t hash_rom(const CartMemory &mem) {
+  // FNV-1a. N.B., CHR RAM is state, not part of the cart's identity.
+  uint64_t hash = 0xcbf29ce484222325;
+  auto     add  = [&](const uint8_t *data, int size) {
+    for (int i = 0; i < size; i++) {
+      hash = (hash ^ data[i]) * 0x100000001b3;
+    }
+  };
+  add(mem.prg_rom.get(), mem.prg_rom_size);
+  if (mem.chr_rom_readonly) {
+    add(mem.chr_rom.get(), mem.chr_rom_size);
+  }
+  return hash;
+}
+
+void Cart::set_memory(CartMemory &&mem) {
+  // N.B., the old mappings point into the memory about to be released.
+  std::fill(std::begin(prg_peek_pages_), std::end(prg_peek_pages_), nullptr);
+  std::fill(std::begin(prg_poke_pages_), std::end(prg_poke_pages_), nullptr);
+  update_cpu_pages();
+  if (ppu_) {
+    ppu_->unmap_pages();
+  }
+  mapper_.reset();
+  mem_ = std::move(mem);
+  rom_hash_ = hash_rom(mem_);
+  if (cpu_) {
+    cpu_->reset_code_cache(mem_.prg_rom_size);
+  }
+}
+
+void Cart::set_mapper(std::unique_ptr<Mapper> mapper) {
+  mapper_ = std::move(mapper);
+  mapper_->set_cart(this);
   step_ppu_enabled_ = mapper_->step_ppu_enabled();
 }
 
-void Cart::clear_gg_codes() { gg_codes_.clear(); }
-void Cart::add_gg_code(std::string_view code) { gg_codes_.emplace_back(code); }
+void Cart::clear_gg_codes() {
+  gg_codes_.clear();
+  update_cpu_pages();
+}
+
+void Cart::add_gg_code(std::string_view code) {
+  gg_codes_.emplace_back(code);
+  update_cpu_page(gg_codes_.back().addr() >> 8);
+}
 
 void Cart::save_sram(const std::filesystem::path &path) {
   if (!mem_.prg_ram_persistent) {
@@ -7,6 +7,7 @@
 
 #include "src/emu/game_genie.h"
 #include "src/emu/mapper/mapper.h"
+#include "src/emu/mapper/nsf.h"
 
 class Cart {
 public:
@@ -14,8 +15,15 @@ public:
   static constexpr uint16_t CPU_ADDR_START = 0x4020;
 
   void load_cart(const std::filesystem::path &path);
+
+  // Loads an NSF file in place of a cart (see Nes::load_nsf).
+  NsfHeader load_nsf(const std::filesystem::path &path);
+
   bool loaded() const;
 
+  // Hash of the PRG and CHR ROM, used to tell carts apart in save states.
+  uint64_t rom_hash() const { return rom_hash_; }
+
   void set_cpu(Cpu *cpu) { cpu_ = cpu; }
   void set_ppu(Ppu *ppu) { ppu_ = ppu; }
 
@@ -23,13 +31,27 @@ public:
   void power_off();
   void reset();
 
+  // See Nes::save_state.
+  void save_state(StateWriter &w) const;
+  void load_state(StateReader &r);
+
   uint8_t peek_cpu(uint16_t addr);
   void    poke_cpu(uint16_t addr, uint8_t x);
 
   PeekPpu peek_ppu(uint16_t addr);
   PokePpu poke_ppu(uint16_t addr, uint8_t x);
 
-  void step_ppu();
+  void    step_ppu();
+  bool    step_ppu_enabled() const { return step_ppu_enabled_; }
+  int64_t ppu_cycles_until_irq() { return mapper_->ppu_cycles_until_irq(); }
+
+  // Installs a direct CPU mapping for [addr, addr + size), see Cpu::map_page.
+  // Pages patched by Game Genie codes are left on the slow path.
+  void map_prg(uint16_t addr, int size, uint8_t *mem, bool writable);
+
+  // Installs direct PPU mappings, see Ppu::map_chr and Ppu::map_nt.
+  void map_chr(uint16_t addr, int size, uint8_t *mem);
+  void map_nt(int page, int vram_addr);
 
   void clear_gg_codes();
   void add_gg_code(std::string_view code);
@@ -38,10 +60,19 @@ public:
   void save_sram(const std::filesystem::path &path);
 
 private:
+  void set_memory(CartMemory &&mem);
+  void set_mapper(std::unique_ptr<Mapper> mapper);
+  void update_cpu_page(int page);
+  void update_cpu_pages();
+
   CartMemory                 mem_;
   std::unique_ptr<Mapper>    mapper_;
+  uint64_t                   rom_hash_         = 0;
   Cpu                       *cpu_              = nullptr;
   Ppu                       *ppu_              = nullptr;
   bool                       step_ppu_enabled_ = false;
   std::vector<GameGenieCode> gg_codes_;
+
+  uint8_t *prg_peek_pages_[256] = {};
+  uint8_t *prg_poke_pages_[256] = {};
 };
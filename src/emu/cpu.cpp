@@ -1,11 +1,16 @@
+#include <algorithm>
 #include <cstring>
 #include <format>
+#include <type_traits>
+#include <utility>
 
 #include "src/emu/apu.h"
 #include "src/emu/cart.h"
 #include "src/emu/cpu.h"
 #include "src/emu/input.h"
+#include "src/emu/jit.h"
 #include "src/emu/ppu.h"
+#include "src/emu/state.h"
 
 static constexpr std::array<Cpu::OpCode, 256> init_op_codes() {
   using enum Cpu::Instruction;
@@ -389,7 +394,53 @@ Cpu::Cpu()
       apu_(nullptr),
       oops_(false),
       jump_(false),
-      test_ram_(nullptr) {}
+      dispatch_(THREADED),
+      run_until_(0),
+      operand_(0),
+      side_effects_(0),
+      status_reads_(0),
+      last_status_(0),
+      idle_cycles_(0) {
+  for (int page = 0; page < 256; page++) {
+    if (page < (RAM_END >> 8)) {
+      uint8_t *mem = ram_ + ((page << 8) & RAM_MASK);
+      map_page((uint8_t)page, mem, mem);
+    } else {
+      map_page((uint8_t)page, nullptr, nullptr);
+    }
+  }
+}
+
+Cpu::~Cpu() = default;
+
+void Cpu::set_test_ram(uint8_t *test_ram) {
+  for (int page = 0; page < 256; page++) {
+    map_page((uint8_t)page, test_ram + (page << 8), test_ram + (page << 8));
+  }
+}
+
+void Cpu::set_dispatch(Dispatch dispatch) {
+  if (dispatch == JIT && !Jit::SUPPORTED) {
+    dispatch = THREADED;
+  }
+  if (dispatch == JIT && !jit_) {
+    jit_ = std::make_unique<Jit>(*this);
+    jit_->reset((int)code_cache_.size());
+  }
+  dispatch_ = dispatch;
+}
+
+void Cpu::reset_code_cache(int size) {
+  code_cache_.assign(size, CachedOp());
+  code_cache_stats_ = CodeCacheStats();
+  if (jit_) {
+    jit_->reset(size);
+  }
+}
+
+Cpu::JitStats Cpu::jit_stats() const {
+  return jit_ ? jit_->stats() : JitStats();
+}
 
 void Cpu::power_on() {
   regs_.A          = 0;
@@ -421,18 +472,43 @@ void Cpu::reset() {
   cycles_          = RESET_CYCLES;
 }
 
+void Cpu::save_state(StateWriter &w) const {
+  w.write(ram_, regs_, cycles_, nmi_pending_, nmi_delay_, irq_pending_);
+  w.write(irq_delay_, irq_delay_prev_, oam_dma_pending_);
+  w.write(side_effects_, status_reads_, last_status_, idle_cycles_);
+}
+
+void Cpu::load_state(StateReader &r) {
+  r.read(ram_, regs_, cycles_, nmi_pending_, nmi_delay_, irq_pending_);
+  r.read(irq_delay_, irq_delay_prev_, oam_dma_pending_);
+  r.read(side_effects_, status_reads_, last_status_, idle_cycles_);
+
+  // N.B., the loop being watched is from a different point in time.
+  idle_loop_ = IdleLoop();
+  run_until_ = cycles_;
+}
+
 static constexpr uint8_t open_bus() { return 0; }
 
-uint8_t Cpu::peek(uint16_t addr) {
-  if (test_ram_) {
-    return test_ram_[addr];
-  } else if (addr < RAM_END) {
+uint8_t Cpu::peek_io(uint16_t addr) {
+  if (sync_) {
+    sync_(addr);
+  }
+
+  side_effects_++;
+
+  if (addr < RAM_END) {
     return ram_[addr & RAM_MASK];
   } else if (addr < PPU_REGS_END) {
     switch (addr & 0x2007) {
     case PPU_PPUCTRL: return ppu_->read_PPUCTRL();
     case PPU_PPUMASK: return ppu_->read_PPUMASK();
-    case PPU_PPUSTATUS: return ppu_->read_PPUSTATUS();
+    case PPU_PPUSTATUS: {
+      // N.B., counted separately so that idle loops may poll it (see run()).
+      status_reads_++;
+      last_status_ = ppu_->read_PPUSTATUS();
+      return last_status_;
+    }
     case PPU_OAMADDR: return ppu_->read_OAMADDR();
     case PPU_OAMDATA: return ppu_->read_OAMDATA();
     case PPU_PPUSCROLL: return ppu_->read_PPUSCROLL();
@@ -459,10 +535,12 @@ uint16_t Cpu::peek16(uint16_t addr) {
   return (uint16_t)(lo + (hi << 8));
 }
 
-void Cpu::poke(uint16_t addr, uint8_t x) {
-  if (test_ram_) {
-    test_ram_[addr] = x;
-  } else if (addr < RAM_END) {
+void Cpu::poke_io(uint16_t addr, uint8_t x) {
+  if (sync_) {
+    sync_(addr);
+  }
+
+  if (addr < RAM_END) {
     ram_[addr & RAM_MASK] = x;
   } else if (addr < PPU_REGS_END) {
     switch (addr & 0x2007) {
@@ -540,6 +618,8 @@ void Cpu::signal_NMI() {
 }
 
 void Cpu::step() {
+  idle_loop_.head = -1;
+
   if (oam_dma_pending_) {
     step_OAM_DMA();
     // nesdev says OAM DMA takes 513 cycles (+1 on odd cpu cycles).
@@ -570,7 +650,14 @@ void Cpu::step() {
     return;
   }
 
+  // N.B., the JIT only runs whole blocks, from run().
+  if (dispatch_ != SWITCH) {
+    step_threaded();
+    return;
+  }
+
   const OpCode &op = OP_CODES[peek(regs_.PC)];
+  fetch_operand(op);
 
   jump_ = false;
   oops_ = false;
@@ -653,51 +740,262 @@ void Cpu::step() {
   }
 }
 
+void Cpu::run(int64_t cycles) {
+  run_until_ = cycles;
+  while (cycles_ < run_until_) {
+    // N.B., an IRQ may stay pending for a long time while masked, so this
+    // falls back to step() rather than re-checking the I flag here.
+    if (oam_dma_pending_ || nmi_pending_ || irq_pending_ || irq_delay_ > 0 ||
+        dispatch_ == SWITCH) {
+      step();
+      continue;
+    }
+
+    if (regs_.PC == idle_loop_.head) {
+      step_idle_loop();
+      if (cycles_ >= run_until_) {
+        break;
+      }
+    }
+
+    uint16_t pc = regs_.PC; // of the last instruction run
+    if (dispatch_ != JIT || !jit_->run(pc)) {
+      step_threaded();
+    }
+    if (regs_.PC <= pc && regs_.PC != idle_loop_.head) {
+      // N.B., a backward jump (or a jump to itself), so possibly the start of
+      // a loop.
+      idle_loop_.head         = regs_.PC;
+      idle_loop_.cycles       = cycles_;
+      idle_loop_.regs         = regs_;
+      idle_loop_.side_effects = side_effects_;
+      idle_loop_.status_reads = status_reads_;
+    }
+  }
+}
+
+void Cpu::step_idle_loop() {
+  // If the last iteration had no side effects and ended up back in the same
+  // state, then the next ones will too, at least until an interrupt or until
+  // PPUSTATUS changes (if polled). Skip as many whole iterations as we can.
+  IdleLoop &loop = idle_loop_;
+
+  int64_t status_reads = status_reads_ - loop.status_reads;
+  int64_t side_effects = side_effects_ - loop.side_effects - status_reads;
+  if (cycles_ > loop.cycles && side_effects == 0 && regs_ == loop.regs) {
+    int64_t period = cycles_ - loop.cycles;
+    int64_t until  = run_until_;
+    if (status_reads > 0) {
+      // N.B., the PPU may have moved on since the last read.
+      int64_t ppu_cycles = ppu_->cycles() + ppu_->cycles_until_status_change();
+      bool    changed    = ppu_->registers().PPUSTATUS != last_status_;
+      until              = changed ? cycles_ : std::min(until, ppu_cycles / 3);
+    }
+    int64_t skipped = std::max(until - cycles_, (int64_t)0) / period * period;
+    cycles_ += skipped;
+    idle_cycles_ += skipped;
+  }
+
+  loop.cycles       = cycles_;
+  loop.regs         = regs_;
+  loop.side_effects = side_effects_;
+  loop.status_reads = status_reads_;
+}
+
+void Cpu::step_threaded() {
+  int     offset = code_pages_[regs_.PC >> 8];
+  uint8_t lo     = (uint8_t)regs_.PC;
+
+  // N.B., instructions that might straddle two pages aren't cached, since the
+  // next page could be mapped anywhere.
+  if (offset >= 0 && lo <= 0xfd) {
+    CachedOp &cached = code_cache_[offset + lo];
+    if (cached.handler) {
+      code_cache_stats_.hits++;
+    } else {
+      const uint8_t *mem = peek_pages_[regs_.PC >> 8] + lo;
+      cached.handler     = HANDLERS[mem[0]];
+      cached.operand     = (uint16_t)(mem[1] | (mem[2] << 8));
+      code_cache_stats_.misses++;
+    }
+    operand_ = cached.operand;
+    cached.handler(*this);
+    return;
+  }
+
+  code_cache_stats_.uncached++;
+  uint8_t code = peek(regs_.PC);
+  fetch_operand(OP_CODES[code]);
+  HANDLERS[code](*this);
+}
+
+// N.B., the operand is fetched once up front, as on hardware. Read-modify-write
+// ops (including the illegal ones that run two instructions, e.g., DCP) could
+// otherwise see their own write if it lands on the operand.
+void Cpu::fetch_operand(const OpCode &op) {
+  switch (op.bytes) {
+  case 2: operand_ = peek(regs_.PC + 1); break;
+  case 3: operand_ = peek16(regs_.PC + 1); break;
+  }
+}
+
+// An op code whose addressing mode and flags are compile-time constants (they
+// shadow the members of the same name), so that the decode_addr() and
+// decode_mem() instantiations for it don't need to switch on them.
+template <Cpu::AddrMode MODE, uint8_t FLAGS>
+struct StaticOpCode : Cpu::OpCode {
+  static constexpr Cpu::AddrMode mode  = MODE;
+  static constexpr uint8_t       flags = FLAGS;
+};
+
+template <uint8_t CODE> void Cpu::step_code(Cpu &cpu) {
+  static constexpr OpCode OP = OP_CODES_ARR[CODE];
+  static constexpr StaticOpCode<OP.mode, OP.flags> op{OP};
+
+  cpu.jump_ = false;
+  cpu.oops_ = false;
+
+  // N.B., the switch is on a constant, so only one case survives.
+  switch (OP.ins) {
+  case ADC: cpu.step_ADC(op); break;
+  case AND: cpu.step_AND(op); break;
+  case ASL: cpu.step_ASL(op); break;
+  case BCC: cpu.step_BCC(op); break;
+  case BCS: cpu.step_BCS(op); break;
+  case BEQ: cpu.step_BEQ(op); break;
+  case BIT: cpu.step_BIT(op); break;
+  case BMI: cpu.step_BMI(op); break;
+  case BNE: cpu.step_BNE(op); break;
+  case BPL: cpu.step_BPL(op); break;
+  case BRK: cpu.step_BRK(op); break;
+  case BVC: cpu.step_BVC(op); break;
+  case BVS: cpu.step_BVS(op); break;
+  case CLC: cpu.step_CLC(op); break;
+  case CLD: cpu.step_CLD(op); break;
+  case CLI: cpu.step_CLI(op); break;
+  case CLV: cpu.step_CLV(op); break;
+  case CMP: cpu.step_CMP(op); break;
+  case CPX: cpu.step_CPX(op); break;
+  case CPY: cpu.step_CPY(op); break;
+  case DCP: cpu.step_DCP(op); break;
+  case DEC: cpu.step_DEC(op); break;
+  case DEX: cpu.step_DEX(op); break;
+  case DEY: cpu.step_DEY(op); break;
+  case EOR: cpu.step_EOR(op); break;
+  case INC: cpu.step_INC(op); break;
+  case INX: cpu.step_INX(op); break;
+  case INY: cpu.step_INY(op); break;
+  case ISB: cpu.step_ISB(op); break;
+  case JMP: cpu.step_JMP(op); break;
+  case JSR: cpu.step_JSR(op); break;
+  case LAX: cpu.step_LAX(op); break;
+  case LDA: cpu.step_LDA(op); break;
+  case LDX: cpu.step_LDX(op); break;
+  case LDY: cpu.step_LDY(op); break;
+  case LSR: cpu.step_LSR(op); break;
+  case NOP: cpu.step_NOP(op); break;
+  case ORA: cpu.step_ORA(op); break;
+  case PHA: cpu.step_PHA(op); break;
+  case PHP: cpu.step_PHP(op); break;
+  case PHX: cpu.step_PHX(op); break;
+  case PHY: cpu.step_PHY(op); break;
+  case PLA: cpu.step_PLA(op); break;
+  case PLP: cpu.step_PLP(op); break;
+  case PLX: cpu.step_PLX(op); break;
+  case PLY: cpu.step_PLY(op); break;
+  case RLA: cpu.step_RLA(op); break;
+  case ROL: cpu.step_ROL(op); break;
+  case ROR: cpu.step_ROR(op); break;
+  case RRA: cpu.step_RRA(op); break;
+  case RTI: cpu.step_RTI(op); break;
+  case RTS: cpu.step_RTS(op); break;
+  case SAX: cpu.step_SAX(op); break;
+  case SBC: cpu.step_SBC(op); break;
+  case SEC: cpu.step_SEC(op); break;
+  case SED: cpu.step_SED(op); break;
+  case SEI: cpu.step_SEI(op); break;
+  case SLO: cpu.step_SLO(op); break;
+  case SRE: cpu.step_SRE(op); break;
+  case STA: cpu.step_STA(op); break;
+  case STX: cpu.step_STX(op); break;
+  case STY: cpu.step_STY(op); break;
+  case TAX: cpu.step_TAX(op); break;
+  case TAY: cpu.step_TAY(op); break;
+  case TSX: cpu.step_TSX(op); break;
+  case TXA: cpu.step_TXA(op); break;
+  case TXS: cpu.step_TXS(op); break;
+  case TYA: cpu.step_TYA(op); break;
+  default: cpu.step_unimplemented(op); break;
+  }
+
+  cpu.cycles_ += OP.base_cycles + cpu.oops_;
+  if (!cpu.jump_) {
+    cpu.regs_.PC += OP.bytes;
+  }
+}
+
+const std::array<Cpu::Handler, 256> Cpu::HANDLERS =
+    []<size_t... CODES>(std::index_sequence<CODES...>) {
+      return std::array<Handler, 256>{&step_code<CODES>...};
+    }(std::make_index_sequence<256>());
+
 static bool page_crossed(uint16_t addr1, uint16_t addr2) {
   return (addr1 & 0xff00) != (addr2 & 0xff00);
 }
 
-uint16_t Cpu::decode_addr(const OpCode &op) {
+// N.B., both dispatchers fetch the operand into operand_ before running the
+// op (see fetch_operand).
+template <class Op> uint8_t Cpu::operand8([[maybe_unused]] const Op &op) {
+  return (uint8_t)operand_;
+}
+
+template <class Op> uint16_t Cpu::operand16([[maybe_unused]] const Op &op) {
+  return operand_;
+}
+
+template <class Op>
+uint16_t Cpu::decode_addr(const Op &op) {
   switch (op.mode) {
   case ABSOLUTE: {
-    return peek16(regs_.PC + 1);
+    return operand16(op);
   }
   case ABSOLUTE_X: {
-    uint16_t addr0 = peek16(regs_.PC + 1);
+    uint16_t addr0 = operand16(op);
     uint16_t addr1 = addr0 + regs_.X;
     oops_          = (op.flags & FORCE_OOPS) || page_crossed(addr0, addr1);
     return addr1;
   }
   case ABSOLUTE_Y: {
-    uint16_t addr0 = peek16(regs_.PC + 1);
+    uint16_t addr0 = operand16(op);
     uint16_t addr1 = addr0 + regs_.Y;
     oops_          = (op.flags & FORCE_OOPS) || page_crossed(addr0, addr1);
     return addr1;
   }
   case RELATIVE: {
     uint16_t addr0 = regs_.PC + 2;
-    int8_t   off   = (int8_t)peek(regs_.PC + 1);
+    int8_t   off   = (int8_t)operand8(op);
     uint16_t addr1 = (uint16_t)(addr0 + off);
     oops_          = (op.flags & FORCE_OOPS) || page_crossed(addr0, addr1);
     return addr1;
   }
   case ZERO_PAGE: {
-    return peek(regs_.PC + 1);
+    return operand8(op);
   }
   case ZERO_PAGE_X: {
-    uint8_t addr0 = peek(regs_.PC + 1);
+    uint8_t addr0 = operand8(op);
     uint8_t addr1 = addr0 + regs_.X;
     return addr1;
   }
   case ZERO_PAGE_Y: {
-    uint8_t addr0 = peek(regs_.PC + 1);
+    uint8_t addr0 = operand8(op);
     uint8_t addr1 = addr0 + regs_.Y;
     return addr1;
   }
   case INDIRECT: {
-    uint8_t  lo0     = peek(regs_.PC + 1);
+    uint16_t ptr     = operand16(op);
+    uint8_t  lo0     = (uint8_t)ptr;
     uint8_t  lo1     = lo0 + 1;
-    uint8_t  hi      = peek(regs_.PC + 2);
+    uint8_t  hi      = (uint8_t)(ptr >> 8);
     uint16_t addr0   = (uint16_t)(lo0 + (hi << 8));
     uint16_t addr1   = (uint16_t)(lo1 + (hi << 8));
     uint8_t  addr_lo = peek(addr0);
@@ -705,7 +1003,7 @@ uint16_t Cpu::decode_addr(const OpCode &op) {
     return (uint16_t)(addr_lo + (addr_hi << 8));
   }
   case INDIRECT_X: {
-    uint8_t a     = peek(regs_.PC + 1);
+    uint8_t a     = operand8(op);
     uint8_t addr0 = a + regs_.X;
     uint8_t addr1 = addr0 + 1;
     uint8_t lo    = peek(addr0);
@@ -713,7 +1011,7 @@ uint16_t Cpu::decode_addr(const OpCode &op) {
     return (uint16_t)(lo + (hi << 8));
   }
   case INDIRECT_Y: {
-    uint8_t  a0    = peek(regs_.PC + 1);
+    uint8_t  a0    = operand8(op);
     uint8_t  a1    = a0 + 1;
     uint16_t addr0 = (uint16_t)(peek(a0) + (peek(a1) << 8));
     uint16_t addr1 = addr0 + regs_.Y;
@@ -729,9 +1027,10 @@ uint16_t Cpu::decode_addr(const OpCode &op) {
   }
 }
 
-uint8_t Cpu::decode_mem(const OpCode &op) {
+template <class Op>
+uint8_t Cpu::decode_mem(const Op &op) {
   switch (op.mode) {
-  case IMMEDIATE: return peek(regs_.PC + 1);
+  case IMMEDIATE: return operand8(op);
   case ZERO_PAGE:
   case ZERO_PAGE_X:
   case ZERO_PAGE_Y:
@@ -749,7 +1048,8 @@ uint8_t Cpu::decode_mem(const OpCode &op) {
   }
 }
 
-void Cpu::step_ADC(const OpCode &op) {
+template <class Op>
+void Cpu::step_ADC(const Op &op) {
   uint8_t  mem   = decode_mem(op);
   bool     carry = regs_.P & C_FLAG;
   uint16_t res   = regs_.A + mem + carry;
@@ -758,19 +1058,25 @@ void Cpu::step_ADC(const OpCode &op) {
   step_load((uint8_t)res, regs_.A);
 }
 
-void Cpu::step_AND(const OpCode &op) {
+template <class Op>
+void Cpu::step_AND(const Op &op) {
   uint8_t mem = decode_mem(op);
   uint8_t res = regs_.A & mem;
   step_load(res, regs_.A);
 }
 
-void Cpu::step_ASL(const OpCode &op) { step_shift_left(op, false); }
+template <class Op>
+void Cpu::step_ASL(const Op &op) { step_shift_left(op, false); }
 
-void Cpu::step_BCC(const OpCode &op) { step_branch(op, !(regs_.P & C_FLAG)); }
-void Cpu::step_BCS(const OpCode &op) { step_branch(op, regs_.P & C_FLAG); }
-void Cpu::step_BEQ(const OpCode &op) { step_branch(op, regs_.P & Z_FLAG); }
+template <class Op>
+void Cpu::step_BCC(const Op &op) { step_branch(op, !(regs_.P & C_FLAG)); }
+template <class Op>
+void Cpu::step_BCS(const Op &op) { step_branch(op, regs_.P & C_FLAG); }
+template <class Op>
+void Cpu::step_BEQ(const Op &op) { step_branch(op, regs_.P & Z_FLAG); }
 
-void Cpu::step_BIT(const OpCode &op) {
+template <class Op>
+void Cpu::step_BIT(const Op &op) {
   uint8_t mem = decode_mem(op);
   uint8_t res = regs_.A & mem;
   set_flag(Z_FLAG, res == 0);
@@ -778,11 +1084,15 @@ void Cpu::step_BIT(const OpCode &op) {
   set_flag(V_FLAG, mem & 0b01000000);
 }
 
-void Cpu::step_BMI(const OpCode &op) { step_branch(op, regs_.P & N_FLAG); }
-void Cpu::step_BNE(const OpCode &op) { step_branch(op, !(regs_.P & Z_FLAG)); }
-void Cpu::step_BPL(const OpCode &op) { step_branch(op, !(regs_.P & N_FLAG)); }
+template <class Op>
+void Cpu::step_BMI(const Op &op) { step_branch(op, regs_.P & N_FLAG); }
+template <class Op>
+void Cpu::step_BNE(const Op &op) { step_branch(op, !(regs_.P & Z_FLAG)); }
+template <class Op>
+void Cpu::step_BPL(const Op &op) { step_branch(op, !(regs_.P & N_FLAG)); }
 
-void Cpu::step_BRK([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_BRK([[maybe_unused]] const Op &op) {
   push16(regs_.PC + 2);
   push(regs_.P | 0b00110000);
   regs_.PC = peek16(IRQ_VECTOR);
@@ -790,28 +1100,39 @@ void Cpu::step_BRK([[maybe_unused]] const OpCode &op) {
   jump_ = true;
 }
 
-void Cpu::step_BVC(const OpCode &op) { step_branch(op, !(regs_.P & V_FLAG)); }
-void Cpu::step_BVS(const OpCode &op) { step_branch(op, regs_.P & V_FLAG); }
-void Cpu::step_CLC([[maybe_unused]] const OpCode &op) { regs_.P &= ~C_FLAG; }
-void Cpu::step_CLD([[maybe_unused]] const OpCode &op) { regs_.P &= ~D_FLAG; }
+template <class Op>
+void Cpu::step_BVC(const Op &op) { step_branch(op, !(regs_.P & V_FLAG)); }
+template <class Op>
+void Cpu::step_BVS(const Op &op) { step_branch(op, regs_.P & V_FLAG); }
+template <class Op>
+void Cpu::step_CLC([[maybe_unused]] const Op &op) { regs_.P &= ~C_FLAG; }
+template <class Op>
+void Cpu::step_CLD([[maybe_unused]] const Op &op) { regs_.P &= ~D_FLAG; }
 
-void Cpu::step_CLI([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_CLI([[maybe_unused]] const Op &op) {
   irq_delay_      = 1;
   irq_delay_prev_ = get_flag(I_FLAG);
   regs_.P &= ~I_FLAG;
 }
 
-void Cpu::step_CLV([[maybe_unused]] const OpCode &op) { regs_.P &= ~V_FLAG; }
-void Cpu::step_CMP(const OpCode &op) { step_compare(op, regs_.A); }
-void Cpu::step_CPX(const OpCode &op) { step_compare(op, regs_.X); }
-void Cpu::step_CPY(const OpCode &op) { step_compare(op, regs_.Y); }
+template <class Op>
+void Cpu::step_CLV([[maybe_unused]] const Op &op) { regs_.P &= ~V_FLAG; }
+template <class Op>
+void Cpu::step_CMP(const Op &op) { step_compare(op, regs_.A); }
+template <class Op>
+void Cpu::step_CPX(const Op &op) { step_compare(op, regs_.X); }
+template <class Op>
+void Cpu::step_CPY(const Op &op) { step_compare(op, regs_.Y); }
 
-void Cpu::step_DCP(const OpCode &op) {
+template <class Op>
+void Cpu::step_DCP(const Op &op) {
   step_DEC(op);
   step_CMP(op);
 }
 
-void Cpu::step_DEC(const OpCode &op) {
+template <class Op>
+void Cpu::step_DEC(const Op &op) {
   uint16_t addr = decode_addr(op);
   uint8_t  mem  = peek(addr);
   uint8_t  res  = mem - 1;
@@ -823,21 +1144,25 @@ void Cpu::step_DEC(const OpCode &op) {
   set_flag(N_FLAG, res & 0b10000000);
 }
 
-void Cpu::step_DEX([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_DEX([[maybe_unused]] const Op &op) {
   step_load(regs_.X - 1, regs_.X);
 }
 
-void Cpu::step_DEY([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_DEY([[maybe_unused]] const Op &op) {
   step_load(regs_.Y - 1, regs_.Y);
 }
 
-void Cpu::step_EOR(const OpCode &op) {
+template <class Op>
+void Cpu::step_EOR(const Op &op) {
   uint8_t mem = decode_mem(op);
   uint8_t res = regs_.A ^ mem;
   step_load(res, regs_.A);
 }
 
-void Cpu::step_INC(const OpCode &op) {
+template <class Op>
+void Cpu::step_INC(const Op &op) {
   uint16_t addr = decode_addr(op);
   uint8_t  mem  = peek(addr);
   uint8_t  res  = mem + 1;
@@ -849,43 +1174,54 @@ void Cpu::step_INC(const OpCode &op) {
   set_flag(N_FLAG, res & 0b10000000);
 }
 
-void Cpu::step_INX([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_INX([[maybe_unused]] const Op &op) {
   step_load(regs_.X + 1, regs_.X);
 }
 
-void Cpu::step_INY([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_INY([[maybe_unused]] const Op &op) {
   step_load(regs_.Y + 1, regs_.Y);
 }
 
-void Cpu::step_ISB(const OpCode &op) {
+template <class Op>
+void Cpu::step_ISB(const Op &op) {
   step_INC(op);
   step_SBC(op);
 }
 
-void Cpu::step_JMP(const OpCode &op) {
+template <class Op>
+void Cpu::step_JMP(const Op &op) {
   regs_.PC = decode_addr(op);
   jump_    = true;
 }
 
-void Cpu::step_JSR(const OpCode &op) {
+template <class Op>
+void Cpu::step_JSR(const Op &op) {
   push16(regs_.PC + 2);
   regs_.PC = decode_addr(op);
   jump_    = true;
 }
 
-void Cpu::step_LAX(const OpCode &op) {
+template <class Op>
+void Cpu::step_LAX(const Op &op) {
   uint8_t res = decode_mem(op);
   step_load(res, regs_.A);
   step_load(res, regs_.X);
 }
 
-void Cpu::step_LDA(const OpCode &op) { step_load_mem(op, regs_.A); }
-void Cpu::step_LDX(const OpCode &op) { step_load_mem(op, regs_.X); }
-void Cpu::step_LDY(const OpCode &op) { step_load_mem(op, regs_.Y); }
+template <class Op>
+void Cpu::step_LDA(const Op &op) { step_load_mem(op, regs_.A); }
+template <class Op>
+void Cpu::step_LDX(const Op &op) { step_load_mem(op, regs_.X); }
+template <class Op>
+void Cpu::step_LDY(const Op &op) { step_load_mem(op, regs_.Y); }
 
-void Cpu::step_LSR(const OpCode &op) { step_shift_right(op, false); }
+template <class Op>
+void Cpu::step_LSR(const Op &op) { step_shift_right(op, false); }
 
-void Cpu::step_NOP(const OpCode &op) {
+template <class Op>
+void Cpu::step_NOP(const Op &op) {
   if (op.flags & ILLEGAL &&
       (op.mode != IMPLICIT && op.mode != ACCUMULATOR && op.mode != IMMEDIATE)) {
     // N.B., some illegal op-codes generate an "oops" cycle.
@@ -893,25 +1229,32 @@ void Cpu::step_NOP(const OpCode &op) {
   }
 }
 
-void Cpu::step_ORA(const OpCode &op) {
+template <class Op>
+void Cpu::step_ORA(const Op &op) {
   uint8_t mem = decode_mem(op);
   uint8_t res = regs_.A | mem;
   step_load(res, regs_.A);
 }
 
-void Cpu::step_PHA([[maybe_unused]] const OpCode &op) { push(regs_.A); }
-void Cpu::step_PHX([[maybe_unused]] const OpCode &op) { push(regs_.X); }
-void Cpu::step_PHY([[maybe_unused]] const OpCode &op) { push(regs_.Y); }
+template <class Op>
+void Cpu::step_PHA([[maybe_unused]] const Op &op) { push(regs_.A); }
+template <class Op>
+void Cpu::step_PHX([[maybe_unused]] const Op &op) { push(regs_.X); }
+template <class Op>
+void Cpu::step_PHY([[maybe_unused]] const Op &op) { push(regs_.Y); }
 
-void Cpu::step_PHP([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_PHP([[maybe_unused]] const Op &op) {
   push(regs_.P | 0b00110000);
 }
 
-void Cpu::step_PLA([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_PLA([[maybe_unused]] const Op &op) {
   step_load_stack(regs_.A);
 }
 
-void Cpu::step_PLP([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_PLP([[maybe_unused]] const Op &op) {
   constexpr uint8_t mask = 0b11001111;
   uint8_t           mem  = pop();
   irq_delay_             = 1;
@@ -919,28 +1262,35 @@ void Cpu::step_PLP([[maybe_unused]] const OpCode &op) {
   regs_.P                = (mem & mask) | (regs_.P & ~mask);
 }
 
-void Cpu::step_PLX([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_PLX([[maybe_unused]] const Op &op) {
   step_load_stack(regs_.X);
 }
 
-void Cpu::step_PLY([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_PLY([[maybe_unused]] const Op &op) {
   step_load_stack(regs_.Y);
 }
 
-void Cpu::step_RLA(const OpCode &op) {
+template <class Op>
+void Cpu::step_RLA(const Op &op) {
   step_ROL(op);
   step_AND(op);
 }
 
-void Cpu::step_ROL(const OpCode &op) { step_shift_left(op, true); }
-void Cpu::step_ROR(const OpCode &op) { step_shift_right(op, true); }
+template <class Op>
+void Cpu::step_ROL(const Op &op) { step_shift_left(op, true); }
+template <class Op>
+void Cpu::step_ROR(const Op &op) { step_shift_right(op, true); }
 
-void Cpu::step_RRA(const OpCode &op) {
+template <class Op>
+void Cpu::step_RRA(const Op &op) {
   step_ROR(op);
   step_ADC(op);
 }
 
-void Cpu::step_RTI([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_RTI([[maybe_unused]] const Op &op) {
   constexpr uint8_t mask = 0b11001111;
   uint8_t           mem  = pop();
   regs_.P                = (regs_.P & ~mask) | (mem & mask);
@@ -948,18 +1298,21 @@ void Cpu::step_RTI([[maybe_unused]] const OpCode &op) {
   jump_                  = true;
 }
 
-void Cpu::step_RTS([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_RTS([[maybe_unused]] const Op &op) {
   regs_.PC = pop16() + 1;
   jump_    = true;
 }
 
-void Cpu::step_SAX(const OpCode &op) {
+template <class Op>
+void Cpu::step_SAX(const Op &op) {
   uint16_t addr = decode_addr(op);
   uint8_t  res  = regs_.A & regs_.X;
   poke(addr, res);
 }
 
-void Cpu::step_SBC(const OpCode &op) {
+template <class Op>
+void Cpu::step_SBC(const Op &op) {
   uint8_t mem   = decode_mem(op);
   bool    carry = regs_.P & C_FLAG;
   int16_t res16 = regs_.A - mem - !carry;
@@ -969,62 +1322,76 @@ void Cpu::step_SBC(const OpCode &op) {
   step_load(res8, regs_.A);
 }
 
-void Cpu::step_SEC([[maybe_unused]] const OpCode &op) { regs_.P |= C_FLAG; }
-void Cpu::step_SED([[maybe_unused]] const OpCode &op) { regs_.P |= D_FLAG; }
+template <class Op>
+void Cpu::step_SEC([[maybe_unused]] const Op &op) { regs_.P |= C_FLAG; }
+template <class Op>
+void Cpu::step_SED([[maybe_unused]] const Op &op) { regs_.P |= D_FLAG; }
 
-void Cpu::step_SEI([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_SEI([[maybe_unused]] const Op &op) {
   irq_delay_      = 1;
   irq_delay_prev_ = get_flag(I_FLAG);
   regs_.P |= I_FLAG;
 }
 
-void Cpu::step_SLO(const OpCode &op) {
+template <class Op>
+void Cpu::step_SLO(const Op &op) {
   step_ASL(op);
   step_ORA(op);
 }
 
-void Cpu::step_SRE(const OpCode &op) {
+template <class Op>
+void Cpu::step_SRE(const Op &op) {
   step_LSR(op);
   step_EOR(op);
 }
 
-void Cpu::step_STA(const OpCode &op) {
+template <class Op>
+void Cpu::step_STA(const Op &op) {
   uint16_t addr = decode_addr(op);
   poke(addr, regs_.A);
 }
 
-void Cpu::step_STX(const OpCode &op) {
+template <class Op>
+void Cpu::step_STX(const Op &op) {
   uint16_t addr = decode_addr(op);
   poke(addr, regs_.X);
 }
 
-void Cpu::step_STY(const OpCode &op) {
+template <class Op>
+void Cpu::step_STY(const Op &op) {
   uint16_t addr = decode_addr(op);
   poke(addr, regs_.Y);
 }
 
-void Cpu::step_TAX([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_TAX([[maybe_unused]] const Op &op) {
   step_load(regs_.A, regs_.X);
 }
 
-void Cpu::step_TAY([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_TAY([[maybe_unused]] const Op &op) {
   step_load(regs_.A, regs_.Y);
 }
 
-void Cpu::step_TSX([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_TSX([[maybe_unused]] const Op &op) {
   step_load(regs_.S, regs_.X);
 }
 
-void Cpu::step_TXA([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_TXA([[maybe_unused]] const Op &op) {
   step_load(regs_.X, regs_.A);
 }
 
-void Cpu::step_TXS([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_TXS([[maybe_unused]] const Op &op) {
   // N.B., does not set flags, so don't use step_load
   regs_.S = regs_.X;
 }
 
-void Cpu::step_TYA([[maybe_unused]] const OpCode &op) {
+template <class Op>
+void Cpu::step_TYA([[maybe_unused]] const Op &op) {
   step_load(regs_.Y, regs_.A);
 }
 
@@ -1043,13 +1410,18 @@ void Cpu::step_IRQ() {
 }
 
 void Cpu::step_OAM_DMA() {
+  if (sync_) {
+    sync_(PPU_OAMDMA);
+  }
+
   uint16_t src_addr = (uint16_t)(ppu_->registers().OAMDMA << 8);
   for (int i = 0; i < 256; i++) {
     ppu_->write_OAMDATA(peek(src_addr++));
   }
 }
 
-void Cpu::step_load_mem(const OpCode &op, uint8_t &reg) {
+template <class Op>
+void Cpu::step_load_mem(const Op &op, uint8_t &reg) {
   uint8_t res = decode_mem(op);
   step_load(res, reg);
 }
@@ -1065,7 +1437,8 @@ void Cpu::step_load(uint8_t res, uint8_t &reg) {
   set_flag(N_FLAG, res & 0b10000000);
 }
 
-void Cpu::step_branch(const OpCode &op, bool test) {
+template <class Op>
+void Cpu::step_branch(const Op &op, bool test) {
   if (test) {
     regs_.PC = decode_addr(op);
     cycles_ += 1;
@@ -1073,7 +1446,8 @@ void Cpu::step_branch(const OpCode &op, bool test) {
   }
 }
 
-void Cpu::step_compare(const OpCode &op, uint8_t &reg) {
+template <class Op>
+void Cpu::step_compare(const Op &op, uint8_t &reg) {
   uint8_t mem = decode_mem(op);
   uint8_t res = reg - mem;
   set_flag(C_FLAG, reg >= mem);
@@ -1081,7 +1455,8 @@ void Cpu::step_compare(const OpCode &op, uint8_t &reg) {
   set_flag(N_FLAG, res & 0b10000000);
 }
 
-void Cpu::step_shift_left(const OpCode &op, bool carry) {
+template <class Op>
+void Cpu::step_shift_left(const Op &op, bool carry) {
   if (op.mode == ACCUMULATOR) {
     uint8_t res = (uint8_t)(regs_.A << 1);
     if (carry) {
@@ -1106,7 +1481,8 @@ void Cpu::step_shift_left(const OpCode &op, bool carry) {
   }
 }
 
-void Cpu::step_shift_right(const OpCode &op, bool carry) {
+template <class Op>
+void Cpu::step_shift_right(const Op &op, bool carry) {
   if (op.mode == ACCUMULATOR) {
     uint8_t res = regs_.A >> 1;
     if (carry) {
@@ -1131,7 +1507,8 @@ void Cpu::step_shift_right(const OpCode &op, bool carry) {
   }
 }
 
-void Cpu::step_unimplemented(const OpCode &op) {
+template <class Op>
+void Cpu::step_unimplemented(const Op &op) {
   throw std::runtime_error(std::format(
       "unimplemented instruction: {} (${:02X})", INS_NAMES[op.ins], (int)op.code
   ));
@@ -1146,3 +1523,6 @@ void Cpu::set_flag(Flags flag, bool value) {
 }
 
 bool Cpu::get_flag(Flags flag) const { return regs_.P & flag; }
+
+template uint16_t Cpu::decode_addr(const OpCode &op);
+template uint8_t  Cpu::decode_mem(const OpCode &op);
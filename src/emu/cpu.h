@@ -2,13 +2,19 @@
 
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <vector>
 
 class Cart;
 class Ppu;
 class Apu;
 class Input;
+class Jit;
+class StateReader;
+class StateWriter;
 
 class Cpu {
 public:
@@ -36,6 +42,8 @@ public:
     uint8_t  X;
     uint8_t  Y;
     uint8_t  P;
+
+    bool operator==(const Registers &other) const = default;
   };
 
   enum Instruction : uint8_t {
@@ -131,6 +139,16 @@ public:
     INVALID_ADDR_MODE,
   };
 
+  // SWITCH decodes each instruction at run time; THREADED jumps through a table
+  // of handlers specialized for each op code. JIT is THREADED, except that
+  // run() translates whole blocks of code into native code (see Jit), where
+  // supported. All should behave identically.
+  enum Dispatch : uint8_t {
+    SWITCH,
+    THREADED,
+    JIT,
+  };
+
   enum OpCodeFlags : uint8_t {
     ILLEGAL    = 1u << 0,
     FORCE_OOPS = 1u << 1,
@@ -145,24 +163,81 @@ public:
     uint8_t     flags       = 0;
   };
 
+  struct CodeCacheStats {
+    int64_t hits     = 0;
+    int64_t misses   = 0;
+    int64_t uncached = 0; // e.g., code running from RAM
+  };
+
+  struct JitStats {
+    int64_t blocks      = 0; // compiled
+    int64_t runs        = 0; // of blocks
+    int64_t invalidated = 0; // blocks whose code changed
+    int64_t flushes     = 0; // of every block, when out of room
+  };
+
   static const std::array<OpCode, 256> &OP_CODES;
   static const std::string_view         ADDR_MODE_NAMES[];
   static const std::string_view         INS_NAMES[];
 
   Cpu();
+  ~Cpu();
 
   void set_cart(Cart *cart) { cart_ = cart; }
   void set_ppu(Ppu *ppu) { ppu_ = ppu; }
   void set_apu(Apu *apu) { apu_ = apu; }
   void set_input(Input *input) { input_ = input; }
-  void set_test_ram(uint8_t *test_ram) { test_ram_ = test_ram; }
+  void set_test_ram(uint8_t *test_ram); // single-step tests
+
+  // N.B., JIT falls back to THREADED where it isn't supported.
+  void     set_dispatch(Dispatch dispatch);
+  Dispatch dispatch() const { return dispatch_; }
+
+  // Called with the address before any access the PPU, APU or mapper could
+  // observe, so that they can be caught up to the current cycle first (see
+  // Nes::run_until).
+  void set_sync(std::function<void(uint16_t)> sync) {
+    sync_ = std::move(sync);
+  }
+
+  // Maps a 256 byte page of the address space directly onto host memory so
+  // that peek()/poke() can skip the I/O dispatch. Null pointers fall back to
+  // it (e.g., PPU/APU registers or ROM writes that switch banks). If the page
+  // is PRG ROM, code_offset gives its offset into the code cache (see below).
+  void map_page(
+      uint8_t page, const uint8_t *peek, uint8_t *poke, int code_offset = -1
+  ) {
+    peek_pages_[page] = peek;
+    poke_pages_[page] = poke;
+    code_pages_[page] = code_offset;
+  }
+
+  // Threaded dispatch caches decoded instructions by their offset into PRG
+  // ROM, so the cache survives bank switches. ROM can't change underneath
+  // it, so nothing ever needs invalidating; code elsewhere isn't cached.
+  void                  reset_code_cache(int size);
+  const CodeCacheStats &code_cache_stats() const { return code_cache_stats_; }
+  JitStats              jit_stats() const;
 
   Registers &registers() { return regs_; }
   int64_t    cycles() { return cycles_; }
 
-  uint8_t  peek(uint16_t addr);
+  uint8_t peek(uint16_t addr) {
+    const uint8_t *page = peek_pages_[addr >> 8];
+    return page ? page[addr & 0xff] : peek_io(addr);
+  }
+
+  void poke(uint16_t addr, uint8_t x) {
+    side_effects_++;
+    uint8_t *page = poke_pages_[addr >> 8];
+    if (page) {
+      page[addr & 0xff] = x;
+    } else {
+      poke_io(addr, x);
+    }
+  }
+
   uint16_t peek16(uint16_t addr);
-  void     poke(uint16_t addr, uint8_t x);
   void     push(uint8_t x);
   void     push16(uint16_t x);
   uint8_t  pop();
@@ -177,109 +252,178 @@ public:
   void reset();
   void step();
 
-  uint16_t decode_addr(const OpCode &op);
-  uint8_t  decode_mem(const OpCode &op);
+  // See Nes::save_state.
+  void save_state(StateWriter &w) const;
+  void load_state(StateReader &r);
+
+  // Executes instructions until the given cycle count is reached or until
+  // stop() is called (e.g., from the sync callback). Between interrupts this
+  // skips the checks done by step() and jumps straight to the op handlers (or
+  // into blocks compiled by the JIT). Loops that can't change anything (e.g.,
+  // polling a RAM flag that only an NMI handler sets) are fast-forwarded, see
+  // idle_cycles().
+  void run(int64_t cycles);
+  void stop() { run_until_ = cycles_; }
+
+  // Total number of cycles fast-forwarded through idle loops by run().
+  int64_t idle_cycles() const { return idle_cycles_; }
+
+  // Fetches the operand of the op at PC, which decode_addr() and decode_mem()
+  // then decode. N.B., these are templates so that they can also be
+  // instantiated with op codes whose addressing mode is known at compile time
+  // (see step_code()).
+  void                         fetch_operand(const OpCode &op);
+  template <class Op> uint16_t decode_addr(const Op &op);
+  template <class Op> uint8_t  decode_mem(const Op &op);
 
 private:
-  void step_ADC(const OpCode &op);
-  void step_AND(const OpCode &op);
-  void step_ASL(const OpCode &op);
-  void step_BCC(const OpCode &op);
-  void step_BCS(const OpCode &op);
-  void step_BEQ(const OpCode &op);
-  void step_BIT(const OpCode &op);
-  void step_BMI(const OpCode &op);
-  void step_BNE(const OpCode &op);
-  void step_BPL(const OpCode &op);
-  void step_BRK(const OpCode &op);
-  void step_BVC(const OpCode &op);
-  void step_BVS(const OpCode &op);
-  void step_CLC(const OpCode &op);
-  void step_CLD(const OpCode &op);
-  void step_CLI(const OpCode &op);
-  void step_CLV(const OpCode &op);
-  void step_CMP(const OpCode &op);
-  void step_CPX(const OpCode &op);
-  void step_CPY(const OpCode &op);
-  void step_DCP(const OpCode &op);
-  void step_DEC(const OpCode &op);
-  void step_DEX(const OpCode &op);
-  void step_DEY(const OpCode &op);
-  void step_EOR(const OpCode &op);
-  void step_INC(const OpCode &op);
-  void step_INX(const OpCode &op);
-  void step_INY(const OpCode &op);
-  void step_ISB(const OpCode &op);
-  void step_JMP(const OpCode &op);
-  void step_JSR(const OpCode &op);
-  void step_LAX(const OpCode &op);
-  void step_LDA(const OpCode &op);
-  void step_LDX(const OpCode &op);
-  void step_LDY(const OpCode &op);
-  void step_LSR(const OpCode &op);
-  void step_NOP(const OpCode &op);
-  void step_ORA(const OpCode &op);
-  void step_PHA(const OpCode &op);
-  void step_PHP(const OpCode &op);
-  void step_PHX(const OpCode &op);
-  void step_PHY(const OpCode &op);
-  void step_PLA(const OpCode &op);
-  void step_PLP(const OpCode &op);
-  void step_PLX(const OpCode &op);
-  void step_PLY(const OpCode &op);
-  void step_RLA(const OpCode &op);
-  void step_ROL(const OpCode &op);
-  void step_ROR(const OpCode &op);
-  void step_RRA(const OpCode &op);
-  void step_RTI(const OpCode &op);
-  void step_RTS(const OpCode &op);
-  void step_SAX(const OpCode &op);
-  void step_SBC(const OpCode &op);
-  void step_SEC(const OpCode &op);
-  void step_SED(const OpCode &op);
-  void step_SEI(const OpCode &op);
-  void step_SLO(const OpCode &op);
-  void step_SRE(const OpCode &op);
-  void step_STA(const OpCode &op);
-  void step_STX(const OpCode &op);
-  void step_STY(const OpCode &op);
-  void step_TAX(const OpCode &op);
-  void step_TAY(const OpCode &op);
-  void step_TSX(const OpCode &op);
-  void step_TXA(const OpCode &op);
-  void step_TXS(const OpCode &op);
-  void step_TYA(const OpCode &op);
+  friend class Jit;
+
+  using Handler = void (*)(Cpu &cpu);
+
+  static const std::array<Handler, 256> HANDLERS;
+
+  // A loop that run() is watching, starting from its last iteration.
+  struct IdleLoop {
+    int       head = -1; // PC, or -1 if none
+    int64_t   cycles;
+    Registers regs;
+    int64_t   side_effects;
+    int64_t   status_reads;
+  };
+
+  struct CachedOp {
+    Handler  handler = nullptr;
+    uint16_t operand = 0;
+  };
+
+  template <uint8_t CODE> static void step_code(Cpu &cpu);
+
+  void step_threaded();
+  void step_idle_loop();
+
+  uint8_t peek_io(uint16_t addr);
+  void    poke_io(uint16_t addr, uint8_t x);
+
+  template <class Op> void step_ADC(const Op &op);
+  template <class Op> void step_AND(const Op &op);
+  template <class Op> void step_ASL(const Op &op);
+  template <class Op> void step_BCC(const Op &op);
+  template <class Op> void step_BCS(const Op &op);
+  template <class Op> void step_BEQ(const Op &op);
+  template <class Op> void step_BIT(const Op &op);
+  template <class Op> void step_BMI(const Op &op);
+  template <class Op> void step_BNE(const Op &op);
+  template <class Op> void step_BPL(const Op &op);
+  template <class Op> void step_BRK(const Op &op);
+  template <class Op> void step_BVC(const Op &op);
+  template <class Op> void step_BVS(const Op &op);
+  template <class Op> void step_CLC(const Op &op);
+  template <class Op> void step_CLD(const Op &op);
+  template <class Op> void step_CLI(const Op &op);
+  template <class Op> void step_CLV(const Op &op);
+  template <class Op> void step_CMP(const Op &op);
+  template <class Op> void step_CPX(const Op &op);
+  template <class Op> void step_CPY(const Op &op);
+  template <class Op> void step_DCP(const Op &op);
+  template <class Op> void step_DEC(const Op &op);
+  template <class Op> void step_DEX(const Op &op);
+  template <class Op> void step_DEY(const Op &op);
+  template <class Op> void step_EOR(const Op &op);
+  template <class Op> void step_INC(const Op &op);
+  template <class Op> void step_INX(const Op &op);
+  template <class Op> void step_INY(const Op &op);
+  template <class Op> void step_ISB(const Op &op);
+  template <class Op> void step_JMP(const Op &op);
+  template <class Op> void step_JSR(const Op &op);
+  template <class Op> void step_LAX(const Op &op);
+  template <class Op> void step_LDA(const Op &op);
+  template <class Op> void step_LDX(const Op &op);
+  template <class Op> void step_LDY(const Op &op);
+  template <class Op> void step_LSR(const Op &op);
+  template <class Op> void step_NOP(const Op &op);
+  template <class Op> void step_ORA(const Op &op);
+  template <class Op> void step_PHA(const Op &op);
+  template <class Op> void step_PHP(const Op &op);
+  template <class Op> void step_PHX(const Op &op);
+  template <class Op> void step_PHY(const Op &op);
+  template <class Op> void step_PLA(const Op &op);
+  template <class Op> void step_PLP(const Op &op);
+  template <class Op> void step_PLX(const Op &op);
+  template <class Op> void step_PLY(const Op &op);
+  template <class Op> void step_RLA(const Op &op);
+  template <class Op> void step_ROL(const Op &op);
+  template <class Op> void step_ROR(const Op &op);
+  template <class Op> void step_RRA(const Op &op);
+  template <class Op> void step_RTI(const Op &op);
+  template <class Op> void step_RTS(const Op &op);
+  template <class Op> void step_SAX(const Op &op);
+  template <class Op> void step_SBC(const Op &op);
+  template <class Op> void step_SEC(const Op &op);
+  template <class Op> void step_SED(const Op &op);
+  template <class Op> void step_SEI(const Op &op);
+  template <class Op> void step_SLO(const Op &op);
+  template <class Op> void step_SRE(const Op &op);
+  template <class Op> void step_STA(const Op &op);
+  template <class Op> void step_STX(const Op &op);
+  template <class Op> void step_STY(const Op &op);
+  template <class Op> void step_TAX(const Op &op);
+  template <class Op> void step_TAY(const Op &op);
+  template <class Op> void step_TSX(const Op &op);
+  template <class Op> void step_TXA(const Op &op);
+  template <class Op> void step_TXS(const Op &op);
+  template <class Op> void step_TYA(const Op &op);
 
   void step_NMI();
   void step_IRQ();
   void step_OAM_DMA();
 
-  void step_load_mem(const OpCode &op, uint8_t &reg);
+  template <class Op> uint8_t  operand8(const Op &op);
+  template <class Op> uint16_t operand16(const Op &op);
+
+  template <class Op> void step_load_mem(const Op &op, uint8_t &reg);
+  template <class Op> void step_compare(const Op &op, uint8_t &reg);
+  template <class Op> void step_branch(const Op &op, bool test);
+  template <class Op> void step_shift_left(const Op &op, bool carry);
+  template <class Op> void step_shift_right(const Op &op, bool carry);
+  template <class Op> void step_unimplemented(const Op &op);
+
   void step_load_stack(uint8_t &reg);
   void step_load(uint8_t res, uint8_t &reg);
-  void step_compare(const OpCode &op, uint8_t &reg);
-  void step_branch(const OpCode &op, bool test);
-  void step_shift_left(const OpCode &op, bool carry);
-  void step_shift_right(const OpCode &op, bool carry);
-  void step_unimplemented(const OpCode &op);
 
   void set_flag(Flags flag, bool value);
   bool get_flag(Flags flag) const;
 
-  uint8_t   ram_[2 * 1024];
-  Registers regs_;
-  Cart     *cart_;
-  Ppu      *ppu_;
-  Apu      *apu_;
-  Input    *input_;
-  int64_t   cycles_;
-  bool      oops_;
-  bool      jump_;
-  bool      nmi_pending_;
-  uint8_t   nmi_delay_;
-  uint8_t   irq_pending_;
-  uint8_t   irq_delay_;
-  bool      irq_delay_prev_;
-  bool      oam_dma_pending_;
-  uint8_t  *test_ram_; // single-step tests
+  uint8_t        ram_[2 * 1024];
+  const uint8_t *peek_pages_[256];
+  uint8_t       *poke_pages_[256];
+  Registers      regs_;
+  Cart          *cart_;
+  Ppu           *ppu_;
+  Apu           *apu_;
+  Input         *input_;
+  int64_t        cycles_;
+  bool           oops_;
+  bool           jump_;
+  bool           nmi_pending_;
+  uint8_t        nmi_delay_;
+  uint8_t        irq_pending_;
+  uint8_t        irq_delay_;
+  bool           irq_delay_prev_;
+  bool           oam_dma_pending_;
+
+  std::function<void(uint16_t)> sync_;
+
+  Dispatch              dispatch_;
+  int64_t               run_until_;
+  uint16_t              operand_;
+  int                   code_pages_[256];
+  std::vector<CachedOp> code_cache_;
+  CodeCacheStats        code_cache_stats_;
+  int64_t               side_effects_; // writes and I/O reads
+  int64_t               status_reads_; // PPUSTATUS reads (also side effects)
+  uint8_t               last_status_;
+  IdleLoop              idle_loop_;
+  int64_t               idle_cycles_;
+  std::unique_ptr<Jit>  jit_;
 };
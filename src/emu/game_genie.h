@@ -9,6 +9,7 @@ public:
   GameGenieCode(std::string_view code);
 
   const char *code() const { return code_; }
+  uint16_t    addr() const { return addr_; }
   bool        applies(uint16_t addr, uint8_t x) const;
   uint8_t     value() const { return value_; }
 
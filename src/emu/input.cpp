@@ -4,6 +4,7 @@
 #include <stdexcept>
 
 #include "src/emu/input.h"
+#include "src/emu/state.h"
 
 Input::Input() : controllers_{0}, turbo_counter_(0), strobe_(false) {}
 
@@ -16,6 +17,14 @@ void Input::reset() {
   strobe_        = false;
 }
 
+void Input::save_state(StateWriter &w) const {
+  w.write(shift_reg_, turbo_counter_, strobe_);
+}
+
+void Input::load_state(StateReader &r) {
+  r.read(shift_reg_, turbo_counter_, strobe_);
+}
+
 void Input::set_controller(Controller *controller, int index) {
   if (!(index >= 0 && index < 2)) {
     throw std::runtime_error(std::format("invalid controller index: {}", index)
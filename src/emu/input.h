@@ -3,6 +3,8 @@
 #include <cstdint>
 
 class Ppu;
+class StateReader;
+class StateWriter;
 
 class Controller {
 public:
@@ -32,6 +34,10 @@ public:
   void power_on();
   void reset();
 
+  // See Nes::save_state.
+  void save_state(StateWriter &w) const;
+  void load_state(StateReader &r);
+
   void    write_controller(uint8_t x);
   uint8_t read_controller(int index);
 
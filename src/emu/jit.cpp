@@ -0,0 +1,1230 @@
+#include "src/emu/jit.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+#if TEENYNES_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Room for the generated code. When it runs out, every block is dropped and
+// compiled again as needed.
+static constexpr size_t BUFFER_SIZE = 8 << 20;
+
+// N.B., longer blocks are cheaper to run, but are more often too close to the
+// deadline to run at all.
+static constexpr int MAX_BLOCK_OPS = 32;
+
+#if TEENYNES_JIT
+
+namespace {
+
+using enum Cpu::Instruction;
+using enum Cpu::AddrMode;
+using enum Cpu::Flags;
+using enum Cpu::OpCodeFlags;
+
+enum Reg : uint8_t {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+enum Cond : uint8_t {
+  CC_O  = 0x0,
+  CC_B  = 0x2,
+  CC_AE = 0x3,
+  CC_E  = 0x4,
+  CC_NE = 0x5,
+};
+
+enum AluOp : uint8_t {
+  ALU_ADD,
+  ALU_OR,
+  ALU_ADC,
+  ALU_SBB,
+  ALU_AND,
+  ALU_SUB,
+  ALU_XOR,
+  ALU_CMP,
+};
+
+enum ShiftOp : uint8_t {
+  SHIFT_ROL,
+  SHIFT_ROR,
+  SHIFT_RCL,
+  SHIFT_RCR,
+  SHIFT_SHL,
+  SHIFT_SHR,
+};
+
+// Either a register, or [base + index * (1 << scale) + disp].
+struct Operand {
+  bool    is_reg = false;
+  uint8_t base   = 0;
+  int     index  = -1;
+  uint8_t scale  = 0;
+  int32_t disp   = 0;
+};
+
+Operand reg(Reg r) { return {.is_reg = true, .base = r}; }
+
+Operand mem(Reg base, int32_t disp) { return {.base = base, .disp = disp}; }
+
+Operand mem(Reg base, int32_t disp, Reg index, uint8_t scale) {
+  return {.base = base, .index = index, .scale = scale, .disp = disp};
+}
+
+// Just enough of an x86-64 assembler for the code below. Operand sizes are in
+// bytes. Jumps always take 32-bit offsets, so labels can be bound in any order.
+class Assembler {
+public:
+  using Label = int;
+
+  const std::vector<uint8_t> &code() const { return code_; }
+
+  Label new_label() {
+    labels_.push_back(-1);
+    return (Label)labels_.size() - 1;
+  }
+
+  void bind(Label label) { labels_[label] = (int)code_.size(); }
+
+  // Fills in the jumps. Every label used must have been bound by now.
+  void finish() {
+    for (auto [pos, label] : fixups_) {
+      int32_t rel = labels_[label] - (pos + 4);
+      std::memcpy(&code_[pos], &rel, 4);
+    }
+  }
+
+  void mov(int size, const Operand &dst, Reg src) {
+    emit(size, {by_size(size, 0x88)}, src, dst);
+  }
+
+  void mov(int size, Reg dst, const Operand &src) {
+    emit(size, {by_size(size, 0x8a)}, dst, src);
+  }
+
+  void mov_imm(int size, const Operand &dst, int32_t imm) {
+    emit(size, {by_size(size, 0xc6)}, 0, dst);
+    imm_bytes(imm, std::min(size, 4));
+  }
+
+  void mov_imm32(Reg dst, uint32_t imm) {
+    rex(false, 0, -1, dst, false);
+    byte(0xb8 + (dst & 7));
+    imm_bytes((int32_t)imm, 4);
+  }
+
+  void mov_imm64(Reg dst, uint64_t imm) {
+    rex(true, 0, -1, dst, false);
+    byte(0xb8 + (dst & 7));
+    for (int i = 0; i < 8; i++) {
+      byte((uint8_t)(imm >> (i * 8)));
+    }
+  }
+
+  void movzx8(Reg dst, const Operand &src) {
+    emit(4, {0x0f, 0xb6}, dst, src, src.is_reg);
+  }
+
+  void movzx16(Reg dst, const Operand &src) { emit(4, {0x0f, 0xb7}, dst, src); }
+
+  void lea(int size, Reg dst, const Operand &src) {
+    emit(size, {0x8d}, dst, src);
+  }
+
+  void alu_imm(int size, AluOp op, const Operand &dst, int32_t imm) {
+    if (size == 1) {
+      emit(size, {0x80}, op, dst);
+      imm_bytes(imm, 1);
+    } else if (imm >= -128 && imm <= 127) {
+      emit(size, {0x83}, op, dst);
+      imm_bytes(imm, 1);
+    } else {
+      emit(size, {0x81}, op, dst);
+      imm_bytes(imm, std::min(size, 4));
+    }
+  }
+
+  // dst op= src
+  void alu(int size, AluOp op, const Operand &dst, Reg src) {
+    emit(size, {(uint8_t)(op * 8 + (size == 1 ? 0 : 1))}, src, dst);
+  }
+
+  // dst op= src
+  void alu(int size, AluOp op, Reg dst, const Operand &src) {
+    emit(size, {(uint8_t)(op * 8 + (size == 1 ? 2 : 3))}, dst, src);
+  }
+
+  void test(int size, const Operand &dst, Reg src) {
+    emit(size, {by_size(size, 0x84)}, src, dst);
+  }
+
+  void test_imm(int size, const Operand &dst, int32_t imm) {
+    emit(size, {by_size(size, 0xf6)}, 0, dst);
+    imm_bytes(imm, std::min(size, 4));
+  }
+
+  void shift1(int size, ShiftOp op, const Operand &dst) {
+    emit(size, {by_size(size, 0xd0)}, op, dst);
+  }
+
+  void shift_imm(int size, ShiftOp op, const Operand &dst, uint8_t imm) {
+    emit(size, {by_size(size, 0xc0)}, op, dst);
+    byte(imm);
+  }
+
+  void inc(int size, const Operand &dst) {
+    emit(size, {by_size(size, 0xfe)}, 0, dst);
+  }
+
+  void dec(int size, const Operand &dst) {
+    emit(size, {by_size(size, 0xfe)}, 1, dst);
+  }
+
+  void setcc(Cond cond, const Operand &dst) {
+    emit(1, {0x0f, (uint8_t)(0x90 + cond)}, 0, dst);
+  }
+
+  void bt_imm(const Operand &dst, uint8_t bit) {
+    emit(4, {0x0f, 0xba}, 4, dst);
+    byte(bit);
+  }
+
+  void cmc() { byte(0xf5); }
+
+  void jcc(Cond cond, Label label) {
+    byte(0x0f);
+    byte(0x80 + cond);
+    fixup(label);
+  }
+
+  void jmp(Label label) {
+    byte(0xe9);
+    fixup(label);
+  }
+
+  template <class Fn> void call(Fn *fn) {
+    mov_imm64(RAX, (uint64_t)(uintptr_t)fn);
+    emit(4, {0xff}, 2, reg(RAX));
+  }
+
+  void push(Reg r) {
+    rex(false, 0, -1, r, false);
+    byte(0x50 + (r & 7));
+  }
+
+  void pop(Reg r) {
+    rex(false, 0, -1, r, false);
+    byte(0x58 + (r & 7));
+  }
+
+  void ret() { byte(0xc3); }
+
+private:
+  // Most ops with a byte form come in pairs, with the other sizes next.
+  static uint8_t by_size(int size, uint8_t byte_opcode) {
+    return byte_opcode + (size != 1);
+  }
+
+  void byte(uint8_t x) { code_.push_back(x); }
+
+  void imm_bytes(int32_t imm, int size) {
+    for (int i = 0; i < size; i++) {
+      byte((uint8_t)(imm >> (i * 8)));
+    }
+  }
+
+  void fixup(Label label) {
+    fixups_.push_back({(int)code_.size(), label});
+    imm_bytes(0, 4);
+  }
+
+  // N.B., without a REX prefix, byte registers 4-7 are AH, CH, DH and BH
+  // rather than SPL, BPL, SIL and DIL.
+  void rex(bool w, int r, int x, int b, bool force) {
+    uint8_t prefix = 0x40 | (w << 3) | ((r >> 3) << 2) | (b >> 3);
+    if (x >= 0) {
+      prefix |= (x >> 3) << 1;
+    }
+    if (prefix != 0x40 || force) {
+      byte(prefix);
+    }
+  }
+
+  // Emits an instruction with a ModRM byte, where r is either a register or an
+  // op code extension. N.B., byte_rm is for instructions whose r/m operand is
+  // a byte even though the instruction isn't (movzx).
+  void emit(
+      int                            size,
+      std::initializer_list<uint8_t> opcode,
+      int                            r,
+      const Operand                 &rm,
+      bool                           byte_rm = false
+  ) {
+    if (size == 2) {
+      byte(0x66);
+    }
+    bool byte_regs = size == 1 || byte_rm;
+    bool force     = byte_regs && ((r >= 4 && r < 8 && size == 1) ||
+                               (rm.is_reg && rm.base >= 4 && rm.base < 8));
+    rex(size == 8, r, rm.is_reg ? -1 : rm.index, rm.base, force);
+    for (uint8_t b : opcode) {
+      byte(b);
+    }
+
+    if (rm.is_reg) {
+      byte(0xc0 | ((r & 7) << 3) | (rm.base & 7));
+      return;
+    }
+
+    // N.B., RSP and R12 as a base need a SIB byte, and RBP and R13 as a base
+    // need a displacement.
+    int  base = rm.base & 7;
+    bool sib  = rm.index >= 0 || base == RSP;
+    int  mod;
+    if (rm.disp == 0 && base != RBP) {
+      mod = 0;
+    } else if (rm.disp >= -128 && rm.disp <= 127) {
+      mod = 1;
+    } else {
+      mod = 2;
+    }
+    byte((uint8_t)((mod << 6) | ((r & 7) << 3) | (sib ? 4 : base)));
+    if (sib) {
+      int index = rm.index >= 0 ? rm.index & 7 : 4;
+      byte((uint8_t)((rm.scale << 6) | (index << 3) | base));
+    }
+    if (mod == 1) {
+      byte((uint8_t)rm.disp);
+    } else if (mod == 2) {
+      imm_bytes(rm.disp, 4);
+    }
+  }
+
+  std::vector<uint8_t>             code_;
+  std::vector<int>                 labels_; // positions, or -1 if unbound
+  std::vector<std::pair<int, int>> fixups_; // positions of the offsets
+};
+
+// N and Z for each value of a result.
+constexpr std::array<uint8_t, 256> NZ_FLAGS = [] {
+  std::array<uint8_t, 256> flags;
+  for (int x = 0; x < 256; x++) {
+    flags[x] = (uint8_t)((x & N_FLAG) | (x == 0 ? Z_FLAG : 0));
+  }
+  return flags;
+}();
+
+} // namespace
+
+// Where the generated code finds things, filled in by Jit (a friend of Cpu).
+struct JitContext {
+  int32_t A, X, Y, S, P, PC;
+  int32_t cycles, side_effects, operand, peek_pages, poke_pages;
+
+  uint8_t (*peek)(Cpu *cpu, uint16_t addr);
+  void (*poke_io)(Cpu *cpu, uint16_t addr, uint8_t x);
+  void (*const *handlers)(Cpu &cpu);
+};
+
+namespace {
+
+struct DecodedOp {
+  const Cpu::OpCode *op;
+  uint16_t           operand;
+  int                lo; // within the page
+};
+
+// Ops that are translated inline. The rest call the op handlers instead, and
+// end the block.
+bool inlined(const Cpu::OpCode &op) {
+  switch (op.ins) {
+  case ADC:
+  case AND:
+  case ASL:
+  case BCC:
+  case BCS:
+  case BEQ:
+  case BIT:
+  case BMI:
+  case BNE:
+  case BPL:
+  case BVC:
+  case BVS:
+  case CLC:
+  case CLD:
+  case CLV:
+  case CMP:
+  case CPX:
+  case CPY:
+  case DEC:
+  case DEX:
+  case DEY:
+  case EOR:
+  case INC:
+  case INX:
+  case INY:
+  case JSR:
+  case LDA:
+  case LDX:
+  case LDY:
+  case LSR:
+  case ORA:
+  case PHA:
+  case PHP:
+  case PLA:
+  case ROL:
+  case ROR:
+  case RTS:
+  case SBC:
+  case SEC:
+  case SED:
+  case STA:
+  case STX:
+  case STY:
+  case TAX:
+  case TAY:
+  case TSX:
+  case TXA:
+  case TXS:
+  case TYA: return true;
+  case JMP: return op.mode == ABSOLUTE;
+  case NOP: {
+    // N.B., the other illegal NOPs read memory (see Cpu::step_NOP).
+    return op.mode == IMPLICIT || op.mode == ACCUMULATOR ||
+           op.mode == IMMEDIATE;
+  }
+  default: return false;
+  }
+}
+
+bool is_branch(const Cpu::OpCode &op) { return op.mode == RELATIVE; }
+
+// Whether an op ends its block. N.B., a branch only ends it if taken.
+bool ends_block(const Cpu::OpCode &op) {
+  return !inlined(op) || op.ins == JMP || op.ins == JSR || op.ins == RTS;
+}
+
+// Whether an "oops" cycle is added no matter what (see Cpu::decode_addr).
+bool forced_oops(const Cpu::OpCode &op) {
+  bool indexed = op.mode == ABSOLUTE_X || op.mode == ABSOLUTE_Y ||
+                 op.mode == INDIRECT_Y || op.mode == RELATIVE;
+  return indexed && (op.flags & FORCE_OOPS);
+}
+
+// Whether an "oops" cycle depends on the address.
+bool dynamic_oops(const Cpu::OpCode &op) {
+  bool indexed = op.mode == ABSOLUTE_X || op.mode == ABSOLUTE_Y ||
+                 op.mode == INDIRECT_Y;
+  return indexed && !(op.flags & FORCE_OOPS);
+}
+
+int max_cycles(const Cpu::OpCode &op) {
+  int extra = is_branch(op) ? 2 : forced_oops(op) + dynamic_oops(op);
+  return op.base_cycles + extra;
+}
+
+// Generates the code for a block. Registers:
+//
+//   rbx       the Cpu
+//   rbp       NZ_FLAGS
+//   eax       on exit, where the last op run starts in its page
+//   r12d      set once an access went through peek_io() or poke_io(), or a
+//             write hit the block's own code
+//   r13-r15   kept across calls
+//   r14d      the "oops" cycle of the current op, if only known at run time
+//
+// Cycles and PC aren't written back after each op. Instead, pending_cycles_
+// and pending_pc_ keep track of how far behind they are, and they're caught up
+// before calls and exits. While an op runs, they're as of its start, as in the
+// interpreter.
+class Compiler {
+public:
+  Compiler(const JitContext &ctx, const uint8_t *code, int code_size)
+      : ctx_(ctx),
+        code_(code),
+        code_size_(code_size),
+        epilogue_(a_.new_label()),
+        pending_cycles_(0),
+        pending_pc_(0),
+        lo_(0) {}
+
+  std::vector<uint8_t> compile(const std::vector<DecodedOp> &ops) {
+    a_.push(RBX);
+    a_.push(RBP);
+    a_.push(R12);
+    a_.push(R13);
+    a_.push(R14);
+    a_.push(R15);
+    a_.alu_imm(8, ALU_SUB, reg(RSP), 8); // N.B., keeps the stack aligned
+    a_.mov(8, RBX, reg(RDI));
+    a_.mov_imm64(RBP, (uint64_t)(uintptr_t)NZ_FLAGS.data());
+    a_.mov_imm32(R12, 0);
+
+    bool ended = false;
+    for (auto &op : ops) {
+      lo_   = op.lo;
+      ended = compile_op(*op.op, op.operand);
+    }
+    if (!ended) {
+      exit_block(pending_cycles_, pending_pc_, lo_);
+    }
+
+    // N.B., cold paths may add more cold paths.
+    for (size_t i = 0; i < cold_.size(); i++) {
+      cold_[i]();
+    }
+
+    a_.bind(epilogue_);
+    a_.alu_imm(8, ALU_ADD, reg(RSP), 8);
+    a_.pop(R15);
+    a_.pop(R14);
+    a_.pop(R13);
+    a_.pop(R12);
+    a_.pop(RBP);
+    a_.pop(RBX);
+    a_.ret();
+    a_.finish();
+    return a_.code();
+  }
+
+private:
+  using Label = Assembler::Label;
+
+  // Returns true if the op ended the block.
+  bool compile_op(const Cpu::OpCode &op, uint16_t operand) {
+    if (!inlined(op)) {
+      call_handler(op, operand);
+      return true;
+    }
+    if (is_branch(op)) {
+      branch(op, operand);
+      return false;
+    }
+
+    bool oops       = false; // only known at run time, in r14d
+    bool accesses   = op.mode != IMPLICIT && op.mode != ACCUMULATOR &&
+                    op.mode != IMMEDIATE;
+    int32_t regs[3] = {ctx_.A, ctx_.X, ctx_.Y};
+
+    switch (op.ins) {
+    case LDA:
+    case LDX:
+    case LDY: {
+      int32_t dst = regs[op.ins - LDA];
+      oops        = load_operand(op, operand);
+      a_.mov(1, mem(RBX, dst), RAX);
+      set_nz();
+      break;
+    }
+    case STA:
+    case STX:
+    case STY: {
+      oops = address(op, operand);
+      a_.movzx8(RDX, mem(RBX, regs[op.ins - STA]));
+      poke();
+      break;
+    }
+    case AND:
+    case ORA:
+    case EOR: {
+      AluOp alu = op.ins == AND ? ALU_AND : op.ins == ORA ? ALU_OR : ALU_XOR;
+      oops      = load_operand(op, operand);
+      a_.alu(1, alu, RAX, mem(RBX, ctx_.A));
+      a_.mov(1, mem(RBX, ctx_.A), RAX);
+      set_nz();
+      break;
+    }
+    case ADC:
+    case SBC: {
+      oops = load_operand(op, operand);
+      a_.mov(4, RDX, reg(RAX));
+      a_.movzx8(RAX, mem(RBX, ctx_.A));
+      a_.movzx8(RCX, mem(RBX, ctx_.P));
+      a_.bt_imm(reg(RCX), 0);
+      if (op.ins == ADC) {
+        a_.alu(1, ALU_ADC, reg(RAX), RDX);
+        a_.setcc(CC_B, reg(R8));
+      } else {
+        // N.B., the 6502's carry is the inverse of x86's borrow.
+        a_.cmc();
+        a_.alu(1, ALU_SBB, reg(RAX), RDX);
+        a_.setcc(CC_AE, reg(R8));
+      }
+      a_.setcc(CC_O, reg(R9));
+      a_.mov(1, mem(RBX, ctx_.A), RAX);
+      a_.movzx8(RDX, mem(RBP, 0, RAX, 0));
+      a_.alu(1, ALU_OR, reg(RDX), R8);
+      a_.shift_imm(1, SHIFT_SHL, reg(R9), 6);
+      a_.alu(1, ALU_OR, reg(RDX), R9);
+      a_.alu_imm(
+          1, ALU_AND, mem(RBX, ctx_.P), ~(N_FLAG | Z_FLAG | C_FLAG | V_FLAG)
+      );
+      a_.alu(1, ALU_OR, mem(RBX, ctx_.P), RDX);
+      break;
+    }
+    case CMP:
+    case CPX:
+    case CPY: {
+      oops = load_operand(op, operand);
+      a_.movzx8(RCX, mem(RBX, regs[op.ins - CMP]));
+      a_.alu(1, ALU_SUB, reg(RCX), RAX);
+      a_.setcc(CC_AE, reg(R8));
+      a_.movzx8(RAX, reg(RCX));
+      set_nzc();
+      break;
+    }
+    case BIT: {
+      oops = load_operand(op, operand);
+      a_.mov(4, RDX, reg(RAX));
+      a_.alu_imm(4, ALU_AND, reg(RDX), N_FLAG | V_FLAG);
+      a_.test(1, mem(RBX, ctx_.A), RAX);
+      a_.setcc(CC_E, reg(RCX));
+      a_.shift1(1, SHIFT_SHL, reg(RCX)); // to Z_FLAG
+      a_.alu(1, ALU_OR, reg(RDX), RCX);
+      a_.alu_imm(1, ALU_AND, mem(RBX, ctx_.P), ~(N_FLAG | V_FLAG | Z_FLAG));
+      a_.alu(1, ALU_OR, mem(RBX, ctx_.P), RDX);
+      break;
+    }
+    case ASL:
+    case LSR:
+    case ROL:
+    case ROR: {
+      if (op.mode == ACCUMULATOR) {
+        a_.movzx8(RAX, mem(RBX, ctx_.A));
+        shift(op.ins);
+        a_.mov(1, mem(RBX, ctx_.A), RAX);
+        set_nzc();
+      } else {
+        oops = read_modify_write(op, operand, [&] {
+          shift(op.ins);
+          set_nzc();
+        });
+      }
+      break;
+    }
+    case INC:
+    case DEC: {
+      oops = read_modify_write(op, operand, [&] {
+        if (op.ins == INC) {
+          a_.inc(1, reg(RAX));
+        } else {
+          a_.dec(1, reg(RAX));
+        }
+        set_nz();
+      });
+      break;
+    }
+    case INX:
+    case INY:
+    case DEX:
+    case DEY: {
+      int32_t r = op.ins == INX || op.ins == DEX ? ctx_.X : ctx_.Y;
+      a_.movzx8(RAX, mem(RBX, r));
+      if (op.ins == INX || op.ins == INY) {
+        a_.inc(1, reg(RAX));
+      } else {
+        a_.dec(1, reg(RAX));
+      }
+      a_.mov(1, mem(RBX, r), RAX);
+      set_nz();
+      break;
+    }
+    case TAX: transfer(ctx_.A, ctx_.X); break;
+    case TAY: transfer(ctx_.A, ctx_.Y); break;
+    case TSX: transfer(ctx_.S, ctx_.X); break;
+    case TXA: transfer(ctx_.X, ctx_.A); break;
+    case TYA: transfer(ctx_.Y, ctx_.A); break;
+    case TXS: {
+      // N.B., doesn't set flags.
+      a_.movzx8(RAX, mem(RBX, ctx_.X));
+      a_.mov(1, mem(RBX, ctx_.S), RAX);
+      break;
+    }
+    case CLC: a_.alu_imm(1, ALU_AND, mem(RBX, ctx_.P), ~C_FLAG); break;
+    case CLD: a_.alu_imm(1, ALU_AND, mem(RBX, ctx_.P), ~D_FLAG); break;
+    case CLV: a_.alu_imm(1, ALU_AND, mem(RBX, ctx_.P), ~V_FLAG); break;
+    case SEC: a_.alu_imm(1, ALU_OR, mem(RBX, ctx_.P), C_FLAG); break;
+    case SED: a_.alu_imm(1, ALU_OR, mem(RBX, ctx_.P), D_FLAG); break;
+    case NOP: break;
+    case PHA:
+    case PHP: {
+      if (op.ins == PHA) {
+        a_.movzx8(RDX, mem(RBX, ctx_.A));
+      } else {
+        a_.movzx8(RDX, mem(RBX, ctx_.P));
+        a_.alu_imm(4, ALU_OR, reg(RDX), 0b00110000);
+      }
+      push();
+      accesses = true;
+      break;
+    }
+    case PLA: {
+      pop();
+      a_.mov(1, mem(RBX, ctx_.A), RAX);
+      set_nz();
+      accesses = true;
+      break;
+    }
+    case JMP: {
+      a_.mov_imm(2, mem(RBX, ctx_.PC), operand);
+      pending_pc_ = 0;
+      exit_block(pending_cycles_ + op.base_cycles, 0, lo_);
+      return true;
+    }
+    case JSR: {
+      a_.movzx16(R13, mem(RBX, ctx_.PC));
+      a_.alu_imm(4, ALU_ADD, reg(R13), pending_pc_ + 2);
+      a_.mov(4, RDX, reg(R13));
+      a_.shift_imm(4, SHIFT_SHR, reg(RDX), 8);
+      a_.movzx8(RDX, reg(RDX));
+      push();
+      a_.movzx8(RDX, reg(R13));
+      push();
+      a_.mov_imm(2, mem(RBX, ctx_.PC), operand);
+      pending_pc_ = 0;
+      exit_block(pending_cycles_ + op.base_cycles, 0, lo_);
+      return true;
+    }
+    case RTS: {
+      pop();
+      a_.mov(4, R15, reg(RAX));
+      pop();
+      a_.shift_imm(4, SHIFT_SHL, reg(RAX), 8);
+      a_.alu(4, ALU_OR, RAX, reg(R15));
+      a_.inc(4, reg(RAX));
+      a_.mov(2, mem(RBX, ctx_.PC), RAX);
+      pending_pc_ = 0;
+      exit_block(pending_cycles_ + op.base_cycles, 0, lo_);
+      return true;
+    }
+    default: throw std::runtime_error("unreachable");
+    }
+
+    if (oops) {
+      a_.alu(8, ALU_ADD, mem(RBX, ctx_.cycles), R14);
+    }
+    pending_cycles_ += op.base_cycles + forced_oops(op);
+    pending_pc_ += op.bytes;
+    if (accesses) {
+      exit_if_io();
+    }
+    return false;
+  }
+
+  void call_handler(const Cpu::OpCode &op, uint16_t operand) {
+    catch_up(pending_cycles_, pending_pc_);
+    a_.mov_imm(2, mem(RBX, ctx_.operand), operand);
+    a_.mov(8, RDI, reg(RBX));
+    a_.call(ctx_.handlers[op.code]);
+    a_.mov_imm32(RAX, lo_);
+    a_.jmp(epilogue_);
+  }
+
+  // Leaves the block if the branch is taken, and carries on otherwise.
+  void branch(const Cpu::OpCode &op, uint16_t operand) {
+    uint8_t flag;
+    switch (op.ins) {
+    case BCC:
+    case BCS: flag = C_FLAG; break;
+    case BEQ:
+    case BNE: flag = Z_FLAG; break;
+    case BMI:
+    case BPL: flag = N_FLAG; break;
+    case BVC:
+    case BVS: flag = V_FLAG; break;
+    default: throw std::runtime_error("unreachable");
+    }
+    bool if_set =
+        op.ins == BCS || op.ins == BEQ || op.ins == BMI || op.ins == BVS;
+
+    // N.B., pages are aligned, so whether a branch crosses one only depends on
+    // where it is within its page.
+    int  rel     = (int8_t)operand;
+    int  next    = lo_ + op.bytes;
+    bool crossed = (next & ~0xff) != ((next + rel) & ~0xff);
+
+    Label taken = a_.new_label();
+    a_.test_imm(1, mem(RBX, ctx_.P), flag);
+    a_.jcc(if_set ? CC_NE : CC_E, taken);
+    cold_.push_back([=, this,
+                     cycles = pending_cycles_ + op.base_cycles + 1 + crossed,
+                     pc     = pending_pc_ + op.bytes + rel,
+                     lo     = lo_] {
+      a_.bind(taken);
+      exit_block(cycles, pc, lo);
+    });
+    pending_cycles_ += op.base_cycles;
+    pending_pc_ += op.bytes;
+  }
+
+  void transfer(int32_t src, int32_t dst) {
+    a_.movzx8(RAX, mem(RBX, src));
+    a_.mov(1, mem(RBX, dst), RAX);
+    set_nz();
+  }
+
+  // Leaves the operand in eax.
+  bool load_operand(const Cpu::OpCode &op, uint16_t operand) {
+    if (op.mode == IMMEDIATE) {
+      a_.mov_imm32(RAX, (uint8_t)operand);
+      return false;
+    }
+    bool oops = address(op, operand);
+    peek();
+    return oops;
+  }
+
+  // Runs modify on the value at the address in eax, writing it back twice
+  // (see Cpu::step_INC).
+  template <class Modify>
+  bool read_modify_write(
+      const Cpu::OpCode &op, uint16_t operand, Modify modify
+  ) {
+    bool oops = address(op, operand);
+    a_.mov(4, R13, reg(RCX));
+    peek();
+    a_.mov(4, R15, reg(RAX));
+    a_.mov(4, RCX, reg(R13));
+    a_.mov(4, RDX, reg(R15));
+    poke();
+    a_.mov(4, RAX, reg(R15));
+    modify();
+    a_.mov(4, RCX, reg(R13));
+    a_.movzx8(RDX, reg(RAX));
+    poke();
+    return oops;
+  }
+
+  // Leaves the address in ecx (see Cpu::decode_addr). Returns true if the
+  // "oops" cycle is only known at run time, in which case it's left in r14d.
+  bool address(const Cpu::OpCode &op, uint16_t operand) {
+    switch (op.mode) {
+    case ZERO_PAGE: {
+      a_.mov_imm32(RCX, (uint8_t)operand);
+      return false;
+    }
+    case ZERO_PAGE_X:
+    case ZERO_PAGE_Y: {
+      a_.movzx8(RCX, mem(RBX, op.mode == ZERO_PAGE_X ? ctx_.X : ctx_.Y));
+      a_.alu_imm(1, ALU_ADD, reg(RCX), (uint8_t)operand);
+      return false;
+    }
+    case ABSOLUTE: {
+      a_.mov_imm32(RCX, operand);
+      return false;
+    }
+    case ABSOLUTE_X:
+    case ABSOLUTE_Y: {
+      a_.movzx8(RCX, mem(RBX, op.mode == ABSOLUTE_X ? ctx_.X : ctx_.Y));
+      a_.alu_imm(4, ALU_ADD, reg(RCX), operand);
+      if (dynamic_oops(op)) {
+        a_.alu_imm(4, ALU_CMP, reg(RCX), (operand & 0xff00) + 0x100);
+        a_.setcc(CC_AE, reg(R14));
+        a_.movzx8(R14, reg(R14));
+      }
+      a_.movzx16(RCX, reg(RCX));
+      return dynamic_oops(op);
+    }
+    case INDIRECT_X: {
+      a_.movzx8(RCX, mem(RBX, ctx_.X));
+      a_.alu_imm(1, ALU_ADD, reg(RCX), (uint8_t)operand);
+      a_.mov(4, R13, reg(RCX));
+      peek();
+      a_.mov(4, R15, reg(RAX));
+      a_.lea(4, RCX, mem(R13, 1));
+      a_.movzx8(RCX, reg(RCX));
+      peek();
+      a_.shift_imm(4, SHIFT_SHL, reg(RAX), 8);
+      a_.alu(4, ALU_OR, RAX, reg(R15));
+      a_.mov(4, RCX, reg(RAX));
+      return false;
+    }
+    case INDIRECT_Y: {
+      a_.mov_imm32(RCX, (uint8_t)operand);
+      peek();
+      a_.mov(4, R15, reg(RAX));
+      a_.mov_imm32(RCX, (uint8_t)(operand + 1));
+      peek();
+      a_.shift_imm(4, SHIFT_SHL, reg(RAX), 8);
+      a_.alu(4, ALU_OR, RAX, reg(R15));
+      a_.movzx8(RCX, mem(RBX, ctx_.Y));
+      a_.alu(4, ALU_ADD, RCX, reg(RAX));
+      if (dynamic_oops(op)) {
+        a_.mov(4, RDX, reg(RCX));
+        a_.alu(4, ALU_XOR, RDX, reg(RAX));
+        a_.test_imm(4, reg(RDX), 0xff00);
+        a_.setcc(CC_NE, reg(R14));
+        a_.movzx8(R14, reg(R14));
+      }
+      a_.movzx16(RCX, reg(RCX));
+      return dynamic_oops(op);
+    }
+    default: throw std::runtime_error("unreachable");
+    }
+  }
+
+  // Reads the byte at the address in ecx into eax (see Cpu::peek).
+  void peek() {
+    Label slow = a_.new_label();
+    Label done = a_.new_label();
+    a_.mov(4, RAX, reg(RCX));
+    a_.shift_imm(4, SHIFT_SHR, reg(RAX), 8);
+    a_.mov(8, RDX, mem(RBX, ctx_.peek_pages, RAX, 3));
+    a_.test(8, reg(RDX), RDX);
+    a_.jcc(CC_E, slow);
+    a_.movzx8(RAX, reg(RCX));
+    a_.movzx8(RAX, mem(RDX, 0, RAX, 0));
+    a_.bind(done);
+
+    cold_.push_back([=, this, cycles = pending_cycles_, pc = pending_pc_] {
+      a_.bind(slow);
+      catch_up(cycles, pc);
+      a_.mov(8, RDI, reg(RBX));
+      a_.mov(4, RSI, reg(RCX));
+      a_.call(ctx_.peek);
+      a_.movzx8(RAX, reg(RAX));
+      catch_up(-cycles, -pc);
+      a_.mov_imm32(R12, 1);
+      a_.jmp(done);
+    });
+  }
+
+  // Writes the byte in edx to the address in ecx (see Cpu::poke).
+  void poke() {
+    Label slow = a_.new_label();
+    Label done = a_.new_label();
+    a_.inc(8, mem(RBX, ctx_.side_effects));
+    a_.mov(4, RAX, reg(RCX));
+    a_.shift_imm(4, SHIFT_SHR, reg(RAX), 8);
+    a_.mov(8, RSI, mem(RBX, ctx_.poke_pages, RAX, 3));
+    a_.test(8, reg(RSI), RSI);
+    a_.jcc(CC_E, slow);
+    a_.movzx8(RAX, reg(RCX));
+    a_.mov(1, mem(RSI, 0, RAX, 0), RDX);
+    if (code_) {
+      // N.B., compares host addresses, so that mirrors of the code count too.
+      a_.lea(8, RAX, mem(RSI, 0, RAX, 0));
+      a_.mov_imm64(RDI, (uint64_t)(uintptr_t)code_);
+      a_.alu(8, ALU_SUB, reg(RAX), RDI);
+      a_.alu_imm(8, ALU_CMP, reg(RAX), code_size_);
+      a_.jcc(CC_AE, done);
+      a_.mov_imm32(R12, 1);
+    }
+    a_.bind(done);
+
+    cold_.push_back([=, this, cycles = pending_cycles_, pc = pending_pc_] {
+      a_.bind(slow);
+      catch_up(cycles, pc);
+      a_.mov(8, RDI, reg(RBX));
+      a_.mov(4, RSI, reg(RCX));
+      a_.movzx8(RDX, reg(RDX));
+      a_.call(ctx_.poke_io);
+      catch_up(-cycles, -pc);
+      a_.mov_imm32(R12, 1);
+      a_.jmp(done);
+    });
+  }
+
+  // Pushes the byte in edx (see Cpu::push).
+  void push() {
+    a_.movzx8(RCX, mem(RBX, ctx_.S));
+    a_.alu_imm(4, ALU_OR, reg(RCX), 0x100);
+    poke();
+    a_.dec(1, mem(RBX, ctx_.S));
+  }
+
+  // Pops a byte into eax (see Cpu::pop).
+  void pop() {
+    a_.inc(1, mem(RBX, ctx_.S));
+    a_.movzx8(RCX, mem(RBX, ctx_.S));
+    a_.alu_imm(4, ALU_OR, reg(RCX), 0x100);
+    peek();
+  }
+
+  // Shifts al, leaving the carry in r8b.
+  void shift(Cpu::Instruction ins) {
+    if (ins == ROL || ins == ROR) {
+      a_.movzx8(RCX, mem(RBX, ctx_.P));
+      a_.bt_imm(reg(RCX), 0);
+    }
+    switch (ins) {
+    case ASL: a_.shift1(1, SHIFT_SHL, reg(RAX)); break;
+    case LSR: a_.shift1(1, SHIFT_SHR, reg(RAX)); break;
+    case ROL: a_.shift1(1, SHIFT_RCL, reg(RAX)); break;
+    case ROR: a_.shift1(1, SHIFT_RCR, reg(RAX)); break;
+    default: throw std::runtime_error("unreachable");
+    }
+    a_.setcc(CC_B, reg(R8));
+  }
+
+  // Sets N and Z from eax.
+  void set_nz() {
+    a_.movzx8(RDX, mem(RBP, 0, RAX, 0));
+    a_.alu_imm(1, ALU_AND, mem(RBX, ctx_.P), ~(N_FLAG | Z_FLAG));
+    a_.alu(1, ALU_OR, mem(RBX, ctx_.P), RDX);
+  }
+
+  // Sets N and Z from eax, and C from r8b.
+  void set_nzc() {
+    a_.movzx8(RDX, mem(RBP, 0, RAX, 0));
+    a_.alu(1, ALU_OR, reg(RDX), R8);
+    a_.alu_imm(1, ALU_AND, mem(RBX, ctx_.P), ~(N_FLAG | Z_FLAG | C_FLAG));
+    a_.alu(1, ALU_OR, mem(RBX, ctx_.P), RDX);
+  }
+
+  // Adds to the cycle count and PC in memory.
+  void catch_up(int cycles, int pc) {
+    if (cycles) {
+      a_.alu_imm(8, ALU_ADD, mem(RBX, ctx_.cycles), cycles);
+    }
+    if ((int16_t)pc) {
+      a_.alu_imm(2, ALU_ADD, mem(RBX, ctx_.PC), (int16_t)pc);
+    }
+  }
+
+  // Leaves the block, returning where the last op run started.
+  void exit_block(int cycles, int pc, int lo) {
+    catch_up(cycles, pc);
+    a_.mov_imm32(RAX, lo);
+    a_.jmp(epilogue_);
+  }
+
+  // Ends the block after the current op if it went through peek_io() or
+  // poke_io() (or wrote to its own code).
+  void exit_if_io() {
+    Label stub = a_.new_label();
+    a_.test(4, reg(R12), R12);
+    a_.jcc(CC_NE, stub);
+    cold_.push_back(
+        [=, this, cycles = pending_cycles_, pc = pending_pc_, lo = lo_] {
+          a_.bind(stub);
+          exit_block(cycles, pc, lo);
+        }
+    );
+  }
+
+  const JitContext &ctx_;
+  const uint8_t    *code_; // if the block can be written to
+  int               code_size_;
+  Assembler         a_;
+  Label             epilogue_;
+  int               pending_cycles_;
+  int               pending_pc_;
+  int               lo_; // where the current op starts in its page
+
+  std::vector<std::function<void()>> cold_;
+};
+
+template <class T>
+int32_t offset_of(const Cpu &cpu, const T &field) {
+  return (int32_t)((const char *)&field - (const char *)&cpu);
+}
+
+} // namespace
+
+Jit::Jit(Cpu &cpu)
+    : cpu_(cpu),
+      buffer_(nullptr),
+      buffer_used_(0),
+      ram_blocks_(0x10000) {
+  void *buffer = mmap(
+      nullptr,
+      BUFFER_SIZE,
+      PROT_READ | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0
+  );
+  if (buffer == MAP_FAILED) {
+    throw std::runtime_error("failed to map memory for the JIT");
+  }
+  buffer_ = (uint8_t *)buffer;
+}
+
+Jit::~Jit() { munmap(buffer_, BUFFER_SIZE); }
+
+Jit::Block *Jit::compile(uint16_t pc, const uint8_t *page, bool in_rom) {
+  std::vector<DecodedOp> ops;
+  int                    lo     = pc & 0xff;
+  int64_t                cycles = 0;
+  while (lo < 0x100 && (int)ops.size() < MAX_BLOCK_OPS) {
+    const Cpu::OpCode &op = Cpu::OP_CODES[page[lo]];
+    if (op.ins == INVALID_INS || lo + op.bytes > 0x100) {
+      break;
+    }
+    uint16_t operand = 0;
+    if (op.bytes >= 2) {
+      operand = page[lo + 1];
+    }
+    if (op.bytes >= 3) {
+      operand |= page[lo + 2] << 8;
+    }
+    ops.push_back({&op, operand, lo});
+    lo += op.bytes;
+    if (ends_block(op)) {
+      break;
+    }
+    cycles += max_cycles(op);
+  }
+  if (ops.empty()) {
+    return nullptr;
+  }
+
+  JitContext ctx;
+  ctx.A            = offset_of(cpu_, cpu_.regs_.A);
+  ctx.X            = offset_of(cpu_, cpu_.regs_.X);
+  ctx.Y            = offset_of(cpu_, cpu_.regs_.Y);
+  ctx.S            = offset_of(cpu_, cpu_.regs_.S);
+  ctx.P            = offset_of(cpu_, cpu_.regs_.P);
+  ctx.PC           = offset_of(cpu_, cpu_.regs_.PC);
+  ctx.cycles       = offset_of(cpu_, cpu_.cycles_);
+  ctx.side_effects = offset_of(cpu_, cpu_.side_effects_);
+  ctx.operand      = offset_of(cpu_, cpu_.operand_);
+  ctx.peek_pages   = offset_of(cpu_, cpu_.peek_pages_);
+  ctx.poke_pages   = offset_of(cpu_, cpu_.poke_pages_);
+  ctx.peek         = &Jit::peek;
+  ctx.poke_io      = &Jit::poke_io;
+  ctx.handlers     = Cpu::HANDLERS.data();
+
+  int                  start = pc & 0xff;
+  const uint8_t       *code  = in_rom ? nullptr : page + start;
+  std::vector<uint8_t> bytes =
+      Compiler(ctx, code, lo - start).compile(ops);
+
+  if (buffer_used_ + bytes.size() > BUFFER_SIZE) {
+    flush();
+  }
+
+  // N.B., the buffer is only writable while a block is copied in.
+  static const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  uint8_t            *dst       = buffer_ + buffer_used_;
+  uint8_t            *begin = buffer_ + buffer_used_ / page_size * page_size;
+  size_t              size  = dst + bytes.size() - begin;
+  if (mprotect(begin, size, PROT_READ | PROT_WRITE) != 0) {
+    throw std::runtime_error("failed to make JIT code writable");
+  }
+  std::memcpy(dst, bytes.data(), bytes.size());
+  if (mprotect(begin, size, PROT_READ | PROT_EXEC) != 0) {
+    throw std::runtime_error("failed to make JIT code executable");
+  }
+  buffer_used_ += (bytes.size() + 15) & ~(size_t)15;
+
+  Block &block = blocks_.emplace_back();
+  std::memcpy(&block.code, &dst, sizeof(dst));
+  block.cycles = cycles;
+  block.size   = lo - start;
+  if (!in_rom) {
+    block.page = page;
+    block.bytes.assign(page + start, page + lo);
+  } else {
+    block.page = nullptr;
+  }
+  stats_.blocks++;
+  return &block;
+}
+
+#else
+
+Jit::Jit(Cpu &cpu) : cpu_(cpu), buffer_(nullptr), buffer_used_(0) {
+  throw std::runtime_error("the JIT isn't supported on this platform");
+}
+
+Jit::~Jit() {}
+
+Jit::Block *Jit::compile(
+    [[maybe_unused]] uint16_t       pc,
+    [[maybe_unused]] const uint8_t *page,
+    [[maybe_unused]] bool           in_rom
+) {
+  return nullptr;
+}
+
+#endif
+
+void Jit::reset(int prg_rom_size) {
+  flush();
+  rom_blocks_.assign(prg_rom_size, nullptr);
+  stats_ = Cpu::JitStats();
+}
+
+void Jit::flush() {
+  blocks_.clear();
+  std::fill(rom_blocks_.begin(), rom_blocks_.end(), nullptr);
+  std::fill(ram_blocks_.begin(), ram_blocks_.end(), nullptr);
+  buffer_used_ = 0;
+  stats_.flushes++;
+}
+
+bool Jit::run(uint16_t &last_pc) {
+  uint16_t       pc     = cpu_.regs_.PC;
+  const uint8_t *page   = cpu_.peek_pages_[pc >> 8];
+  int            offset = cpu_.code_pages_[pc >> 8];
+  if (!page) {
+    return false;
+  }
+
+  Block *block;
+  if (offset >= 0) {
+    block = rom_blocks_[offset + (pc & 0xff)];
+    if (!block) {
+      block = compile(pc, page, true);
+      // N.B., compiling may have flushed the tables.
+      rom_blocks_[offset + (pc & 0xff)] = block;
+    }
+  } else {
+    block = ram_blocks_[pc];
+    if (block && (block->page != page ||
+                  !std::equal(
+                      block->bytes.begin(),
+                      block->bytes.end(),
+                      page + (pc & 0xff)
+                  ))) {
+      stats_.invalidated++;
+      block = nullptr;
+    }
+    if (!block) {
+      block = compile(pc, page, false);
+      ram_blocks_[pc] = block;
+    }
+  }
+
+  if (!block || cpu_.cycles_ + block->cycles >= cpu_.run_until_) {
+    return false;
+  }
+  // N.B., Cpu::run() has to see the head of the loop it's watching, if the
+  // block runs through it.
+  int head = cpu_.idle_loop_.head;
+  if (head >= 0 && head > pc && head - pc < block->size) {
+    return false;
+  }
+  last_pc = (uint16_t)((pc & 0xff00) | block->code(&cpu_));
+  stats_.runs++;
+  return true;
+}
+
+uint8_t Jit::peek(Cpu *cpu, uint16_t addr) { return cpu->peek(addr); }
+
+void Jit::poke_io(Cpu *cpu, uint16_t addr, uint8_t x) {
+  cpu->poke_io(addr, x);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "src/emu/cpu.h"
+
+// N.B., the generated code follows the System V calling convention.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define TEENYNES_JIT 1
+#else
+#define TEENYNES_JIT 0
+#endif
+
+// Translates runs of 6502 code into x86-64 for Cpu::run() (see Cpu::JIT).
+//
+// A block is straight-line code up to the next jump, or up to an instruction
+// that's left to the op handlers (e.g., BRK, CLI or illegal ops), and never
+// crosses a page. Branches leave the block only if taken. Blocks in PRG ROM
+// are cached by their offset into it, as in the threaded code cache, so every
+// bank keeps its blocks while it's switched out and a block can only be
+// reached through the page it was compiled from. Blocks anywhere else (RAM, or
+// the NSF player's idle page) are cached by address and checked against memory
+// before each run, so that they get recompiled when the code changes. A block
+// that writes to its own code stops right after the write.
+//
+// Blocks keep the registers, cycle count and side effect count exactly as the
+// interpreter would, and only run when they're sure to end before the
+// deadline. Any access that goes through Cpu::peek_io() or Cpu::poke_io() ends
+// the block after the instruction, since it can raise an interrupt, start OAM
+// DMA, switch banks or stop the batch.
+class Jit {
+public:
+  static constexpr bool SUPPORTED = TEENYNES_JIT;
+
+  explicit Jit(Cpu &cpu);
+  ~Jit();
+
+  Jit(const Jit &)            = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  // Drops every block, e.g., when a cart is loaded (see
+  // Cpu::reset_code_cache).
+  void reset(int prg_rom_size);
+
+  // Runs the block at PC and sets last_pc to where the last instruction it ran
+  // started. Returns false if there's no block that can run there (e.g., the
+  // code is in an I/O page, or the block might not finish before the
+  // deadline), in which case the caller should step instead.
+  bool run(uint16_t &last_pc);
+
+  const Cpu::JitStats &stats() const { return stats_; }
+
+private:
+  // Returns where the last instruction it ran starts in its page.
+  using Code = int (*)(Cpu *cpu);
+
+  struct Block {
+    Code    code;
+    int64_t cycles; // at most, before its last instruction starts
+    int     size;   // in bytes
+
+    // For blocks outside PRG ROM, the code they were compiled from.
+    const uint8_t       *page;
+    std::vector<uint8_t> bytes;
+  };
+
+  Block *compile(uint16_t pc, const uint8_t *page, bool in_rom);
+  void   flush();
+
+  static uint8_t peek(Cpu *cpu, uint16_t addr);
+  static void    poke_io(Cpu *cpu, uint16_t addr, uint8_t x);
+
+  Cpu                 &cpu_;
+  uint8_t             *buffer_; // executable memory for the generated code
+  size_t               buffer_used_;
+  std::deque<Block>    blocks_;
+  std::vector<Block *> rom_blocks_; // by PRG ROM offset
+  std::vector<Block *> ram_blocks_; // by address
+  Cpu::JitStats        stats_;
+};
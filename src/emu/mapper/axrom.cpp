@@ -1,10 +1,32 @@
 #include "src/emu/mapper/axrom.h"
+#include "src/emu/state.h"
 
 AxRom::AxRom(CartMemory &mem)
     : mem_(mem),
       bank_addr_(0),
       mirroring_(MIRROR_SCREEN_A_ONLY) {}
 
+void AxRom::power_on() {
+  map_prg(0x6000, 0x2000, mem_.prg_ram.get(), true);
+  update_prg_map();
+  map_chr(0x0000, 0x2000, mem_.chr_rom.get());
+  map_nt(mirroring_);
+}
+
+void AxRom::update_prg_map() {
+  map_prg(0x8000, 0x8000, mem_.prg_rom.get() + bank_addr_, false);
+}
+
+void AxRom::save_state(StateWriter &w) const {
+  w.write(bank_addr_, mirroring_);
+}
+
+void AxRom::load_state(StateReader &r) {
+  r.read(bank_addr_, mirroring_);
+  update_prg_map();
+  map_nt(mirroring_);
+}
+
 uint8_t AxRom::peek_cpu(uint16_t addr) {
   if (addr >= 0x8000) {
     return mem_.prg_rom[bank_addr_ + addr - 0x8000];
@@ -19,6 +41,8 @@ void AxRom::poke_cpu(uint16_t addr, uint8_t x) {
   if (addr >= 0x8000) {
     bank_addr_ = (x & 7) << 15;
     mirroring_ = x & 0x10 ? MIRROR_SCREEN_B_ONLY : MIRROR_SCREEN_A_ONLY;
+    update_prg_map();
+    map_nt(mirroring_);
   } else if (addr >= 0x6000) {
     mem_.prg_ram[addr - 0x6000] = x;
   } else {
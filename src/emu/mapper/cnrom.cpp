@@ -1,4 +1,7 @@
+#include <algorithm>
+
 #include "src/emu/mapper/cnrom.h"
+#include "src/emu/state.h"
 
 CnRom::CnRom(const CartHeader &header, CartMemory &mem)
     : mem_(mem),
@@ -10,6 +13,26 @@ CnRom::CnRom(const CartHeader &header, CartMemory &mem)
   }
 }
 
+void CnRom::power_on() {
+  map_prg(0x6000, 0x2000, mem_.prg_ram.get(), true);
+  map_prg(
+      0x8000, std::min(mem_.prg_rom_size, 0x8000), mem_.prg_rom.get(), false
+  );
+  update_chr_map();
+  map_nt(mirroring_);
+}
+
+void CnRom::update_chr_map() {
+  map_chr(0x0000, 0x2000, mem_.chr_rom.get() + bank_addr_);
+}
+
+void CnRom::save_state(StateWriter &w) const { w.write(bank_addr_); }
+
+void CnRom::load_state(StateReader &r) {
+  r.read(bank_addr_);
+  update_chr_map();
+}
+
 uint8_t CnRom::peek_cpu(uint16_t addr) {
   if (addr >= 0x8000) {
     return mem_.prg_rom[addr - 0x8000];
@@ -23,6 +46,7 @@ uint8_t CnRom::peek_cpu(uint16_t addr) {
 void CnRom::poke_cpu(uint16_t addr, uint8_t x) {
   if (addr >= 0x8000) {
     bank_addr_ = (x & 3) << 13;
+    update_chr_map();
   } else if (addr >= 0x6000) {
     mem_.prg_ram[addr - 0x6000] = x;
   } else {
@@ -1,6 +1,7 @@
 #include <cstring>
 #include <stdexcept>
 
+#include "src/emu/cart.h"
 #include "src/emu/mapper/mapper.h"
 
 static constexpr uint16_t MIRROR_HORZ_OFF_MASK = 0x3ff;
@@ -18,6 +19,27 @@ uint16_t Mapper::mirrored_nt_addr(Mirroring mirroring, uint16_t addr) {
   }
 }
 
+void Mapper::map_prg(uint16_t addr, int size, uint8_t *mem, bool writable) {
+  if (cart_) {
+    cart_->map_prg(addr, size, mem, writable);
+  }
+}
+
+void Mapper::map_chr(uint16_t addr, int size, uint8_t *mem) {
+  if (cart_) {
+    cart_->map_chr(addr, size, mem);
+  }
+}
+
+void Mapper::map_nt(Mirroring mirroring) {
+  if (cart_) {
+    for (int page = 0; page < 4; page++) {
+      uint16_t addr = (uint16_t)(0x2000 + (page << 10));
+      cart_->map_nt(page, mirrored_nt_addr(mirroring, addr));
+    }
+  }
+}
+
 static constexpr uint8_t HEADER_TAG[4] = {0x4e, 0x45, 0x53, 0x1a};
 
 // Flags 6
@@ -3,10 +3,14 @@
 #include <cassert>
 #include <cstdint>
 #include <filesystem>
+#include <limits>
 #include <memory>
 
+class Cart;
 class Cpu;
 class Ppu;
+class StateReader;
+class StateWriter;
 
 enum Mirroring {
   MIRROR_VERT,
@@ -104,6 +108,8 @@ class Mapper {
 public:
   virtual ~Mapper() = default;
 
+  void set_cart(Cart *cart) { cart_ = cart; }
+
   virtual void power_on() {}
   virtual void reset() {}
 
@@ -116,6 +122,31 @@ public:
   virtual bool step_ppu_enabled() { return false; }
   virtual void step_ppu() {}
 
+  // Saves and restores the mapper's registers (see Nes::save_state). Loading
+  // must also redo any mappings that depend on them.
+  virtual void save_state([[maybe_unused]] StateWriter &w) const {}
+  virtual void load_state([[maybe_unused]] StateReader &r) {}
+
+  // Lower bound on the number of PPU cycles before the mapper can signal an
+  // IRQ (used by the scheduler, see Nes::run_until).
+  virtual int64_t ppu_cycles_until_irq() {
+    return std::numeric_limits<int64_t>::max();
+  }
+
 protected:
   static uint16_t mirrored_nt_addr(Mirroring mirroring, uint16_t addr);
+
+  // Maps [addr, addr + size) of the CPU address space directly onto mem (see
+  // Cpu::map_page). Mappers must call this again whenever a bank switch
+  // changes what backs the range.
+  void map_prg(uint16_t addr, int size, uint8_t *mem, bool writable);
+
+  // Likewise maps [addr, addr + size) of the pattern tables directly onto mem,
+  // and the nametables according to mirroring (see Ppu::map_chr). Mappers
+  // must call these again on bank switches and mirroring changes.
+  void map_chr(uint16_t addr, int size, uint8_t *mem);
+  void map_nt(Mirroring mirroring);
+
+private:
+  Cart *cart_ = nullptr;
 };
@@ -1,6 +1,7 @@
 #include <cstring>
 
 #include "src/emu/mapper/mmc1.h"
+#include "src/emu/state.h"
 
 static constexpr uint8_t SHIFT_REG_RESET_FLAG  = 0b10000000;
 static constexpr uint8_t SHIFT_REG_RESET_VAL   = 0b00010000;
@@ -20,6 +21,44 @@ void Mmc1::reset() {
   std::memset(&regs_, 0, sizeof(regs_));
   regs_.shift   = SHIFT_REG_RESET_VAL;
   regs_.control = CONTROL_REG_RESET_VAL;
+  map_prg(PRG_RAM_START, 0x2000, mem_.prg_ram.get(), true);
+  update_prg_map();
+  update_ppu_map();
+}
+
+void Mmc1::save_state(StateWriter &w) const { w.write(regs_); }
+
+void Mmc1::load_state(StateReader &r) {
+  r.read(regs_);
+  update_prg_map();
+  update_ppu_map();
+}
+
+void Mmc1::update_prg_map() {
+  uint8_t *prg_rom = mem_.prg_rom.get();
+  map_prg(
+      PRG_BANK_0_START,
+      0x4000,
+      prg_rom + map_prg_rom_addr(PRG_BANK_0_START),
+      false
+  );
+  map_prg(
+      PRG_BANK_1_START,
+      0x4000,
+      prg_rom + map_prg_rom_addr(PRG_BANK_1_START),
+      false
+  );
+}
+
+void Mmc1::update_ppu_map() {
+  uint8_t *chr_rom = mem_.chr_rom.get();
+  map_chr(
+      CHR_BANK_0_START, 0x1000, chr_rom + map_chr_rom_addr(CHR_BANK_0_START)
+  );
+  map_chr(
+      CHR_BANK_1_START, 0x1000, chr_rom + map_chr_rom_addr(CHR_BANK_1_START)
+  );
+  map_nt(mirroring());
 }
 
 uint8_t Mmc1::peek_cpu(uint16_t addr) {
@@ -69,6 +108,8 @@ void Mmc1::write_shift_reg(uint16_t addr, uint8_t x) {
   if (x & SHIFT_REG_RESET_FLAG) {
     regs_.shift = SHIFT_REG_RESET_VAL;
     regs_.control |= CONTROL_REG_RESET_VAL;
+    update_prg_map();
+    update_ppu_map();
     return;
   } else {
     bool full   = regs_.shift & 1;
@@ -81,6 +122,8 @@ void Mmc1::write_shift_reg(uint16_t addr, uint8_t x) {
       default: regs_.prg_bank = regs_.shift; break;
       }
       regs_.shift = SHIFT_REG_RESET_VAL;
+      update_prg_map();
+      update_ppu_map();
     }
   }
 }
@@ -8,6 +8,8 @@ public:
 
   void power_on() override;
   void reset() override;
+  void save_state(StateWriter &w) const override;
+  void load_state(StateReader &r) override;
 
   uint8_t peek_cpu(uint16_t addr) override;
   void    poke_cpu(uint16_t addr, uint8_t x) override;
@@ -24,6 +26,8 @@ private:
   };
 
   void write_shift_reg(uint16_t addr, uint8_t x);
+  void update_prg_map();
+  void update_ppu_map();
 
   int prg_rom_banks() const;
 
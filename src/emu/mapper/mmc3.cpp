@@ -3,6 +3,7 @@
 #include "src/emu/cpu.h"
 #include "src/emu/mapper/mmc3.h"
 #include "src/emu/ppu.h"
+#include "src/emu/state.h"
 
 Mmc3::Mmc3(const CartHeader &header, CartMemory &mem, Cpu &cpu, Ppu &ppu)
     : mem_(mem),
@@ -21,6 +22,35 @@ void Mmc3::reset() {
   std::memset(&regs_, 0, sizeof(regs_));
   std::memset(&irq_, 0, sizeof(irq_));
   mirroring_ = orig_mirroring_;
+  map_prg(0x6000, 0x2000, mem_.prg_ram.get(), true);
+  update_prg_map();
+  update_chr_map();
+  map_nt(mirroring_);
+}
+
+void Mmc3::save_state(StateWriter &w) const {
+  w.write(regs_, irq_, mirroring_);
+}
+
+void Mmc3::load_state(StateReader &r) {
+  r.read(regs_, irq_, mirroring_);
+  update_prg_map();
+  update_chr_map();
+  map_nt(mirroring_);
+}
+
+void Mmc3::update_prg_map() {
+  for (int region = 0; region < 4; region++) {
+    uint16_t addr = (uint16_t)(0x8000 + (region << 13));
+    map_prg(addr, 0x2000, mem_.prg_rom.get() + map_prg_rom_addr(addr), false);
+  }
+}
+
+void Mmc3::update_chr_map() {
+  for (int region = 0; region < 8; region++) {
+    uint16_t addr = (uint16_t)(region << 10);
+    map_chr(addr, 0x400, mem_.chr_rom.get() + map_chr_rom_addr(addr));
+  }
 }
 
 int Mmc3::prg_rom_banks() const { return mem_.prg_rom_size >> 13; }
@@ -54,6 +84,8 @@ void Mmc3::poke_cpu(uint16_t addr, uint8_t x) {
     } else {
       write_bank_data(x);
     }
+    update_prg_map();
+    update_chr_map();
     break;
   case 1: // 0xa000..0xbfff
     if (even) {
@@ -86,6 +118,7 @@ void Mmc3::write_mirroring(uint8_t x) {
   } else {
     mirroring_ = MIRROR_VERT;
   }
+  map_nt(mirroring_);
 }
 
 void Mmc3::write_bank_data(uint8_t x) {
@@ -199,6 +232,21 @@ void Mmc3::step_ppu() {
   irq_.prev_a12 = curr_a12;
 }
 
+int64_t Mmc3::ppu_cycles_until_irq() {
+  if (!irq_.enabled) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  // Count the clocks needed for the counter to hit zero. Consecutive clocks are
+  // at least 3 CPU cycles apart (see step_ppu).
+  int clocks;
+  if (irq_.counter == 0 || irq_.reload) {
+    clocks = irq_.latch + 1;
+  } else {
+    clocks = irq_.counter;
+  }
+  return (clocks - 1) * cpu_to_ppu_cycles(3);
+}
+
 void Mmc3::clock_IRQ_counter() {
   if (irq_.counter == 0 || irq_.reload) {
     irq_.counter = irq_.latch;
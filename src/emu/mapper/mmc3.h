@@ -8,14 +8,17 @@ public:
 
   void power_on() override;
   void reset() override;
+  void save_state(StateWriter &w) const override;
+  void load_state(StateReader &r) override;
 
   uint8_t peek_cpu(uint16_t addr) override;
   void    poke_cpu(uint16_t addr, uint8_t x) override;
   PeekPpu peek_ppu(uint16_t addr) override;
   PokePpu poke_ppu(uint16_t addr, uint8_t x) override;
 
-  void step_ppu() override;
-  bool step_ppu_enabled() override { return true; }
+  void    step_ppu() override;
+  bool    step_ppu_enabled() override { return true; }
+  int64_t ppu_cycles_until_irq() override;
 
 private:
   struct Registers {
@@ -34,6 +37,8 @@ private:
 
   void write_bank_data(uint8_t x);
   void write_mirroring(uint8_t x);
+  void update_prg_map();
+  void update_chr_map();
 
   int prg_rom_banks() const;
   int chr_rom_banks() const;
@@ -26,6 +26,18 @@ NRom::NRom(const CartHeader &header, CartMemory &mem)
   }
 }
 
+void NRom::power_on() {
+  map_prg(0x6000, 0x2000, mem_.prg_ram.get(), true);
+  if (prg_rom_mask_ == PRG_ROM_MASK_128) {
+    map_prg(0x8000, 0x4000, mem_.prg_rom.get(), false);
+    map_prg(0xc000, 0x4000, mem_.prg_rom.get(), false);
+  } else {
+    map_prg(0x8000, 0x8000, mem_.prg_rom.get(), false);
+  }
+  map_chr(0x0000, 0x2000, mem_.chr_rom.get());
+  map_nt(mirroring_);
+}
+
 uint8_t NRom::peek_cpu(uint16_t addr) {
   if (addr >= 0x8000) {
     return mem_.prg_rom[addr & prg_rom_mask_];
@@ -6,6 +6,8 @@ class NRom : public Mapper {
 public:
   NRom(const CartHeader &header, CartMemory &mem);
 
+  void power_on() override;
+
   uint8_t peek_cpu(uint16_t addr) override;
   void    poke_cpu(uint16_t addr, uint8_t x) override;
   PeekPpu peek_ppu(uint16_t addr) override;
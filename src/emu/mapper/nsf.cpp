@@ -0,0 +1,197 @@
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#include "src/emu/mapper/nsf.h"
+#include "src/emu/state.h"
+
+static constexpr uint8_t HEADER_TAG[5] = {0x4e, 0x45, 0x53, 0x4d, 0x1a};
+
+static constexpr int OFFSET_SONGS          = 0x06;
+static constexpr int OFFSET_START_SONG     = 0x07;
+static constexpr int OFFSET_LOAD_ADDR      = 0x08;
+static constexpr int OFFSET_INIT_ADDR      = 0x0a;
+static constexpr int OFFSET_PLAY_ADDR      = 0x0c;
+static constexpr int OFFSET_TITLE          = 0x0e;
+static constexpr int OFFSET_ARTIST         = 0x2e;
+static constexpr int OFFSET_COPYRIGHT      = 0x4e;
+static constexpr int OFFSET_PLAY_PERIOD_US = 0x6e;
+static constexpr int OFFSET_BANKS          = 0x70;
+static constexpr int OFFSET_SOUND_CHIPS    = 0x7b;
+
+static constexpr int STRING_SIZE = 32;
+
+// N.B., some rippers leave the play period unset, in which case the tune is
+// meant to be played once per (NTSC) frame.
+static constexpr int DEFAULT_PLAY_PERIOD_US = 16639;
+
+NsfHeader::NsfHeader(uint8_t bytes[SIZE]) {
+  for (size_t i = 0; i < sizeof(HEADER_TAG); i++) {
+    if (bytes[i] != HEADER_TAG[i]) {
+      throw std::runtime_error("unsupported NSF format: unknown header type");
+    }
+  }
+
+  std::memcpy(bytes_, bytes, sizeof(bytes_));
+
+  if (songs() == 0) {
+    throw std::runtime_error("unsupported NSF format: no songs");
+  }
+  if (bytes_[OFFSET_SOUND_CHIPS] != 0) {
+    throw std::runtime_error(
+        std::format(
+            "unsupported NSF format: expansion audio {:#04x}",
+            bytes_[OFFSET_SOUND_CHIPS]
+        )
+    );
+  }
+  if (load_addr() < 0x8000) {
+    throw std::runtime_error(
+        std::format("unsupported NSF format: load address {:#06x}", load_addr())
+    );
+  }
+}
+
+int NsfHeader::songs() const { return bytes_[OFFSET_SONGS]; }
+
+int NsfHeader::start_song() const {
+  int song = bytes_[OFFSET_START_SONG] - 1;
+  return song >= 0 && song < songs() ? song : 0;
+}
+
+uint16_t NsfHeader::load_addr() const { return read16(OFFSET_LOAD_ADDR); }
+uint16_t NsfHeader::init_addr() const { return read16(OFFSET_INIT_ADDR); }
+uint16_t NsfHeader::play_addr() const { return read16(OFFSET_PLAY_ADDR); }
+
+int NsfHeader::play_period_us() const {
+  int period = read16(OFFSET_PLAY_PERIOD_US);
+  return period > 0 ? period : DEFAULT_PLAY_PERIOD_US;
+}
+
+bool NsfHeader::bankswitched() const {
+  for (int i = 0; i < 8; i++) {
+    if (initial_bank(i) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t NsfHeader::initial_bank(int index) const {
+  assert(index >= 0 && index < 8);
+  return bytes_[OFFSET_BANKS + index];
+}
+
+std::string_view NsfHeader::title() const { return read_string(OFFSET_TITLE); }
+
+std::string_view NsfHeader::artist() const {
+  return read_string(OFFSET_ARTIST);
+}
+
+std::string_view NsfHeader::copyright() const {
+  return read_string(OFFSET_COPYRIGHT);
+}
+
+uint16_t NsfHeader::read16(int offset) const {
+  return (uint16_t)(bytes_[offset] | (bytes_[offset + 1] << 8));
+}
+
+std::string_view NsfHeader::read_string(int offset) const {
+  // N.B., strings that fill the whole field aren't null terminated.
+  std::string_view str((const char *)&bytes_[offset], STRING_SIZE);
+  return str.substr(0, str.find('\0'));
+}
+
+static constexpr int      BANK_SIZE       = 0x1000;
+static constexpr uint16_t BANK_REGS_START = 0x5ff8;
+static constexpr uint16_t PRG_RAM_START   = 0x6000;
+static constexpr uint16_t PRG_ROM_START   = 0x8000;
+
+Nsf::Nsf(const NsfHeader &header, CartMemory &mem)
+    : mem_(mem),
+      total_banks_(mem.prg_rom_size / BANK_SIZE) {
+  assert(total_banks_ > 0);
+  assert(mem.prg_ram_size == PRG_ROM_START - PRG_RAM_START);
+
+  // N.B., data that isn't bankswitched gets laid out from $8000 (see
+  // Cart::load_nsf), which is the same as banks 0-7 in order.
+  for (int i = 0; i < 8; i++) {
+    initial_banks_[i] = header.bankswitched() ? header.initial_bank(i)
+                                              : (uint8_t)i;
+  }
+
+  // JMP IDLE_ADDR, which the CPU fast-forwards (see Cpu::run).
+  std::memset(idle_page_, 0, sizeof(idle_page_));
+  idle_page_[0] = 0x4c;
+  idle_page_[1] = (uint8_t)IDLE_ADDR;
+  idle_page_[2] = (uint8_t)(IDLE_ADDR >> 8);
+  static_assert(IDLE_END - IDLE_ADDR == 3);
+}
+
+void Nsf::power_on() {
+  map_prg(IDLE_ADDR, 0x100, idle_page_, false);
+  map_prg(PRG_RAM_START, mem_.prg_ram_size, mem_.prg_ram.get(), true);
+  reset();
+}
+
+void Nsf::reset() {
+  for (int i = 0; i < 8; i++) {
+    banks_[i] = (uint8_t)(initial_banks_[i] % total_banks_);
+  }
+  std::memset(mem_.prg_ram.get(), 0, mem_.prg_ram_size);
+  update_prg_map();
+}
+
+void Nsf::save_state(StateWriter &w) const { w.write(banks_); }
+
+void Nsf::load_state(StateReader &r) {
+  r.read(banks_);
+  update_prg_map();
+}
+
+void Nsf::update_prg_map() {
+  for (int i = 0; i < 8; i++) {
+    uint8_t *bank = mem_.prg_rom.get() + banks_[i] * BANK_SIZE;
+    map_prg((uint16_t)(PRG_ROM_START + i * BANK_SIZE), BANK_SIZE, bank, false);
+  }
+}
+
+int Nsf::map_prg_rom_addr(uint16_t addr) const {
+  int offset = addr - PRG_ROM_START;
+  return banks_[offset / BANK_SIZE] * BANK_SIZE + offset % BANK_SIZE;
+}
+
+uint8_t Nsf::peek_cpu(uint16_t addr) {
+  if (addr >= PRG_ROM_START) {
+    return mem_.prg_rom[map_prg_rom_addr(addr)];
+  } else if (addr >= PRG_RAM_START) {
+    return mem_.prg_ram[addr - PRG_RAM_START];
+  } else if (addr >= IDLE_ADDR && addr < IDLE_ADDR + 0x100) {
+    return idle_page_[addr - IDLE_ADDR];
+  } else {
+    return 0;
+  }
+}
+
+void Nsf::poke_cpu(uint16_t addr, uint8_t x) {
+  if (addr >= PRG_ROM_START) {
+    // no-op
+  } else if (addr >= PRG_RAM_START) {
+    mem_.prg_ram[addr - PRG_RAM_START] = x;
+  } else if (addr >= BANK_REGS_START) {
+    banks_[addr - BANK_REGS_START] = (uint8_t)(x % total_banks_);
+    update_prg_map();
+  } else {
+    // no-op
+  }
+}
+
+PeekPpu Nsf::peek_ppu([[maybe_unused]] uint16_t addr) {
+  return PeekPpu::make_value(0); // unused
+}
+
+PokePpu Nsf::poke_ppu(
+    [[maybe_unused]] uint16_t addr, [[maybe_unused]] uint8_t x
+) {
+  return PokePpu::make_success(); // no-op
+}
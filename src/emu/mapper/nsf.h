@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string_view>
+
+#include "src/emu/mapper/mapper.h"
+
+// Reference: https://www.nesdev.org/wiki/NSF
+class NsfHeader {
+public:
+  static constexpr int SIZE = 128;
+
+  NsfHeader(uint8_t bytes[SIZE]);
+
+  int      songs() const;
+  int      start_song() const; // numbered from 0
+  uint16_t load_addr() const;
+  uint16_t init_addr() const;
+  uint16_t play_addr() const;
+  int      play_period_us() const;
+  bool     bankswitched() const;
+  uint8_t  initial_bank(int index) const;
+
+  std::string_view title() const;
+  std::string_view artist() const;
+  std::string_view copyright() const;
+
+private:
+  uint16_t         read16(int offset) const;
+  std::string_view read_string(int offset) const;
+
+  uint8_t bytes_[SIZE];
+};
+
+// Maps NSF data into the CPU address space: 4K banks at $8000-$FFFF switched
+// by writes to $5FF8-$5FFF, and PRG RAM at $6000-$7FFF. Also provides a tiny
+// idle loop at IDLE_ADDR for INIT and PLAY to return to (see Nes::load_nsf).
+class Nsf : public Mapper {
+public:
+  static constexpr uint16_t IDLE_ADDR = 0x4100;
+  static constexpr uint16_t IDLE_END  = 0x4103;
+
+  Nsf(const NsfHeader &header, CartMemory &mem);
+
+  void power_on() override;
+  void reset() override;
+  void save_state(StateWriter &w) const override;
+  void load_state(StateReader &r) override;
+
+  uint8_t peek_cpu(uint16_t addr) override;
+  void    poke_cpu(uint16_t addr, uint8_t x) override;
+  PeekPpu peek_ppu(uint16_t addr) override;
+  PokePpu poke_ppu(uint16_t addr, uint8_t x) override;
+
+private:
+  void update_prg_map();
+  int  map_prg_rom_addr(uint16_t addr) const;
+
+  CartMemory &mem_;
+  int         total_banks_;
+  uint8_t     initial_banks_[8];
+  uint8_t     banks_[8];
+  uint8_t     idle_page_[256];
+};
@@ -4,6 +4,7 @@
 #include <stdexcept>
 
 #include "src/emu/mapper/uxrom.h"
+#include "src/emu/state.h"
 
 UxRom::UxRom(const CartHeader &header, CartMemory &mem)
     : mem_(mem),
@@ -20,6 +21,26 @@ static int prg_rom_addr(int bank_index, uint16_t offset) {
   return bank_index * 16 * 1024 + offset;
 }
 
+void UxRom::power_on() {
+  update_prg_map();
+  map_chr(0x0000, 0x2000, mem_.chr_rom.get());
+  map_nt(mirroring_);
+}
+
+void UxRom::update_prg_map() {
+  uint8_t *bank_0 = mem_.prg_rom.get() + prg_rom_addr(curr_bank_, 0);
+  uint8_t *bank_1 = mem_.prg_rom.get() + prg_rom_addr(total_banks_ - 1, 0);
+  map_prg(CPU_BANK_0_START, 0x4000, bank_0, false);
+  map_prg(CPU_BANK_1_START, 0x4000, bank_1, false);
+}
+
+void UxRom::save_state(StateWriter &w) const { w.write(curr_bank_); }
+
+void UxRom::load_state(StateReader &r) {
+  r.read(curr_bank_);
+  update_prg_map();
+}
+
 uint8_t UxRom::peek_cpu(uint16_t addr) {
   if (addr >= CPU_BANK_1_START) {
     int mapped_addr = prg_rom_addr(total_banks_ - 1, addr - CPU_BANK_1_START);
@@ -35,6 +56,7 @@ uint8_t UxRom::peek_cpu(uint16_t addr) {
 void UxRom::poke_cpu(uint16_t addr, uint8_t x) {
   if (addr >= CPU_BANK_0_START) {
     curr_bank_ = x % total_banks_;
+    update_prg_map();
   } else {
     // no-op
   }
@@ -6,12 +6,18 @@ class UxRom : public Mapper {
 public:
   UxRom(const CartHeader &header, CartMemory &mem);
 
+  void power_on() override;
+  void save_state(StateWriter &w) const override;
+  void load_state(StateReader &r) override;
+
   uint8_t peek_cpu(uint16_t addr) override;
   void    poke_cpu(uint16_t addr, uint8_t x) override;
   PeekPpu peek_ppu(uint16_t addr) override;
   PokePpu poke_ppu(uint16_t addr, uint8_t x) override;
 
 private:
+  void update_prg_map();
+
   CartMemory &mem_;
   Mirroring   mirroring_;
   int         curr_bank_;
@@ -1,8 +1,49 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <format>
 #include <fstream>
+#include <limits>
 
 #include "src/emu/nes.h"
+#include "src/emu/state.h"
 
-Nes::Nes() : powered_on_(false) {
+static constexpr int64_t NEVER  = std::numeric_limits<int64_t>::max();
+static constexpr int64_t CPU_HZ = 1789773;
+
+// Batch size for run_frames, about 9 scanlines. Vertical blank lasts 20.
+static constexpr int64_t RUN_FRAMES_BATCH = 1000;
+
+static constexpr bool is_apu_register(uint16_t addr) {
+  // N.B., $4014 is OAMDMA and $4016 the controllers. $4017 is shared between
+  // the second controller (reads) and the frame counter (writes).
+  return addr >= 0x4000 && addr <= 0x4017 && addr != 0x4014 && addr != 0x4016;
+}
+
+static constexpr uint32_t STATE_MAGIC   = 0x53454e54; // "TNES"
+static constexpr uint32_t STATE_VERSION = 1;
+
+struct StateHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;
+  uint64_t rom_hash;
+};
+
+Nes::Nes()
+    : powered_on_(false),
+      catching_up_(false),
+      target_(0),
+      frames_(0),
+      idle_cycles_(0),
+      idle_cycles_per_frame_(0),
+      apu_event_(NEVER),
+      apu_event_stale_(true),
+      song_(0),
+      play_start_(0),
+      plays_(0),
+      next_play_(NEVER) {
+  cpu_.set_sync([this](uint16_t addr) { sync(addr); });
   cpu_.set_apu(&apu_);
   cpu_.set_ppu(&ppu_);
   cpu_.set_input(&input_);
@@ -27,7 +68,11 @@ void Nes::power_on() {
   ppu_.power_on();
   apu_.power_on();
   input_.power_on();
-  powered_on_ = true;
+  powered_on_      = true;
+  apu_event_stale_ = true;
+  if (nsf_) {
+    start_song();
+  }
 }
 
 void Nes::power_off() {
@@ -44,10 +89,19 @@ void Nes::reset() {
   }
 
   cart_.reset();
-  cpu_.reset();
+  if (nsf_) {
+    // N.B., NSF files have no reset vector, the song just starts over.
+    cpu_.power_on();
+  } else {
+    cpu_.reset();
+  }
   ppu_.reset();
   apu_.reset();
   input_.power_on();
+  apu_event_stale_ = true;
+  if (nsf_) {
+    start_song();
+  }
 }
 
 void Nes::load_cart(const std::filesystem::path &path) {
@@ -55,17 +109,247 @@ void Nes::load_cart(const std::filesystem::path &path) {
     throw std::runtime_error("cannot load cart when system is powered up");
   }
 
+  nsf_.reset();
   cart_.load_cart(path);
 }
 
+void Nes::load_nsf(const std::filesystem::path &path) {
+  if (powered_on_) {
+    throw std::runtime_error("cannot load NSF when system is powered up");
+  }
+
+  nsf_.reset();
+  nsf_  = cart_.load_nsf(path);
+  song_ = nsf_->start_song();
+}
+
+void Nes::save_state(std::vector<uint8_t> &state) {
+  if (!powered_on_) {
+    throw std::runtime_error("system hasn't been powered up yet");
+  }
+
+  // N.B., the PPU and APU normally lag behind the CPU.
+  catch_up(true);
+
+  state.clear();
+  StateWriter w(state);
+  w.write(StateHeader{
+      .magic    = STATE_MAGIC,
+      .version  = STATE_VERSION,
+      .size     = 0,
+      .rom_hash = cart_.rom_hash(),
+  });
+  cpu_.save_state(w);
+  ppu_.save_state(w);
+  apu_.save_state(w);
+  input_.save_state(w);
+  cart_.save_state(w);
+  w.write(frames_, idle_cycles_, idle_cycles_per_frame_);
+  w.write(song_, play_start_, plays_, next_play_);
+
+  uint64_t size = state.size();
+  std::memcpy(state.data() + offsetof(StateHeader, size), &size, sizeof(size));
+}
+
+void Nes::load_state(std::span<const uint8_t> state) {
+  if (!powered_on_) {
+    throw std::runtime_error("system hasn't been powered up yet");
+  }
+
+  StateHeader header;
+  StateReader r(state);
+  r.read(header);
+  if (header.magic != STATE_MAGIC) {
+    throw std::runtime_error("not a save state");
+  }
+  if (header.version != STATE_VERSION) {
+    throw std::runtime_error(
+        std::format("unsupported save state version: {}", header.version)
+    );
+  }
+  if (header.size != state.size()) {
+    throw std::runtime_error("truncated save state");
+  }
+  if (header.rom_hash != cart_.rom_hash()) {
+    throw std::runtime_error("save state is for a different cart");
+  }
+
+  cpu_.load_state(r);
+  ppu_.load_state(r);
+  apu_.load_state(r);
+  input_.load_state(r);
+  cart_.load_state(r);
+  r.read(frames_, idle_cycles_, idle_cycles_per_frame_);
+  r.read(song_, play_start_, plays_, next_play_);
+  apu_event_stale_ = true;
+}
+
+void Nes::select_song(int song) {
+  if (!nsf_) {
+    throw std::runtime_error("no NSF loaded");
+  }
+  if (song < 0 || song >= nsf_->songs()) {
+    throw std::runtime_error(std::format("invalid song: {}", song));
+  }
+
+  song_ = song;
+  if (powered_on_) {
+    reset();
+  }
+}
+
 void Nes::step() {
+  if (nsf_) {
+    update_nsf_player();
+  }
   cpu_.step();
-  int ppu_catchup = (int)(cpu_to_ppu_cycles(cpu_.cycles()) - ppu_.cycles());
-  for (int i = 0; i < ppu_catchup; i++) {
-    ppu_.step();
+  catch_up(false);
+}
+
+void Nes::run_until(int64_t cpu_cycles) {
+  target_ = cpu_cycles;
+  while (cpu_.cycles() < target_) {
+    catch_up(false);
+    update_idle_cycles();
+    if (nsf_) {
+      update_nsf_player();
+    }
+    cpu_.run(std::min(target_, next_event()));
+  }
+  catch_up(false);
+  update_idle_cycles();
+}
+
+void Nes::run_frames(int frames) {
+  if (nsf_) {
+    throw std::runtime_error("NSF files have no frames to run");
+  }
+
+  int64_t end = ppu_.frames() + frames;
+  while (ppu_.frames() < end) {
+    run_until(cpu_.cycles() + RUN_FRAMES_BATCH);
+  }
+}
+
+ApuBuffer &Nes::audio() {
+  apu_.run_until(cpu_.cycles());
+  apu_event_stale_ = true;
+  return apu_.output();
+}
+
+void Nes::sync(uint16_t addr) {
+  // N.B., the CPU syncs before the access takes effect, and a write may well
+  // change when the next interrupt is due (e.g., enabling NMIs). End the batch
+  // after the current instruction so that the deadline gets recomputed. The
+  // APU only needs catching up if it's the one being accessed, otherwise
+  // next_apu_event() has it covered (e.g., in PPUSTATUS polling loops). The
+  // exception is the mapper while a DMC sample plays, since switching banks
+  // changes what the DMC fetches.
+  bool apu = is_apu_register(addr);
+  catch_up(apu || (addr >= Cart::CPU_ADDR_START && apu_.dmc_active()));
+  if (apu) {
+    apu_event_stale_ = true;
+  }
+  cpu_.stop();
+}
+
+void Nes::catch_up(bool apu) {
+  // N.B., DMC fetches go through the CPU and may request a sync themselves.
+  if (catching_up_) {
+    return;
+  }
+  catching_up_ = true;
+  if (!nsf_) {
+    ppu_.run_until(cpu_to_ppu_cycles(cpu_.cycles()));
+  }
+  if (apu || cpu_.cycles() >= next_apu_event()) {
+    apu_.run_until(cpu_.cycles());
+    apu_event_stale_ = true;
+  }
+  catching_up_ = false;
+}
+
+void Nes::update_idle_cycles() {
+  if (ppu_.frames() != frames_) {
+    idle_cycles_per_frame_ = cpu_.idle_cycles() - idle_cycles_;
+    idle_cycles_           = cpu_.idle_cycles();
+    frames_                = ppu_.frames();
+  }
+}
+
+int64_t Nes::next_event() {
+  // Returns the earliest CPU cycle at which an interrupt might be signaled.
+  // The CPU only checks for interrupts between instructions, so catching up at
+  // the first instruction boundary past this point is just as accurate as
+  // catching up after every instruction.
+  int64_t event = NEVER;
+
+  if (nsf_) {
+    event = next_play_;
+  } else {
+    int64_t ppu_cycles =
+        std::min(ppu_.cycles_until_nmi(), cart_.ppu_cycles_until_irq());
+    if (ppu_cycles != NEVER) {
+      event = (ppu_.cycles() + ppu_cycles) / 3 + 1;
+    }
   }
-  int apu_catchup = (int)(cpu_.cycles() - apu_.cycles());
-  for (int i = 0; i < apu_catchup; i++) {
-    apu_.step();
+
+  return std::min(event, next_apu_event());
+}
+
+int64_t Nes::next_apu_event() {
+  // Returns the earliest CPU cycle at which the APU might signal an interrupt.
+  // Until then it's only caught up when the CPU accesses it, or on demand.
+  if (apu_event_stale_) {
+    int64_t cycles   = apu_.cycles_until_irq();
+    apu_event_       = cycles == NEVER ? NEVER : apu_.cycles() + cycles + 1;
+    apu_event_stale_ = false;
   }
+  return apu_event_;
+}
+
+void Nes::start_song() {
+  // Reference: https://www.nesdev.org/wiki/NSF#Initializing_a_tune
+  for (uint16_t addr = 0x4000; addr <= 0x4013; addr++) {
+    cpu_.poke(addr, 0);
+  }
+  cpu_.poke(0x4015, 0x00);
+  cpu_.poke(0x4015, 0x0f);
+  cpu_.poke(0x4017, 0x40);
+
+  auto &regs = cpu_.registers();
+  regs.A     = (uint8_t)song_;
+  regs.X     = 0; // NTSC
+  call_nsf_routine(nsf_->init_addr());
+
+  // N.B., the first PLAY is due right away, but gets dropped since INIT is
+  // still running.
+  play_start_ = cpu_.cycles();
+  plays_      = 0;
+  next_play_  = play_start_;
+}
+
+void Nes::update_nsf_player() {
+  if (cpu_.cycles() < next_play_) {
+    return;
+  }
+
+  // N.B., if the last call hasn't returned yet (e.g., INIT may take several
+  // frames), then this PLAY is dropped.
+  uint16_t pc = cpu_.registers().PC;
+  if (pc >= Nsf::IDLE_ADDR && pc < Nsf::IDLE_END) {
+    call_nsf_routine(nsf_->play_addr());
+  }
+
+  int64_t period = nsf_->play_period_us() * CPU_HZ;
+  while (next_play_ <= cpu_.cycles()) {
+    plays_++;
+    next_play_ = play_start_ + plays_ * period / 1000000;
+  }
+}
+
+void Nes::call_nsf_routine(uint16_t addr) {
+  // N.B., RTS returns to the address pushed plus one.
+  cpu_.push16(Nsf::IDLE_ADDR - 1);
+  cpu_.registers().PC = addr;
 }
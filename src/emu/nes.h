@@ -1,6 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
 
 #include "src/emu/apu.h"
 #include "src/emu/cart.h"
@@ -8,6 +12,9 @@
 #include "src/emu/input.h"
 #include "src/emu/ppu.h"
 
+// CPU cycles in a frame, rounded up (341 x 262 PPU dots, 3 per CPU cycle).
+inline constexpr int64_t CPU_CYCLES_PER_FRAME = 29781;
+
 class Nes {
 public:
   Nes();
@@ -24,13 +31,83 @@ public:
   void step();
   bool is_powered_on() const { return powered_on_; }
 
+  // Runs until the CPU has executed at least the given number of cycles. Unlike
+  // step(), the PPU and APU are only caught up when the CPU accesses them or
+  // when they may signal an interrupt, so they run in large batches.
+  void run_until(int64_t cpu_cycles);
+
+  // Runs until the PPU has finished the given number of frames (see
+  // Ppu::frames). N.B., this may overshoot the end of the last frame by a few
+  // scanlines, but never into the drawing of the next one.
+  void run_frames(int frames);
+
+  // Catches the APU up to the CPU and returns the audio produced so far. N.B.,
+  // the APU otherwise only runs when the CPU accesses it or when it may signal
+  // an interrupt.
+  ApuBuffer &audio();
+
+  // Number of CPU cycles skipped through idle loops during the last frame (see
+  // Cpu::run).
+  int64_t idle_cycles_per_frame() const { return idle_cycles_per_frame_; }
+
+  // Saves the state of the whole system into the given buffer, replacing its
+  // contents. States are plain snapshots of every component's registers and
+  // memory, and are only valid for the same cart and build of the emulator.
+  // N.B., reusing the buffer avoids allocating on every save, which matters
+  // when saving every frame (e.g., for rewind).
+  void save_state(std::vector<uint8_t> &state);
+
+  // Restores a state made by save_state. The state is checked against the
+  // loaded cart before anything is touched, so a bad state leaves the system
+  // as it was.
+  void load_state(std::span<const uint8_t> state);
+
   void load_cart(const std::filesystem::path &path);
 
+  // Loads an NSF file in place of a cart. The NES then acts as a music player:
+  // INIT gets called for the selected song on power on or reset, and PLAY at
+  // the rate given by the file. Only the CPU and APU are emulated, the PPU is
+  // never stepped.
+  void             load_nsf(const std::filesystem::path &path);
+  const NsfHeader *nsf() const { return nsf_ ? &*nsf_ : nullptr; }
+
+  // Selects the NSF song to play (numbered from 0), restarting the player if
+  // it's already powered up.
+  void select_song(int song);
+  int  song() const { return song_; }
+
 private:
-  Cpu   cpu_;
-  Ppu   ppu_;
-  Apu   apu_;
-  Input input_;
-  Cart  cart_;
-  bool  powered_on_;
+  void    sync(uint16_t addr);
+  void    catch_up(bool apu);
+  int64_t next_event();
+  int64_t next_apu_event();
+  void    update_idle_cycles();
+  void    start_song();
+  void    update_nsf_player();
+  void    call_nsf_routine(uint16_t addr);
+
+  Cpu     cpu_;
+  Ppu     ppu_;
+  Apu     apu_;
+  Input   input_;
+  Cart    cart_;
+  bool    powered_on_;
+  bool    catching_up_;
+  int64_t target_;
+  int64_t frames_;
+  int64_t idle_cycles_;
+  int64_t idle_cycles_per_frame_;
+
+  // Cached result of next_apu_event(), invalidated whenever the APU runs or
+  // its registers are accessed.
+  int64_t apu_event_;
+  bool    apu_event_stale_;
+
+  // NSF player state (see load_nsf). N.B., PLAY calls are scheduled off a
+  // count rather than by adding up periods, so that they don't drift.
+  std::optional<NsfHeader> nsf_;
+  int                      song_;
+  int64_t                  play_start_;
+  int64_t                  plays_;
+  int64_t                  next_play_;
 };
@@ -1,11 +1,20 @@
+#include <algorithm>
+#include <array>
 #include <bit>
 #include <cassert>
 #include <cstring>
 #include <format>
+#include <limits>
+#include <type_traits>
+
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
 
 #include "src/emu/cart.h"
 #include "src/emu/cpu.h"
 #include "src/emu/ppu.h"
+#include "src/emu/state.h"
 
 // PPUCTRL layout
 // ==============
@@ -130,16 +139,193 @@ template <uint16_t mask, int max> constexpr bool inc_bits(uint16_t &bits) {
   }
 }
 
+// Spreads the bits of a pattern byte out into 8 pixels, one per byte, in the
+// order they appear on screen. The flipped variant is for horizontally flipped
+// sprites. This way a whole tile row can be decoded with a few table lookups
+// (see decode_tile_row) instead of one bit at a time.
+using PixelRows = std::array<uint64_t, 256>;
+
+static constexpr PixelRows make_pixel_rows(bool flip) {
+  PixelRows rows = {};
+  for (int x = 0; x < 256; x++) {
+    for (int i = 0; i < 8; i++) {
+      int bit  = flip ? i : 7 - i;
+      int byte = std::endian::native == std::endian::little ? i : 7 - i;
+      rows[x] |= (uint64_t)((x >> bit) & 1) << (byte * 8);
+    }
+  }
+  return rows;
+}
+
+static constexpr PixelRows PIXEL_ROWS         = make_pixel_rows(false);
+static constexpr PixelRows PIXEL_ROWS_FLIPPED = make_pixel_rows(true);
+
+// Decodes a row of 8 pixels into dst, with each pixel holding the pattern in
+// bits 0..1 and the palette in bits 2..3.
+static void decode_tile_row(
+    uint8_t *dst, uint8_t pt_lo, uint8_t pt_hi, uint8_t at_lo, uint8_t at_hi
+) {
+  uint64_t pixels = PIXEL_ROWS[pt_lo] | (PIXEL_ROWS[pt_hi] << 1) |
+                    (PIXEL_ROWS[at_lo] << 2) | (PIXEL_ROWS[at_hi] << 3);
+  std::memcpy(dst, &pixels, sizeof(pixels));
+}
+
+// Per-dot actions of the BG and sprite pipelines on the visible and pre-render
+// scanlines (the post-render scanlines are idle). Actions on the same dot run
+// in the order listed here, see Ppu::step_dot_actions.
+enum DotAction : uint32_t {
+  SPR_CLEAR_SOAM = 1u << 0,
+  SPR_EVAL_INIT  = 1u << 1,
+  SPR_EVAL       = 1u << 2,
+  SPR_FETCH_INIT = 1u << 3,
+  SPR_FETCH_LO   = 1u << 4,
+  SPR_FETCH_HI   = 1u << 5,
+  SPR_RENDER     = 1u << 6,
+  BG_ADDR_BUS    = 1u << 7,
+  BG_SHIFT       = 1u << 8,
+  BG_RELOAD      = 1u << 9,
+  BG_FETCH_NT    = 1u << 10,
+  BG_FETCH_AT    = 1u << 11,
+  BG_FETCH_PT_LO = 1u << 12,
+  BG_FETCH_PT_HI = 1u << 13,
+  BG_INC_V_HORZ  = 1u << 14,
+  BG_INC_V_VERT  = 1u << 15,
+  BG_SET_V_HORZ  = 1u << 16,
+  BG_SET_V_VERT  = 1u << 17,
+};
+
+using DotActions = std::array<uint32_t, SCANLINE_MAX_CYCLES>;
+
+static constexpr DotActions make_dot_actions(bool pre_render) {
+  DotActions actions = {};
+
+  // Cycle 0 is idle (but see step_dot_actions).
+  actions[0] |= BG_ADDR_BUS;
+
+  // Cycles 1..256 fetch the BG tiles for this scanline, and cycles 321..336
+  // fetch the first two tiles of the next one. Each tile takes 8 cycles, and
+  // the shift registers get reloaded on the cycle after.
+  for (int start : {1, 321}) {
+    int end = start == 1 ? 257 : 337;
+    for (int dot = start; dot < end; dot += 8) {
+      actions[dot] |= BG_FETCH_NT;
+      actions[dot + 2] |= BG_FETCH_AT;
+      actions[dot + 4] |= BG_FETCH_PT_LO;
+      actions[dot + 6] |= BG_FETCH_PT_HI;
+      actions[dot + 7] |= BG_INC_V_HORZ;
+      actions[dot + 8] |= BG_RELOAD;
+    }
+    for (int dot = start + 1; dot <= end; dot++) {
+      actions[dot] |= BG_SHIFT;
+    }
+  }
+  actions[256] |= BG_INC_V_VERT;
+
+  // Cycles 257..320 contain garbage NT fetches.
+  // Emulating the garbage NT seems to be necessary for the MMC3 A12/IRQ
+  // scanline counter to operate properly on Mega Man 3 (specifically the
+  // status bar on Gemini Man's stage).
+  for (int dot = 257; dot < 321; dot += 8) {
+    actions[dot] |= BG_FETCH_NT;
+    actions[dot + 1] |= BG_FETCH_NT;
+  }
+  actions[257] |= BG_SET_V_HORZ;
+  if (pre_render) {
+    for (int dot = 280; dot <= 304; dot++) {
+      actions[dot] |= BG_SET_V_VERT;
+    }
+  }
+
+  // Cycles 337..340 are garbage NT fetches.
+  // nesdev says these are used by MMC5 to clock a counter.
+  actions[337] |= BG_FETCH_NT;
+  actions[339] |= BG_FETCH_NT;
+
+  // Cycles 1..64 clear the secondary OAM (except on the pre-render scanline).
+  if (!pre_render) {
+    for (int dot = 2; dot <= 64; dot += 2) {
+      actions[dot] |= SPR_CLEAR_SOAM;
+    }
+  }
+
+  // Cycles 65..256 are sprite evaluation (except on the pre-render scanline).
+  actions[65] |= SPR_EVAL_INIT;
+  if (!pre_render) {
+    for (int dot = 65; dot <= 256; dot++) {
+      actions[dot] |= SPR_EVAL;
+    }
+  }
+
+  // Cycles 257..320 are sprite tile fetches and render, 8 cycles per sprite.
+  actions[257] |= SPR_FETCH_INIT;
+  for (int dot = 257; dot < 321; dot += 8) {
+    actions[dot + 4] |= SPR_FETCH_LO;
+    actions[dot + 6] |= SPR_FETCH_HI;
+    actions[dot + 8] |= SPR_RENDER;
+  }
+
+  return actions;
+}
+
+static constexpr DotActions VISIBLE_DOT_ACTIONS    = make_dot_actions(false);
+static constexpr DotActions PRE_RENDER_DOT_ACTIONS = make_dot_actions(true);
+
+// N.B., all PPU state is plain data so that it can be copied around freely
+// (e.g., for save states).
+static_assert(std::is_trivially_copyable_v<Ppu>);
+
 Ppu::Ppu()
     : cart_(nullptr),
       cpu_(nullptr),
       scanline_(0),
       dot_(0),
-      back_frame_(std::make_unique<uint8_t[]>(256 * 240)),
-      front_frame_(std::make_unique<uint8_t[]>(256 * 240)),
+      frame_bufs_(),
+      emphasis_bufs_(),
+      front_frame_(0),
       cycles_(0),
       frames_(0),
-      ready_(false) {}
+      ready_(false),
+      scanline_renderer_(true),
+      render_level_(RENDER_FULL),
+      frame_skip_(0),
+      frames_drawn_(0) {
+  unmap_pages();
+}
+
+void Ppu::map_chr(uint16_t addr, int size, const uint8_t *mem) {
+  assert(!(addr & 0x3ff) && !(size & 0x3ff) && addr + size <= 0x2000);
+  for (int offset = 0; offset < size; offset += 1024) {
+    chr_pages_[(addr + offset) >> 10] = mem ? mem + offset : nullptr;
+  }
+}
+
+void Ppu::map_nt(int page, int vram_addr) {
+  assert(page >= 0 && page < 4 && vram_addr < (int)sizeof(vram_));
+  nt_pages_[page] = vram_addr;
+}
+
+void Ppu::unmap_pages() {
+  std::fill(std::begin(chr_pages_), std::end(chr_pages_), nullptr);
+  std::fill(std::begin(nt_pages_), std::end(nt_pages_), -1);
+}
+
+void Ppu::set_render_level(RenderLevel level, int frame_skip) {
+  if (frame_skip < 0) {
+    throw std::runtime_error(std::format("invalid frame skip: {}", frame_skip));
+  }
+  render_level_ = level;
+  frame_skip_   = frame_skip;
+}
+
+// Whether the current frame gets drawn (see RenderLevel).
+bool Ppu::drawing() const {
+  switch (render_level_) {
+  case RENDER_FULL: return true;
+  case RENDER_SKIP_FRAMES: return frames_ % (frame_skip_ + 1) == 0;
+  case RENDER_TIMING_ONLY: return false;
+  default: throw std::runtime_error("unreachable");
+  }
+}
 
 uint16_t Ppu::bg_pt_base_addr() const {
   return (uint16_t)((regs_.PPUCTRL & PPUCTRL_BG_ADDR) << 8);
@@ -162,6 +348,68 @@ int Ppu::color_emphasis() const {
   return get_bits<PPUMASK_EMPHASIS>(regs_.PPUMASK);
 }
 
+int64_t Ppu::cycles_until_nmi() const {
+  if (!(regs_.PPUCTRL & PPUCTRL_NMI_ENABLE)) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  // NMIs are signaled at dot 1 of scanline 241 (see step_post_render_scanline).
+  return cycles_until(241, 1);
+}
+
+int64_t Ppu::cycles_until_status_change() {
+  // N.B., all three flags are cleared at the same time.
+  int64_t cycles =
+      std::min(cycles_until(241, 1), cycles_until(PRE_RENDER_SCANLINE, 1));
+  uint8_t unset = ~regs_.PPUSTATUS & (PPUSTATUS_SPR0_HIT | PPUSTATUS_SPR_OVF);
+  if (!rendering() || !unset) {
+    return cycles;
+  }
+
+  // Otherwise, a sprite 0 hit or overflow can only happen on a line where
+  // sprite evaluation finds sprite 0 or 8 sprites in range (or on the line
+  // after it, where the sprites are drawn).
+  int spr_height = (regs_.PPUCTRL & PPUCTRL_SPR_SIZE) ? 16 : 8;
+  if (spr_height != spr_height_) {
+    // N.B., the new height only takes effect at the next evaluation.
+    return 0;
+  }
+  if (spr_lines_dirty_ || spr_lines_height_ != spr_height_) {
+    build_spr_lines();
+  }
+  int first = 0;
+  if (scanline_ < VISIBLE_FRAME_END) {
+    first = std::max(scanline_ - 1, 0);
+  } else if (scanline_ < PRE_RENDER_SCANLINE) {
+    first = VISIBLE_FRAME_END;
+  }
+  for (int scanline = first; scanline < VISIBLE_FRAME_END; scanline++) {
+    const SpriteLine &line = spr_lines_[scanline];
+    bool spr0 = line.count > 0 && line.sprites[0] == 0;
+    bool ovf  = line.count == 8;
+    if ((spr0 && (unset & PPUSTATUS_SPR0_HIT)) ||
+        (ovf && (unset & PPUSTATUS_SPR_OVF))) {
+      if (scanline_ < VISIBLE_FRAME_END && scanline <= scanline_) {
+        return 0;
+      }
+      return std::min(cycles, cycles_until(scanline, 0));
+    }
+  }
+  return cycles;
+}
+
+int64_t Ppu::cycles_until(int scanline, int dot) const {
+  int64_t cycles =
+      (int64_t)(scanline - scanline_) * SCANLINE_MAX_CYCLES + dot - dot_;
+  if (cycles < 0) {
+    // N.B., wraps around past the pre-render scanline, which is one dot short
+    // on odd frames (and the frame count goes up at the end of the visible
+    // frame).
+    int64_t frames = frames_ + (scanline_ < VISIBLE_FRAME_END);
+    cycles += (PRE_RENDER_SCANLINE + 1) * SCANLINE_MAX_CYCLES - (frames & 1);
+  }
+  return cycles;
+}
+
 uint16_t Ppu::spr_pt_base_addr() const {
   return (uint16_t)((regs_.PPUCTRL & PPUCTRL_SPR_ADDR) << 9);
 }
@@ -172,6 +420,7 @@ void Ppu::power_on() {
   regs_.PPUSTATUS   = 0b10100000;
   regs_.OAMADDR     = 0;
   regs_.PPUDATA     = 0;
+  regs_.OAMDMA      = 0;
   regs_.v           = 0;
   regs_.t           = 0;
   regs_.x           = 0;
@@ -181,20 +430,37 @@ void Ppu::power_on() {
   regs_.shift_at_lo = 0;
   regs_.shift_at_hi = 0;
   addr_bus_         = 0;
+  bg_nt_            = 0;
+  bg_at_            = 0;
+  bg_pt_lo_         = 0;
+  bg_pt_hi_         = 0;
   scanline_         = PRE_RENDER_SCANLINE;
   dot_              = 0;
   cycles_           = 0;
   frames_           = 0;
+  frames_drawn_     = 0;
   ready_            = false;
-  bg_loop_          = bg_loop();
-  spr_loop_         = spr_loop();
+
+  spr_eval_sprite_   = 64;
+  spr_eval_phase_    = 0;
+  soam_index_        = 0;
+  spr_eval_y_        = 0;
+  spr_height_        = 8;
+  spr0_enabled_      = false;
+  spr_fetch_pending_ = false;
+  spr_attr_          = 0;
+  spr_x_             = 0;
+  spr_pt_lo_         = 0;
+  spr_pt_hi_         = 0;
+  spr_lines_height_  = 0;
+  spr_lines_dirty_   = true;
 
   std::memset(oam_, 0, sizeof(oam_));
   std::memset(soam_, 0, sizeof(soam_));
   std::memset(palette_, 0, sizeof(palette_));
   std::memset(vram_, 0, sizeof(vram_));
-  std::memset(back_frame_.get(), 0, sizeof(256 * 240));
-  std::memset(front_frame_.get(), 0, sizeof(256 * 240));
+  std::memset(frame_bufs_, 0, sizeof(frame_bufs_));
+  std::memset(emphasis_bufs_, 0, sizeof(emphasis_bufs_));
 }
 
 void Ppu::reset() {
@@ -210,16 +476,65 @@ void Ppu::reset() {
   regs_.shift_at_lo = 0;
   regs_.shift_at_hi = 0;
   addr_bus_         = 0;
+  bg_nt_            = 0;
+  bg_at_            = 0;
+  bg_pt_lo_         = 0;
+  bg_pt_hi_         = 0;
   scanline_         = PRE_RENDER_SCANLINE;
   dot_              = 0;
   cycles_           = 0;
   frames_           = 0;
+  frames_drawn_     = 0;
   ready_            = false;
-  bg_loop_          = bg_loop();
-  spr_loop_         = spr_loop();
 
-  std::memset(back_frame_.get(), 0, sizeof(256 * 240));
-  std::memset(front_frame_.get(), 0, sizeof(256 * 240));
+  spr_eval_sprite_   = 64;
+  spr_eval_phase_    = 0;
+  soam_index_        = 0;
+  spr_eval_y_        = 0;
+  spr_height_        = 8;
+  spr0_enabled_      = false;
+  spr_fetch_pending_ = false;
+  spr_attr_          = 0;
+  spr_x_             = 0;
+  spr_pt_lo_         = 0;
+  spr_pt_hi_         = 0;
+  spr_lines_height_  = 0;
+  spr_lines_dirty_   = true;
+
+  std::memset(frame_bufs_, 0, sizeof(frame_bufs_));
+  std::memset(emphasis_bufs_, 0, sizeof(emphasis_bufs_));
+}
+
+// N.B., of the frame buffers, only the rows already drawn in the frame being
+// drawn are saved, so that a state loaded mid-frame still shows it whole.
+// Between frames (e.g., for rewind), that's none at all.
+void Ppu::save_state(StateWriter &w) const {
+  w.write(regs_, vram_, palette_, oam_, soam_, addr_bus_);
+  w.write(bg_nt_, bg_at_, bg_pt_lo_, bg_pt_hi_, spr_buf_);
+  w.write(scanline_, dot_, cycles_, frames_, ready_);
+  w.write(spr_eval_sprite_, spr_eval_phase_, soam_index_, spr_eval_y_);
+  w.write(spr_height_, spr0_enabled_, spr_fetch_pending_, spr_attr_, spr_x_);
+  w.write(spr_pt_lo_, spr_pt_hi_);
+  int rows = drawn_rows();
+  w.write_bytes(frame_bufs_[front_frame_ ^ 1], rows * 256);
+  w.write_bytes(emphasis_bufs_[front_frame_ ^ 1], rows);
+}
+
+void Ppu::load_state(StateReader &r) {
+  r.read(regs_, vram_, palette_, oam_, soam_, addr_bus_);
+  r.read(bg_nt_, bg_at_, bg_pt_lo_, bg_pt_hi_, spr_buf_);
+  r.read(scanline_, dot_, cycles_, frames_, ready_);
+  r.read(spr_eval_sprite_, spr_eval_phase_, soam_index_, spr_eval_y_);
+  r.read(spr_height_, spr0_enabled_, spr_fetch_pending_, spr_attr_, spr_x_);
+  r.read(spr_pt_lo_, spr_pt_hi_);
+  int rows = drawn_rows();
+  r.read_bytes(frame_bufs_[front_frame_ ^ 1], rows * 256);
+  r.read_bytes(emphasis_bufs_[front_frame_ ^ 1], rows);
+  spr_lines_dirty_ = true;
+}
+
+int Ppu::drawn_rows() const {
+  return scanline_ < VISIBLE_FRAME_END ? scanline_ + 1 : 0;
 }
 
 static constexpr uint16_t MMAP_ADDR_MASK    = 0x3fff;
@@ -229,6 +544,13 @@ static constexpr uint16_t PALETTE_SPR_MASK  = 0xffef;
 
 void Ppu::poke(uint16_t addr, uint8_t x) {
   addr &= MMAP_ADDR_MASK;
+  if (addr >= 0x2000 && addr < 0x3000) {
+    int vram_addr = nt_pages_[(addr >> 10) & 3];
+    if (vram_addr >= 0) {
+      vram_[vram_addr + (addr & 0x3ff)] = x;
+      return;
+    }
+  }
   if (addr < Cart::PPU_ADDR_END) {
     auto p = cart_->poke_ppu(addr, x);
     if (p.is_address()) {
@@ -248,6 +570,17 @@ void Ppu::poke(uint16_t addr, uint8_t x) {
 
 uint8_t Ppu::peek(uint16_t addr) {
   addr &= MMAP_ADDR_MASK;
+  if (addr < 0x2000) {
+    const uint8_t *page = chr_pages_[addr >> 10];
+    if (page) {
+      return page[addr & 0x3ff];
+    }
+  } else if (addr < 0x3000) {
+    int vram_addr = nt_pages_[(addr >> 10) & 3];
+    if (vram_addr >= 0) {
+      return vram_[vram_addr + (addr & 0x3ff)];
+    }
+  }
   if (addr < Cart::PPU_ADDR_END) {
     auto p = cart_->peek_ppu(addr);
     if (p.is_value()) {
@@ -333,6 +666,9 @@ void Ppu::write_PPUSTATUS([[maybe_unused]] uint8_t x) {
 void Ppu::write_OAMADDR(uint8_t x) { regs_.OAMADDR = x; }
 
 void Ppu::write_OAMDATA(uint8_t x) {
+  if (regs_.OAMADDR % 4 == 0 && oam_[regs_.OAMADDR] != x) {
+    spr_lines_dirty_ = true;
+  }
   oam_[regs_.OAMADDR] = x;
   regs_.OAMADDR++;
 }
@@ -401,13 +737,25 @@ void Ppu::step() {
   cycles_++;
 }
 
+void Ppu::run_until(int64_t cycles) {
+  while (cycles_ < cycles) {
+    // N.B., mappers which watch the address bus (e.g., the MMC3 scanline
+    // counter) need to see every dot.
+    if (scanline_renderer_ && dot_ == 0 && scanline_ < VISIBLE_FRAME_END &&
+        cycles - cycles_ >= SCANLINE_MAX_CYCLES && !cart_->step_ppu_enabled()) {
+      step_scanline();
+    } else {
+      step();
+    }
+  }
+}
+
 void Ppu::step_visible_frame() {
   if (dot_ >= 2 && dot_ <= 257) {
     draw_dot();
   }
 
-  spr_loop_.step();
-  bg_loop_.step();
+  step_dot_actions(VISIBLE_DOT_ACTIONS[dot_]);
 }
 
 void Ppu::step_pre_render_scanline() {
@@ -415,8 +763,7 @@ void Ppu::step_pre_render_scanline() {
     regs_.PPUSTATUS &= ~PPUSTATUS_ALL;
   }
 
-  spr_loop_.step();
-  bg_loop_.step();
+  step_dot_actions(PRE_RENDER_DOT_ACTIONS[dot_]);
 }
 
 void Ppu::step_post_render_scanline() {
@@ -444,8 +791,11 @@ void Ppu::next_dot() {
   dot_ = 0;
   scanline_++;
   if (scanline_ == VISIBLE_FRAME_END) {
+    if (drawing()) {
+      frames_drawn_++;
+      front_frame_ ^= 1;
+    }
     frames_++;
-    back_frame_.swap(front_frame_);
     spr_buf_.clear();
     // TODO: this might be too early for marking the PPU ready
     ready_ = true;
@@ -464,14 +814,40 @@ void Ppu::draw_dot() {
   assert(scanline_ >= 0 && scanline_ < 240);
   assert(dot_ >= 2 && dot_ <= 257);
 
-  int x            = dot_ - 2;
-  int frame_offset = scanline_ * 256 + x;
+  int  x            = dot_ - 2;
+  int  frame_offset = scanline_ * 256 + x;
+  bool drawing      = this->drawing();
+
+  if (x == 0 && drawing) {
+    back_emphasis()[scanline_] = (uint8_t)color_emphasis();
+  }
 
   if (!rendering()) {
-    back_frame_[frame_offset] = palette_[0];
+    if (drawing) {
+      back_frame()[frame_offset] = palette_[0];
+    }
     return;
   }
 
+  // N.B., when the frame isn't drawn, only sprite 0 hits are observable.
+  if (!drawing && !spr_buf_.has_spr0()) {
+    return;
+  }
+
+  uint8_t bg_lo  = (regs_.shift_bg_lo >> (15 - regs_.x)) & 1;
+  uint8_t bg_hi  = (regs_.shift_bg_hi >> (15 - regs_.x)) & 1;
+  uint8_t at_lo  = (regs_.shift_at_lo >> (15 - regs_.x)) & 1;
+  uint8_t at_hi  = (regs_.shift_at_hi >> (15 - regs_.x)) & 1;
+  int     bg_pat = bg_lo | (bg_hi << 1);
+  int     bg_pal = at_lo | (at_hi << 1);
+
+  uint8_t pixel = draw_pixel(x, bg_pat, bg_pal);
+  if (drawing) {
+    back_frame()[frame_offset] = pixel;
+  }
+}
+
+uint8_t Ppu::draw_pixel(int x, int bg_pat, int bg_pal) {
   int  pat           = 0;
   int  pal           = 0;
   bool spr_behind    = false;
@@ -482,32 +858,89 @@ void Ppu::draw_dot() {
     pal += 4;
   }
 
-  if (bg_rendering() && (bg_show_left() || x >= 8)) {
-    uint8_t bg_lo  = (regs_.shift_bg_lo >> (15 - regs_.x)) & 1;
-    uint8_t bg_hi  = (regs_.shift_bg_hi >> (15 - regs_.x)) & 1;
-    int     bg_pat = bg_lo | (bg_hi << 1);
-    if (bg_pat) {
-      // Sprite 0 hit cannot happen on x = 255 for obscure reasons.
-      // See https://www.nesdev.org/wiki/PPU_OAM#Sprite_0_hits
-      if (spr0_rendered && x != 255) {
-        regs_.PPUSTATUS |= PPUSTATUS_SPR0_HIT;
-      }
-      if (spr_behind || pat == 0) {
-        uint8_t at_lo = (regs_.shift_at_lo >> (15 - regs_.x)) & 1;
-        uint8_t at_hi = (regs_.shift_at_hi >> (15 - regs_.x)) & 1;
-        pat           = bg_pat;
-        pal           = at_lo | (at_hi << 1);
-      }
+  if (bg_rendering() && (bg_show_left() || x >= 8) && bg_pat) {
+    // Sprite 0 hit cannot happen on x = 255 for obscure reasons.
+    // See https://www.nesdev.org/wiki/PPU_OAM#Sprite_0_hits
+    if (spr0_rendered && x != 255) {
+      regs_.PPUSTATUS |= PPUSTATUS_SPR0_HIT;
+    }
+    if (spr_behind || pat == 0) {
+      pat = bg_pat;
+      pal = bg_pal;
     }
   }
 
-  uint8_t color;
   if (pat) {
-    color = palette_[pal * 4 + pat];
+    return palette_[pal * 4 + pat];
   } else {
-    color = palette_[0];
+    return palette_[0];
   }
-  back_frame_[frame_offset] = color;
+}
+
+// Same as calling draw_pixel for each pixel of the scanline, with bg holding
+// the BG pixels as produced by decode_tile_row.
+void Ppu::draw_scanline(uint8_t *row, const uint8_t *bg) {
+#ifdef __SSE4_1__
+  // Pixels are composed 16 at a time. Each lane ends up with an index into the
+  // palette (with sprites at 16 and up), which then gets resolved with a pair
+  // of byte shuffles.
+  const __m128i zero     = _mm_setzero_si128();
+  const __m128i all      = _mm_set1_epi8(-1);
+  const __m128i not_left = _mm_set_epi64x(-1, 0);
+  const __m128i pat      = _mm_set1_epi8(0x03);
+  const __m128i color    = _mm_set1_epi8(0x0f);
+  const __m128i behind   = _mm_set1_epi8(0x10);
+  const __m128i spr0     = _mm_set1_epi8(0x20);
+  const __m128i spr_pal  = _mm_set1_epi8(0x10);
+  const __m128i pal_lo   = _mm_loadu_si128((const __m128i *)&palette_[0]);
+  const __m128i pal_hi   = _mm_loadu_si128((const __m128i *)&palette_[16]);
+
+  __m128i bg_mask  = bg_rendering() ? all : zero;
+  __m128i spr_mask = spr_rendering() ? all : zero;
+  __m128i bg_left  = bg_show_left() ? all : not_left;
+  __m128i spr_left = spr_show_left() ? all : not_left;
+
+  for (int x = 0; x < 256; x += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *)&bg[x]);
+    __m128i s = _mm_loadu_si128((const __m128i *)&spr_buf_.data()[x]);
+    b         = _mm_and_si128(b, bg_mask);
+    s         = _mm_and_si128(s, spr_mask);
+    if (x == 0) {
+      b = _mm_and_si128(b, bg_left);
+      s = _mm_and_si128(s, spr_left);
+    }
+
+    __m128i bg_clear  = _mm_cmpeq_epi8(_mm_and_si128(b, pat), zero);
+    __m128i spr_clear = _mm_cmpeq_epi8(_mm_and_si128(s, pat), zero);
+    __m128i spr_back  = _mm_cmpeq_epi8(_mm_and_si128(s, behind), behind);
+    __m128i spr_zero  = _mm_cmpeq_epi8(_mm_and_si128(s, spr0), spr0);
+
+    // Sprite 0 hit cannot happen on x = 255 (see draw_pixel).
+    int hit = _mm_movemask_epi8(_mm_andnot_si128(bg_clear, spr_zero));
+    if (x == 240) {
+      hit &= 0x7fff;
+    }
+    if (hit) {
+      regs_.PPUSTATUS |= PPUSTATUS_SPR0_HIT;
+    }
+
+    __m128i use_bg  = _mm_or_si128(spr_back, spr_clear);
+    use_bg          = _mm_andnot_si128(bg_clear, use_bg);
+    __m128i bg_idx  = _mm_and_si128(b, color);
+    __m128i spr_idx = _mm_or_si128(_mm_and_si128(s, color), spr_pal);
+    spr_idx         = _mm_andnot_si128(spr_clear, spr_idx);
+    __m128i idx     = _mm_blendv_epi8(spr_idx, bg_idx, use_bg);
+
+    __m128i hi_idx = _mm_cmpeq_epi8(_mm_and_si128(idx, spr_pal), spr_pal);
+    __m128i lo     = _mm_shuffle_epi8(pal_lo, idx);
+    __m128i hi     = _mm_shuffle_epi8(pal_hi, idx);
+    _mm_storeu_si128((__m128i *)&row[x], _mm_blendv_epi8(lo, hi, hi_idx));
+  }
+#else
+  for (int x = 0; x < 256; x++) {
+    row[x] = draw_pixel(x, bg[x] & 3, bg[x] >> 2);
+  }
+#endif
 }
 
 uint8_t Ppu::bg_loop_fetch_nt() {
@@ -597,153 +1030,69 @@ void Ppu::bg_loop_shift_regs() {
   regs_.shift_at_hi <<= 1;
 }
 
-static constexpr std::suspend_always SUSPEND_ALWAYS;
-
-Coroutine Ppu::bg_loop() {
-  uint8_t nt = 0, at = 0, pt_lo = 0, pt_hi = 0;
-
-  while (true) {
-    // Cycle 0 is idle.
-    assert(scanline_ == 261 || scanline_ < 240);
-    assert(dot_ == 0);
-    if (rendering()) {
-      // Nesdev says the value of the address bus should be the same as the PT
-      // fetch that happens later on dot 5. For simplicity, we just set it to
-      // the base PT address. Emulating this behavior seems to be necessary for
-      // the MMC3 A12/IRQ scanline counter to operate properly on Mega Man 3
-      // (specifically the status bar on Gemini Man's stage).
-      addr_bus_ = bg_pt_base_addr();
-    }
-    co_await SUSPEND_ALWAYS;
-
-    // Cycles 1..256 fetch and load BG shift registers.
-    assert(dot_ == 1);
-    while (dot_ != 257) {
-      if (rendering()) {
-        nt = bg_loop_fetch_nt();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        at = bg_loop_fetch_at();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        pt_lo = bg_loop_fetch_pt_lo(nt);
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        pt_hi = bg_loop_fetch_pt_hi(nt);
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        bg_loop_inc_v_horz();
-        if (dot_ == 256) {
-          bg_loop_inc_v_vert();
-        }
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        bg_loop_reload_regs(at, pt_lo, pt_hi);
-      }
-    }
-
-    // Cycles 257..320 contain garbage NT fetches.
-    // Emulating the garbage NT seems to be necessary for the MMC3 A12/IRQ
-    // scanline counter to operate properly on Mega Man 3 (specifically the
-    // status bar on Gemini Man's stage).
-    assert(dot_ == 257);
-    while (dot_ != 321) {
-      if (rendering()) {
-        int rel_dot = (dot_ - 257) & 0x7;
-        if (rel_dot == 0 || rel_dot == 1) {
-          bg_loop_fetch_nt();
-        }
-        if (dot_ == 257) {
-          bg_loop_set_v_horz();
-        }
-        if (dot_ >= 280 && dot_ <= 304 && scanline_ == PRE_RENDER_SCANLINE) {
-          bg_loop_set_v_vert();
-        }
-      }
-      co_await SUSPEND_ALWAYS;
-    }
-
-    // Cycles 321..336 fetch and load BG shift regs (for the next scanline).
-    assert(dot_ == 321);
-    while (dot_ != 337) {
-      if (rendering()) {
-        nt = bg_loop_fetch_nt();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        at = bg_loop_fetch_at();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        pt_lo = bg_loop_fetch_pt_lo(nt);
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        pt_hi = bg_loop_fetch_pt_hi(nt);
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        bg_loop_inc_v_horz();
-      }
-      co_await SUSPEND_ALWAYS;
-      if (rendering()) {
-        bg_loop_shift_regs();
-        bg_loop_reload_regs(at, pt_lo, pt_hi);
-      }
-    }
+void Ppu::step_dot_actions(uint32_t actions) {
+  if (actions & SPR_CLEAR_SOAM && rendering()) {
+    soam_[(dot_ - 2) / 2] = 0xff;
+  }
+  if (actions & SPR_EVAL_INIT) {
+    spr_eval_init();
+  }
+  if (actions & SPR_EVAL) {
+    spr_eval_step();
+  }
+  if (actions & SPR_FETCH_INIT) {
+    spr_buf_.clear();
+  }
+  if (actions & SPR_FETCH_LO) {
+    spr_fetch_lo((dot_ - 261) / 8);
+  }
+  if (actions & SPR_FETCH_HI) {
+    spr_fetch_hi();
+  }
+  if (actions & SPR_RENDER) {
+    spr_fetch_render((dot_ - 265) / 8);
+  }
 
-    // Cycles 337..340 are garbage NT fetches.
-    // nesdev says these are used by MMC5 to clock a counter.
-    assert(dot_ == 337);
-    if (rendering()) {
-      bg_loop_fetch_nt();
-    }
-    co_await SUSPEND_ALWAYS;
-    co_await SUSPEND_ALWAYS;
-    if (rendering()) {
-      bg_loop_fetch_nt();
-    }
-    while (dot_ != 0) {
-      co_await SUSPEND_ALWAYS;
-    }
+  if (!rendering()) {
+    return;
+  }
+  if (actions & BG_ADDR_BUS) {
+    // Nesdev says the value of the address bus should be the same as the PT
+    // fetch that happens later on dot 5. For simplicity, we just set it to
+    // the base PT address. Emulating this behavior seems to be necessary for
+    // the MMC3 A12/IRQ scanline counter to operate properly on Mega Man 3
+    // (specifically the status bar on Gemini Man's stage).
+    addr_bus_ = bg_pt_base_addr();
+  }
+  if (actions & BG_SHIFT) {
+    bg_loop_shift_regs();
+  }
+  if (actions & BG_RELOAD) {
+    bg_loop_reload_regs(bg_at_, bg_pt_lo_, bg_pt_hi_);
+  }
+  if (actions & BG_FETCH_NT) {
+    bg_nt_ = bg_loop_fetch_nt();
+  }
+  if (actions & BG_FETCH_AT) {
+    bg_at_ = bg_loop_fetch_at();
+  }
+  if (actions & BG_FETCH_PT_LO) {
+    bg_pt_lo_ = bg_loop_fetch_pt_lo(bg_nt_);
+  }
+  if (actions & BG_FETCH_PT_HI) {
+    bg_pt_hi_ = bg_loop_fetch_pt_hi(bg_nt_);
+  }
+  if (actions & BG_INC_V_HORZ) {
+    bg_loop_inc_v_horz();
+  }
+  if (actions & BG_INC_V_VERT) {
+    bg_loop_inc_v_vert();
+  }
+  if (actions & BG_SET_V_HORZ) {
+    bg_loop_set_v_horz();
+  }
+  if (actions & BG_SET_V_VERT) {
+    bg_loop_set_v_vert();
   }
 }
 
@@ -775,116 +1124,140 @@ static uint16_t spr_calc_pt_addr(
   return (uint16_t)(base_pt_addr + (tile_index << 4) + rel_y);
 }
 
+void Ppu::spr_eval_init() {
+  spr_eval_sprite_ = 0;
+  spr_eval_phase_  = 0;
+  soam_index_      = 0;
+  spr_height_      = (regs_.PPUCTRL & PPUCTRL_SPR_SIZE) ? 16 : 8;
+  spr0_enabled_    = false;
+}
+
+// Advances sprite evaluation by one cycle. Each sprite takes 2 cycles to read
+// and check its Y coordinate, plus 6 more to copy the rest of it into the
+// secondary OAM if it's in range.
 // Reference: https://forums.nesdev.org/viewtopic.php?t=15870
-Coroutine Ppu::spr_loop() {
-  while (true) {
-    // Cycle 0 is idle.
-    assert(
-        (scanline_ >= 0 && scanline_ < 240) || scanline_ == PRE_RENDER_SCANLINE
-    );
-    assert(dot_ == 0);
-    co_await SUSPEND_ALWAYS;
-
-    // Cycles 1..64 clear the secondary OAM.
-    assert(dot_ == 1);
-    if (scanline_ != PRE_RENDER_SCANLINE) {
-      for (int i = 0; i < 32; i++) {
-        co_await SUSPEND_ALWAYS;
-        if (rendering()) {
-          soam_[i] = 0xff;
+void Ppu::spr_eval_step() {
+  while (spr_eval_sprite_ < 64) {
+    int i = spr_eval_sprite_ * 4;
+    switch (spr_eval_phase_++) {
+    case 0: spr_eval_y_ = oam_[i]; return;
+    case 1:
+      if (rendering()) {
+        soam_[soam_index_] = spr_eval_y_;
+      }
+      return;
+    case 2:
+      if (rendering() && spr_y_in_range(spr_eval_y_, scanline_, spr_height_)) {
+        if (i == 0) {
+          spr0_enabled_ = true;
         }
-        co_await SUSPEND_ALWAYS;
+        return;
       }
-    } else {
-      for (int i = 0; i < 64; i++) {
-        co_await SUSPEND_ALWAYS;
+      // Out of range -> move on to the next sprite on the same cycle.
+      break;
+    case 3: soam_[++soam_index_] = oam_[i + 1]; return;
+    case 5: soam_[++soam_index_] = oam_[i + 2]; return;
+    case 7: soam_[++soam_index_] = oam_[i + 3]; return;
+    case 8:
+      // TODO: implement "correct" buggy sprite overflow.
+      if (++soam_index_ >= 32) {
+        regs_.PPUSTATUS |= PPUSTATUS_SPR_OVF;
+        spr_eval_sprite_ = 64;
+        return;
       }
+      break;
+    default: return;
     }
+    spr_eval_sprite_++;
+    spr_eval_phase_ = 0;
+  }
+}
 
-    // Cycles 65..256 are sprite evaluation.
-    assert(dot_ == 65);
-    bool spr_size_8x16 = regs_.PPUCTRL & PPUCTRL_SPR_SIZE;
-    int  spr_height    = spr_size_8x16 ? 16 : 8;
-    bool spr0_enabled  = false;
-    if (scanline_ != PRE_RENDER_SCANLINE) {
-      for (int i = 0, soam_index = 0; i < 256; i += 4) {
-        uint8_t y = oam_[i];
-        co_await SUSPEND_ALWAYS;
-        if (rendering()) {
-          soam_[soam_index] = y;
-        }
-        co_await SUSPEND_ALWAYS;
-        if (rendering() && spr_y_in_range(y, scanline_, spr_height)) {
-          if (i == 0) {
-            spr0_enabled = true;
-          }
-          co_await SUSPEND_ALWAYS;
-          soam_[++soam_index] = oam_[i + 1];
-          co_await SUSPEND_ALWAYS;
-          co_await SUSPEND_ALWAYS;
-          soam_[++soam_index] = oam_[i + 2];
-          co_await SUSPEND_ALWAYS;
-          co_await SUSPEND_ALWAYS;
-          soam_[++soam_index] = oam_[i + 3];
-          co_await SUSPEND_ALWAYS;
-          ++soam_index;
-
-          // TODO: implement "correct" buggy sprite overflow.
-          if (soam_index >= 32) {
-            regs_.PPUSTATUS |= PPUSTATUS_SPR_OVF;
-            break;
-          }
-        }
-      }
-    }
+// Same as running spr_eval_step to completion (with rendering enabled), but
+// takes the sprites in range from spr_lines_ rather than checking all 64.
+void Ppu::spr_eval_cached() {
+  assert(scanline_ < VISIBLE_FRAME_END);
+  assert(rendering());
+
+  spr_eval_init();
+  if (spr_lines_dirty_ || spr_lines_height_ != spr_height_) {
+    build_spr_lines();
+  }
 
-    // Leftover cycles from sprite evaluation are idle.
-    while (dot_ != 257) {
-      co_await SUSPEND_ALWAYS;
+  const SpriteLine &line = spr_lines_[scanline_];
+  for (int i = 0; i < line.count; i++) {
+    std::memcpy(&soam_[i * 4], &oam_[line.sprites[i] * 4], 4);
+  }
+  spr0_enabled_    = line.count > 0 && line.sprites[0] == 0;
+  soam_index_      = line.count * 4;
+  spr_eval_sprite_ = 64;
+  if (line.count == 8) {
+    // Evaluation stops right after the 8th sprite in range.
+    regs_.PPUSTATUS |= PPUSTATUS_SPR_OVF;
+    spr_eval_y_     = soam_[28];
+    spr_eval_phase_ = 9;
+  } else {
+    // Sprites after the last one in range still get their Y coordinate copied
+    // into the secondary OAM (and the last one sticks).
+    if (line.count == 0 || line.sprites[line.count - 1] != 63) {
+      soam_[soam_index_] = oam_[63 * 4];
     }
+    spr_eval_y_     = oam_[63 * 4];
+    spr_eval_phase_ = 0;
+  }
+}
 
-    // Cycles 257..320 are sprite tile fetches and render.
-    assert(dot_ == 257);
-    spr_buf_.clear();
-    for (int soam_index = 0; soam_index < 32; soam_index += 4) {
-      for (int i = 0; i < 4; i++) {
-        co_await SUSPEND_ALWAYS;
-      }
-      uint8_t y = soam_[soam_index];
-      if (rendering() && spr_y_in_range(y, scanline_, spr_height)) {
-        uint8_t tile_idx = soam_[soam_index + 1];
-        uint8_t attr     = soam_[soam_index + 2];
-        uint8_t x        = soam_[soam_index + 3];
-        addr_bus_        = spr_calc_pt_addr(
-            scanline_ - y,
-            tile_idx,
-            spr_size_8x16,
-            attr & SPR_ATTR_FLIP_VERT,
-            spr_pt_base_addr()
-        );
-        uint8_t pt_lo = peek(addr_bus_);
-        co_await SUSPEND_ALWAYS;
-        co_await SUSPEND_ALWAYS;
-        addr_bus_ += 8;
-        uint8_t pt_hi = peek(addr_bus_);
-        co_await SUSPEND_ALWAYS;
-        co_await SUSPEND_ALWAYS;
-        bool spr0 = spr0_enabled && soam_index == 0;
-        spr_loop_render(x, attr, pt_lo, pt_hi, spr0);
-      } else {
-        // Need to ensure the address bus changes here for MMC3 A12/IRQ counter
-        // compatibility.
-        addr_bus_ = spr_pt_base_addr();
-        for (int i = 0; i < 4; i++) {
-          co_await SUSPEND_ALWAYS;
-        }
+void Ppu::build_spr_lines() {
+  for (SpriteLine &line : spr_lines_) {
+    line.count = 0;
+  }
+  for (int i = 0; i < 64; i++) {
+    int y   = oam_[i * 4];
+    int end = std::min(y + spr_height_, VISIBLE_FRAME_END);
+    for (int scanline = y; scanline < end; scanline++) {
+      SpriteLine &line = spr_lines_[scanline];
+      if (line.count < 8) {
+        line.sprites[line.count++] = (uint8_t)i;
       }
     }
+  }
+  spr_lines_height_ = spr_height_;
+  spr_lines_dirty_  = false;
+}
 
-    // Remaining cycles are idle.
-    while (dot_ != 0) {
-      co_await SUSPEND_ALWAYS;
-    }
+void Ppu::spr_fetch_lo(int slot) {
+  uint8_t y          = soam_[slot * 4];
+  spr_fetch_pending_ = rendering() && spr_y_in_range(y, scanline_, spr_height_);
+  if (spr_fetch_pending_) {
+    uint8_t tile_idx = soam_[slot * 4 + 1];
+    spr_attr_        = soam_[slot * 4 + 2];
+    spr_x_           = soam_[slot * 4 + 3];
+    addr_bus_        = spr_calc_pt_addr(
+        scanline_ - y,
+        tile_idx,
+        spr_height_ == 16,
+        spr_attr_ & SPR_ATTR_FLIP_VERT,
+        spr_pt_base_addr()
+    );
+    spr_pt_lo_ = peek(addr_bus_);
+  } else {
+    // Need to ensure the address bus changes here for MMC3 A12/IRQ counter
+    // compatibility.
+    addr_bus_ = spr_pt_base_addr();
+  }
+}
+
+void Ppu::spr_fetch_hi() {
+  if (spr_fetch_pending_) {
+    addr_bus_ += 8;
+    spr_pt_hi_ = peek(addr_bus_);
+  }
+}
+
+void Ppu::spr_fetch_render(int slot) {
+  if (spr_fetch_pending_) {
+    bool spr0 = spr0_enabled_ && slot == 0;
+    spr_loop_render(spr_x_, spr_attr_, spr_pt_lo_, spr_pt_hi_, spr0);
   }
 }
 
@@ -896,23 +1269,135 @@ void Ppu::spr_loop_render(
   int  pal       = attr & SPR_ATTR_PALETTE;
   bool prio      = attr & SPR_ATTR_PRIO;
   bool flip_horz = attr & SPR_ATTR_FLIP_HORZ;
+
+  const PixelRows &rows   = flip_horz ? PIXEL_ROWS_FLIPPED : PIXEL_ROWS;
+  uint64_t         pixels = rows[pt_lo] | (rows[pt_hi] << 1);
+  uint8_t          pats[8];
+  std::memcpy(pats, &pixels, sizeof(pixels));
   for (int i = 0; x + i <= end; i++) {
-    bool lo, hi;
-    if (flip_horz) {
-      lo = pt_lo & (1u << i);
-      hi = pt_hi & (1u << i);
-    } else {
-      lo = pt_lo & (1u << (7 - i));
-      hi = pt_hi & (1u << (7 - i));
+    spr_buf_.render(x + i, pats[i], pal, prio, spr0);
+  }
+}
+
+// Steps through a whole visible scanline in one go. This must leave the PPU in
+// the same state as stepping through dots 0..340 would.
+void Ppu::step_scanline() {
+  assert(scanline_ < VISIBLE_FRAME_END);
+  assert(dot_ == 0);
+
+  uint8_t *row = &back_frame()[scanline_ * 256];
+  if (drawing()) {
+    back_emphasis()[scanline_] = (uint8_t)color_emphasis();
+  }
+  if (rendering()) {
+    render_scanline(row);
+  } else {
+    if (drawing()) {
+      std::fill_n(row, 256, palette_[0]);
     }
-    int pat = lo + (hi << 1);
-    spr_buf_.render(x + i, pat, pal, prio, spr0);
+    spr_eval_and_fetch();
+    addr_bus_ = regs_.v;
   }
+
+  dot_ = SCANLINE_MAX_CYCLES - 1;
+  next_dot();
+  cycles_ += SCANLINE_MAX_CYCLES;
+}
+
+void Ppu::spr_eval_and_fetch() {
+  if (rendering()) {
+    spr_eval_cached();
+  } else {
+    spr_eval_init();
+    while (spr_eval_sprite_ < 64) {
+      spr_eval_step();
+    }
+  }
+  spr_buf_.clear();
+
+  // N.B., when the frame isn't drawn, only sprite 0 hits can be observed, so
+  // the other sprites are left out. The address bus gets overwritten anyway.
+  int slots = drawing() ? 8 : spr0_enabled_;
+  for (int slot = 0; slot < slots; slot++) {
+    spr_fetch_lo(slot);
+    spr_fetch_hi();
+    spr_fetch_render(slot);
+  }
+}
+
+void Ppu::render_scanline(uint8_t *row) {
+  // When the frame isn't drawn, the pixels only matter for sprite 0 hits.
+  bool spr0_hit = regs_.PPUSTATUS & PPUSTATUS_SPR0_HIT;
+  bool draw     = drawing() || (spr_buf_.has_spr0() && !spr0_hit);
+
+  // Dots 1..256 fetch 32 tiles, which are shifted in behind the 2 tiles that
+  // were prefetched on the previous scanline.
+  uint8_t bg[34 * 8];
+  for (int i = 0; draw && i < 2; i++) {
+    int shift = 8 - i * 8;
+    decode_tile_row(
+        &bg[i * 8],
+        (uint8_t)(regs_.shift_bg_lo >> shift),
+        (uint8_t)(regs_.shift_bg_hi >> shift),
+        (uint8_t)(regs_.shift_at_lo >> shift),
+        (uint8_t)(regs_.shift_at_hi >> shift)
+    );
+  }
+
+  // N.B., when nothing is drawn, the fetches can't be observed: they only set
+  // the address bus, which the prefetch below overwrites, and the horizontal
+  // bits of v, which get reloaded from t at dot 257.
+  for (int i = 2; draw && i < 34; i++) {
+    uint8_t nt    = bg_loop_fetch_nt();
+    uint8_t at    = bg_loop_fetch_at();
+    uint8_t pt_lo = bg_loop_fetch_pt_lo(nt);
+    uint8_t pt_hi = bg_loop_fetch_pt_hi(nt);
+    uint8_t at_lo = (at & 1) ? 0xff : 0x00;
+    uint8_t at_hi = (at & 2) ? 0xff : 0x00;
+    decode_tile_row(&bg[i * 8], pt_lo, pt_hi, at_lo, at_hi);
+    bg_loop_inc_v_horz();
+  }
+  bg_loop_inc_v_vert();
+
+  // Dots 2..257 draw pixels, using the sprites fetched on the previous
+  // scanline.
+  if (draw) {
+    draw_scanline(row, &bg[regs_.x]);
+  }
+
+  // Dots 1..320 also clear the secondary OAM, then evaluate and fetch sprites
+  // for the next scanline.
+  std::fill_n(soam_, 32, 0xff);
+  spr_eval_and_fetch();
+  bg_loop_set_v_horz();
+
+  // Dots 321..336 prefetch the first 2 tiles of the next scanline. N.B., the
+  // fetch latches must end up as on the dot path too, since rendering may be
+  // switched on halfway through a later scanline.
+  for (int i = 0; i < 2; i++) {
+    bg_nt_    = bg_loop_fetch_nt();
+    bg_at_    = bg_loop_fetch_at();
+    bg_pt_lo_ = bg_loop_fetch_pt_lo(bg_nt_);
+    bg_pt_hi_ = bg_loop_fetch_pt_hi(bg_nt_);
+    bg_loop_inc_v_horz();
+    regs_.shift_bg_lo <<= 8;
+    regs_.shift_bg_hi <<= 8;
+    regs_.shift_at_lo <<= 8;
+    regs_.shift_at_hi <<= 8;
+    bg_loop_reload_regs(bg_at_, bg_pt_lo_, bg_pt_hi_);
+  }
+
+  // Dots 337..340 contain garbage NT fetches, the last of which is left on the
+  // address bus.
+  bg_loop_fetch_nt();
 }
 
 SpriteBuf::SpriteBuf() { clear(); }
 
-void SpriteBuf::clear() { std::memset(bytes_, 0, sizeof(bytes_)); }
+void SpriteBuf::clear() {
+  std::memset(bytes_, 0, sizeof(bytes_));
+  has_spr0_ = false;
+}
 
 void SpriteBuf::render(
     int x, int pattern, int palette, bool &behind, bool &spr0
@@ -924,6 +1409,7 @@ void SpriteBuf::render(
     return;
   }
   bytes_[x] = (uint8_t)(pattern | (palette << 2) | (behind << 4) | (spr0 << 5));
+  has_spr0_ |= spr0;
 }
 
 void SpriteBuf::get(int x, int &pattern, int &palette, bool &behind, bool &spr0)
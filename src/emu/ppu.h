@@ -1,12 +1,11 @@
 #pragma once
 
 #include <cstdint>
-#include <memory>
-
-#include "src/emu/coroutine.h"
 
 class Cpu;
 class Cart;
+class StateReader;
+class StateWriter;
 
 class SpriteBuf {
 public:
@@ -16,8 +15,15 @@ public:
   void render(int x, int pattern, int palette, bool &behind, bool &spr0);
   void get(int x, int &pattern, int &palette, bool &behind, bool &spr0) const;
 
+  // Packed pixels, see render for the layout.
+  const uint8_t *data() const { return bytes_; }
+
+  // Whether any pixels of sprite 0 were rendered since the last clear.
+  bool has_spr0() const { return has_spr0_; }
+
 private:
   uint8_t bytes_[256];
+  bool    has_spr0_;
 };
 
 class Ppu {
@@ -41,21 +47,59 @@ public:
     uint16_t shift_at_hi;
   };
 
+  // How much of each frame gets drawn. Frames that aren't drawn are still
+  // emulated in full (sprite 0 hits, sprite overflow, memory accesses and NMIs
+  // all happen as usual), only the pixels don't get written out.
+  enum RenderLevel {
+    RENDER_FULL,        // draw every frame
+    RENDER_SKIP_FRAMES, // draw 1 frame, then skip frame_skip frames
+    RENDER_TIMING_ONLY, // don't draw any frames
+  };
+
   Ppu();
 
   void set_cpu(Cpu *cpu) { cpu_ = cpu; }
   void set_ready(bool ready) { ready_ = ready; }
   void set_cart(Cart *cart) { cart_ = cart; }
 
+  // Maps 1KB pages of the pattern tables directly onto host memory, and the
+  // nametables onto offsets into VRAM, so that peek()/poke() can skip the
+  // mapper. Null pointers and negative offsets fall back to it (see
+  // Cart::map_chr and Cart::map_nt).
+  void map_chr(uint16_t addr, int size, const uint8_t *mem);
+  void map_nt(int page, int vram_addr);
+  void unmap_pages();
+
+  // Enables rendering whole scanlines at once from run_until when nothing can
+  // observe the individual dots (on by default).
+  void set_scanline_renderer(bool enabled) { scanline_renderer_ = enabled; }
+
+  // Sets how much of each frame gets drawn (RENDER_FULL by default).
+  void        set_render_level(RenderLevel level, int frame_skip = 0);
+  RenderLevel render_level() const { return render_level_; }
+  int         frame_skip() const { return frame_skip_; }
+
   Registers     &registers() { return regs_; }
   int            scanline() const { return scanline_; }
   int            dot() const { return dot_; }
   int64_t        cycles() const { return cycles_; }
   int64_t        frames() const { return frames_; }
+  int64_t        frames_drawn() const { return frames_drawn_; }
   bool           ready() const { return ready_; }
-  const uint8_t *frame() const { return front_frame_.get(); }
+  const uint8_t *frame() const { return frame_bufs_[front_frame_]; }
+  const uint8_t *frame_emphasis() const {
+    return emphasis_bufs_[front_frame_];
+  }
   uint16_t       addr_bus() const { return addr_bus_; }
 
+  // Lower bound on the number of steps that can run before the PPU signals
+  // an NMI (used by the scheduler, see Nes::run_until).
+  int64_t cycles_until_nmi() const;
+
+  // Lower bound on the number of steps that can run before PPUSTATUS changes
+  // by itself (used to skip idle loops polling it, see Cpu::run).
+  int64_t cycles_until_status_change();
+
   bool     rendering() const;
   bool     bg_rendering() const;
   bool     spr_rendering() const;
@@ -91,56 +135,114 @@ public:
   void power_on();
   void reset();
   void step();
+  void run_until(int64_t cycles);
+
+  // See Nes::save_state.
+  void save_state(StateWriter &w) const;
+  void load_state(StateReader &r);
 
 private:
   void step_visible_frame();
   void step_pre_render_scanline();
   void step_post_render_scanline();
+  void step_scanline();
+  void render_scanline(uint8_t *row);
   void next_dot();
 
+  int64_t cycles_until(int scanline, int dot) const;
+
   uint8_t read_open_bus();
   void    draw_dot();
-
-  Coroutine bg_loop();
-  uint8_t   bg_loop_fetch_nt();
-  uint8_t   bg_loop_fetch_at();
-  uint8_t   bg_loop_fetch_pt_lo(uint8_t nt);
-  uint8_t   bg_loop_fetch_pt_hi(uint8_t nt);
-  void      bg_loop_shift_regs();
-  void      bg_loop_reload_regs(uint8_t at, uint8_t pt_lo, uint8_t pt_hi);
-  void      bg_loop_inc_v_horz();
-  void      bg_loop_inc_v_vert();
-  void      bg_loop_set_v_horz();
-  void      bg_loop_set_v_vert();
-
-  Coroutine spr_loop();
+  uint8_t draw_pixel(int x, int bg_pat, int bg_pal);
+  void    draw_scanline(uint8_t *row, const uint8_t *bg);
+  void    step_dot_actions(uint32_t actions);
+  bool    drawing() const;
+  int     drawn_rows() const; // of the frame being drawn, as saved in states
+
+  uint8_t *back_frame() { return frame_bufs_[front_frame_ ^ 1]; }
+  uint8_t *back_emphasis() { return emphasis_bufs_[front_frame_ ^ 1]; }
+
+  uint8_t bg_loop_fetch_nt();
+  uint8_t bg_loop_fetch_at();
+  uint8_t bg_loop_fetch_pt_lo(uint8_t nt);
+  uint8_t bg_loop_fetch_pt_hi(uint8_t nt);
+  void    bg_loop_shift_regs();
+  void    bg_loop_reload_regs(uint8_t at, uint8_t pt_lo, uint8_t pt_hi);
+  void    bg_loop_inc_v_horz();
+  void    bg_loop_inc_v_vert();
+  void    bg_loop_set_v_horz();
+  void    bg_loop_set_v_vert();
+
+  void spr_eval_init();
+  void spr_eval_step();
+  void spr_fetch_lo(int slot);
+  void spr_fetch_hi();
+  void spr_fetch_render(int slot);
+  void spr_eval_and_fetch();
+  void spr_eval_cached();
+  void build_spr_lines();
   void
   spr_loop_render(int x, uint8_t attr, uint8_t pt_lo, uint8_t pt_hi, bool spr0);
 
-  using Frame = std::unique_ptr<uint8_t[]>;
-
-  Coroutine bg_loop_;
-  Coroutine spr_loop_;
-
   Registers regs_;
   uint8_t   vram_[2 * 1024];
   uint8_t   palette_[32];
   uint8_t   oam_[256];
   uint8_t   soam_[32];
   uint16_t  addr_bus_;
+  uint8_t   bg_nt_; // BG fetch latches
+  uint8_t   bg_at_;
+  uint8_t   bg_pt_lo_;
+  uint8_t   bg_pt_hi_;
   SpriteBuf spr_buf_;
   Cart     *cart_;
   Cpu      *cpu_;
   int       scanline_;
   int       dot_;
-  Frame     back_frame_;
-  Frame     front_frame_;
-  int64_t   cycles_; // since reset
-  int64_t   frames_; // since reset
+  uint8_t   frame_bufs_[2][256 * 240];
+  uint8_t   emphasis_bufs_[2][240];
+  int       front_frame_; // index into frame_bufs_
+  int64_t   cycles_;      // since reset
+  int64_t   frames_;      // since reset
 
   // Readiness for writes. This is a separate flag rather than just checking the
   // cycle or frame count so that we can force it to true in tests.
   bool ready_;
+
+  bool scanline_renderer_;
+
+  RenderLevel render_level_;
+  int         frame_skip_;
+  int64_t     frames_drawn_; // since reset
+
+  // N.B., nametables are mapped by offset rather than by pointer so that copies
+  // of the PPU don't point into the original's VRAM.
+  const uint8_t *chr_pages_[8];
+  int            nt_pages_[4];
+
+  // Sprite evaluation and fetch state, see spr_eval_step and spr_fetch_lo.
+  int     spr_eval_sprite_;
+  int     spr_eval_phase_;
+  int     soam_index_;
+  uint8_t spr_eval_y_;
+  int     spr_height_;
+  bool    spr0_enabled_;
+  bool    spr_fetch_pending_;
+  uint8_t spr_attr_;
+  uint8_t spr_x_;
+  uint8_t spr_pt_lo_;
+  uint8_t spr_pt_hi_;
+
+  // Sprites in range of each visible scanline, in OAM order (see
+  // build_spr_lines). These only need to be rebuilt when sprite Y coordinates
+  // or the sprite size change.
+  struct SpriteLine {
+    uint8_t count;
+    uint8_t sprites[8];
+  };
+  SpriteLine spr_lines_[240];
+  int        spr_lines_height_;
+  bool       spr_lines_dirty_;
 };
 
 inline constexpr int64_t cpu_to_ppu_cycles(int64_t cpu_cycles) {
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#include "src/emu/nes.h"
+#include "src/emu/rewind.h"
+
+// Shortest run of matching bytes worth ending a literal run for. Anything
+// shorter costs about as much to encode as a run as it does inline.
+static constexpr std::size_t MIN_ZERO_RUN = 8;
+
+static void put_varint(std::vector<uint8_t> &out, std::size_t x) {
+  while (x >= 0x80) {
+    out.push_back((uint8_t)(x | 0x80));
+    x >>= 7;
+  }
+  out.push_back((uint8_t)x);
+}
+
+static std::size_t get_varint(const uint8_t *&in) {
+  std::size_t x     = 0;
+  int         shift = 0;
+  while (*in & 0x80) {
+    x |= (std::size_t)(*in++ & 0x7f) << shift;
+    shift += 7;
+  }
+  return x | (std::size_t)*in++ << shift;
+}
+
+static uint64_t load_u64(const uint8_t *p) {
+  uint64_t x;
+  std::memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+// Encodes cur ^ prev (or just cur if prev is null) as a series of runs, each
+// being the number of zero bytes to skip, then the number of literal bytes and
+// the bytes themselves.
+static void encode(
+    const uint8_t        *cur,
+    const uint8_t        *prev,
+    std::size_t           size,
+    std::vector<uint8_t> &out
+) {
+  auto diff     = [&](std::size_t i) -> uint8_t {
+    return prev ? cur[i] ^ prev[i] : cur[i];
+  };
+  auto zero_run = [&](std::size_t i) {
+    return i + MIN_ZERO_RUN <= size &&
+           load_u64(cur + i) == (prev ? load_u64(prev + i) : 0);
+  };
+
+  out.clear();
+  std::size_t i = 0;
+  while (i < size) {
+    std::size_t zeros = i;
+    while (zero_run(i)) {
+      i += MIN_ZERO_RUN;
+    }
+    while (i < size && diff(i) == 0) {
+      i++;
+    }
+    zeros = i - zeros;
+
+    std::size_t literal = i;
+    while (i < size && !zero_run(i)) {
+      i++;
+    }
+    put_varint(out, zeros);
+    put_varint(out, i - literal);
+    for (; literal < i; literal++) {
+      out.push_back(diff(literal));
+    }
+  }
+}
+
+// XORs the encoded bytes into out, which undoes a delta or, starting from
+// zeros, restores a keyframe.
+static void decode(const uint8_t *in, int64_t in_size, uint8_t *out) {
+  const uint8_t *end = in + in_size;
+  std::size_t    i   = 0;
+  while (in < end) {
+    i += get_varint(in);
+    std::size_t literal = get_varint(in);
+    for (std::size_t j = 0; j < literal; j++) {
+      out[i + j] ^= in[j];
+    }
+    in += literal;
+    i  += literal;
+  }
+  assert(in == end);
+}
+
+using Timestamp = std::chrono::high_resolution_clock::time_point;
+
+static int64_t elapsed_nanos(Timestamp start) {
+  auto now = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now - start)
+      .count();
+}
+
+RewindBuffer::RewindBuffer(int64_t budget, int keyframe_interval)
+    : budget_(budget),
+      keyframe_interval_(keyframe_interval),
+      data_(new uint8_t[budget]),
+      bytes_used_(0),
+      since_keyframe_(0),
+      rom_hash_(0),
+      encodes_(0),
+      encode_nanos_(0),
+      decodes_(0),
+      decode_nanos_(0) {}
+
+void RewindBuffer::clear() {
+  entries_.clear();
+  bytes_used_     = 0;
+  since_keyframe_ = 0;
+  newest_.clear();
+}
+
+void RewindBuffer::push(Nes &nes) {
+  // N.B., saving catches the APU up, so it's left out of the timing.
+  nes.save_state(saved_);
+  auto start = Clock::now();
+  if (nes.cart().rom_hash() != rom_hash_) {
+    clear();
+    rom_hash_ = nes.cart().rom_hash();
+  }
+
+  // N.B., resizing pads with zeros (see Entry::span).
+  auto state_size = (int64_t)saved_.size();
+  auto span       = std::max(saved_.size(), newest_.size());
+  saved_.resize(span);
+  newest_.resize(span);
+  bool keyframe =
+      entries_.empty() || since_keyframe_ + 1 >= keyframe_interval_;
+  if (!store(keyframe, state_size)) {
+    // Making room dropped the keyframe that the delta was against.
+    store(true, state_size);
+  }
+  std::swap(newest_, saved_);
+  newest_.resize(state_size);
+
+  encodes_++;
+  encode_nanos_ += elapsed_nanos(start);
+}
+
+bool RewindBuffer::pop(Nes &nes) {
+  if (entries_.empty()) {
+    return false;
+  }
+  nes.load_state(newest_);
+
+  auto  start = Clock::now();
+  Entry entry = entries_.back();
+  entries_.pop_back();
+  bytes_used_ -= entry.size;
+  if (entry.keyframe) {
+    rebuild_newest();
+  } else {
+    // N.B., the oldest state is always a keyframe, so there's one before.
+    newest_.resize(entry.span);
+    decode(&data_[entry.offset], entry.size, newest_.data());
+    newest_.resize(entries_.back().state_size);
+    since_keyframe_--;
+  }
+
+  decodes_++;
+  decode_nanos_ += elapsed_nanos(start);
+  return true;
+}
+
+RewindBuffer::Stats RewindBuffer::stats() const {
+  auto average = [](double total, int64_t count) {
+    return count ? total / (double)count : 0;
+  };
+  return {
+      .states          = size(),
+      .bytes_used      = bytes_used_,
+      .bytes_per_state = average((double)bytes_used_, size()),
+      .encode_us       = average((double)encode_nanos_ / 1000, encodes_),
+      .decode_us       = average((double)decode_nanos_ / 1000, decodes_),
+  };
+}
+
+bool RewindBuffer::store(bool keyframe, int64_t state_size) {
+  encode(
+      saved_.data(),
+      keyframe ? nullptr : newest_.data(),
+      saved_.size(),
+      encoded_
+  );
+  auto size = (int64_t)encoded_.size();
+  if (size > budget_) {
+    throw std::runtime_error("rewind budget is too small to hold a state");
+  }
+
+  // States go one after the other, wrapping around to the start of the ring
+  // when they don't fit at the end. Whatever they overlap gets dropped.
+  int64_t offset = 0;
+  if (!entries_.empty()) {
+    offset = entries_.back().offset + entries_.back().size;
+  }
+  if (offset + size > budget_) {
+    // N.B., anything past the newest state is older than everything at the
+    // start of the ring.
+    while (!entries_.empty() && entries_.front().offset >= offset) {
+      drop_oldest();
+    }
+    offset = 0;
+  }
+  while (!entries_.empty() && entries_.front().offset < offset + size &&
+         offset < entries_.front().offset + entries_.front().size) {
+    drop_oldest();
+  }
+  if (!keyframe && entries_.empty()) {
+    return false;
+  }
+
+  std::memcpy(&data_[offset], encoded_.data(), size);
+  entries_.push_back({
+      .offset     = offset,
+      .size       = size,
+      .span       = (int64_t)saved_.size(),
+      .state_size = state_size,
+      .keyframe   = keyframe,
+  });
+  bytes_used_     += size;
+  since_keyframe_  = keyframe ? 0 : since_keyframe_ + 1;
+  return true;
+}
+
+void RewindBuffer::drop_oldest() {
+  // N.B., the deltas after a keyframe go along with it.
+  do {
+    bytes_used_ -= entries_.front().size;
+    entries_.pop_front();
+  } while (!entries_.empty() && !entries_.front().keyframe);
+}
+
+void RewindBuffer::rebuild_newest() {
+  if (entries_.empty()) {
+    newest_.clear();
+    since_keyframe_ = 0;
+    return;
+  }
+
+  // N.B., the oldest state is always a keyframe (see drop_oldest).
+  assert(entries_.front().keyframe);
+  auto keyframe = entries_.end() - 1;
+  while (!keyframe->keyframe) {
+    keyframe--;
+  }
+  newest_.clear();
+  for (auto it = keyframe; it != entries_.end(); it++) {
+    newest_.resize(std::max(newest_.size(), (std::size_t)it->span));
+    decode(&data_[it->offset], it->size, newest_.data());
+    newest_.resize(it->state_size);
+  }
+  since_keyframe_ = (int)(entries_.end() - keyframe - 1);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class Nes;
+
+// History of save states held within a fixed memory budget, so that the
+// emulator can be run backwards. Consecutive states mostly match, so each one
+// is stored as the XOR of it and the state before, run-length encoded. Every
+// keyframe_interval states, a state is stored whole instead (encoded the same
+// way, against zeros). When the budget runs out, the oldest states are dropped
+// a keyframe at a time, so whatever is left can always be decoded. N.B., states
+// vary in size (e.g., with how much of the frame in progress has been drawn),
+// so the shorter of two is padded with zeros to take the delta.
+class RewindBuffer {
+public:
+  struct Stats {
+    int     states;          // currently held
+    int64_t bytes_used;      // by the encoded states
+    double  bytes_per_state; // on average
+    double  encode_us;       // average time to encode a state
+    double  decode_us;       // average time to decode a state
+  };
+
+  RewindBuffer(int64_t budget, int keyframe_interval);
+
+  void clear();
+
+  // Saves the current state of the system.
+  void push(Nes &nes);
+
+  // Loads the most recently pushed state and drops it. Returns false if there
+  // aren't any left. N.B., stepping back across a keyframe means decoding the
+  // interval before it, which bounds the cost of any one step.
+  bool pop(Nes &nes);
+
+  int     size() const { return (int)entries_.size(); }
+  int64_t budget() const { return budget_; }
+  Stats   stats() const;
+
+private:
+  using Clock = std::chrono::high_resolution_clock;
+
+  struct Entry {
+    int64_t offset; // into data_
+    int64_t size;
+    int64_t span;       // bytes covered by the encoding
+    int64_t state_size; // of the raw state it decodes to
+    bool    keyframe;
+  };
+
+  bool store(bool keyframe, int64_t state_size);
+  void drop_oldest();
+  void rebuild_newest();
+
+  int64_t                    budget_;
+  int                        keyframe_interval_;
+  std::unique_ptr<uint8_t[]> data_; // encoded states, used as a ring
+  std::deque<Entry>          entries_;
+  int64_t                    bytes_used_;
+
+  // Raw state that the newest entry decodes to, i.e., the base for the next
+  // delta. N.B., keyframes and deltas are both applied by XORing into this.
+  std::vector<uint8_t> newest_;
+  std::vector<uint8_t> saved_;
+  std::vector<uint8_t> encoded_;
+  int                  since_keyframe_;
+  uint64_t             rom_hash_;
+
+  int64_t encodes_;
+  int64_t encode_nanos_;
+  int64_t decodes_;
+  int64_t decode_nanos_;
+};
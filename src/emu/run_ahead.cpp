@@ -0,0 +1,64 @@
+#include <chrono>
+#include <format>
+#include <stdexcept>
+
+#include "src/emu/nes.h"
+#include "src/emu/run_ahead.h"
+
+// Weight of the latest frame in the moving averages.
+static constexpr double STATS_SMOOTHING = 0.05;
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double elapsed_us(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+RunAhead::RunAhead() : frames_(0), stats_() {}
+
+void RunAhead::set_frames(int frames) {
+  if (frames < 0 || frames > MAX_FRAMES) {
+    throw std::runtime_error(std::format("invalid run-ahead: {}", frames));
+  }
+  frames_ = frames;
+  stats_  = Stats();
+}
+
+void RunAhead::run(Nes &nes) {
+  // N.B., NSF files have no frames to show.
+  if (frames_ == 0 || nes.nsf()) {
+    return;
+  }
+
+  // N.B., catching the APU up beforehand keeps the audio that's actually
+  // played out of the overhead.
+  nes.audio();
+
+  Ppu &ppu           = nes.ppu();
+  auto render_level  = ppu.render_level();
+  int  frame_skip    = ppu.frame_skip();
+  bool audio_enabled = nes.apu().audio_enabled();
+
+  auto start = Clock::now();
+  nes.save_state(state_);
+  auto saved = Clock::now();
+
+  nes.apu().set_audio_enabled(false);
+  ppu.set_render_level(Ppu::RENDER_TIMING_ONLY);
+  nes.run_frames(frames_ - 1);
+  ppu.set_render_level(Ppu::RENDER_FULL);
+  nes.run_frames(1);
+  ppu.set_render_level(render_level, frame_skip);
+  nes.apu().set_audio_enabled(audio_enabled);
+
+  // N.B., loading only restores the frame being drawn, so the one that just
+  // came out stays in front.
+  auto loading = Clock::now();
+  nes.load_state(state_);
+  auto end = Clock::now();
+
+  double overhead  = elapsed_us(start, end) / 1000;
+  double save_load = elapsed_us(start, saved) + elapsed_us(loading, end);
+  stats_.overhead_ms  += (overhead - stats_.overhead_ms) * STATS_SMOOTHING;
+  stats_.save_load_us += (save_load - stats_.save_load_us) * STATS_SMOOTHING;
+}
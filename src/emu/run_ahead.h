@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class Nes;
+
+// Hides a game's own input lag by showing frames from a little way into the
+// future. After each frame, the system is saved, run ahead a few frames with
+// the current input and then restored, so only the frame that came out of it
+// is left behind. While running ahead, only that last frame is drawn and no
+// audio is produced.
+class RunAhead {
+public:
+  static constexpr int MAX_FRAMES = 4;
+
+  struct Stats {
+    double overhead_ms;  // time spent running ahead per frame
+    double save_load_us; // of that, time spent saving and restoring
+  };
+
+  RunAhead();
+
+  // Number of frames to run ahead, 0 to turn it off.
+  void set_frames(int frames);
+  int  frames() const { return frames_; }
+
+  // Runs ahead from the current point, leaving the frame that came out of it
+  // in Ppu::frame(). Meant to be called just after a frame is finished.
+  void run(Nes &nes);
+
+  // Moving averages over the last few frames.
+  Stats stats() const { return stats_; }
+
+private:
+  int                  frames_;
+  std::vector<uint8_t> state_;
+  Stats                stats_;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Serializes save states (see Nes::save_state). Each component writes its
+// fields in a fixed order and reads them back in the same order, so there's
+// no per-field framing. N.B., values are stored in host byte order and
+// layout, so states aren't meant to be moved between different builds.
+class StateWriter {
+public:
+  explicit StateWriter(std::vector<uint8_t> &out) : out_(out) {}
+
+  template <class... T> void write(const T &...xs) {
+    static_assert((std::is_trivially_copyable_v<T> && ...));
+    (write_bytes(&xs, sizeof(T)), ...);
+  }
+
+  void write_bytes(const void *data, std::size_t size) {
+    auto *bytes = (const uint8_t *)data;
+    out_.insert(out_.end(), bytes, bytes + size);
+  }
+
+private:
+  std::vector<uint8_t> &out_;
+};
+
+class StateReader {
+public:
+  explicit StateReader(std::span<const uint8_t> in) : in_(in), pos_(0) {}
+
+  template <class... T> void read(T &...xs) {
+    static_assert((std::is_trivially_copyable_v<T> && ...));
+    (read_bytes(&xs, sizeof(T)), ...);
+  }
+
+  void read_bytes(void *data, std::size_t size) {
+    if (size > in_.size() - pos_) {
+      throw std::runtime_error("truncated save state");
+    }
+    std::memcpy(data, in_.data() + pos_, size);
+    pos_ += size;
+  }
+
+  std::size_t remaining() const { return in_.size() - pos_; }
+
+private:
+  std::span<const uint8_t> in_;
+  std::size_t              pos_;
+};
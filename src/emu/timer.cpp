@@ -42,9 +42,7 @@ void Timer::run(Nes &nes) {
   }
 
   int64_t target = nes.cpu().cycles() + min_cycles_to_run;
-  while (nes.cpu().cycles() < target) {
-    nes.step();
-  }
+  nes.run_until(target);
 
   remainder_ += (nes.cpu().cycles() - target) * NANOS_PER_SEC;
 }
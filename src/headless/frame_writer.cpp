@@ -0,0 +1,62 @@
+#include <format>
+#include <stdexcept>
+
+#include "src/app/palette.h"
+#include "src/emu/ppu.h"
+#include "src/headless/frame_writer.h"
+
+FrameWriter::FrameWriter(const std::filesystem::path &path, Format format)
+    : path_(path), format_(format), frames_written_(0) {
+  if (format_ == FORMAT_RAW) {
+    raw_.open(path_, std::ios::binary);
+    if (!raw_) {
+      throw std::runtime_error(
+          std::format("failed to open file: {}", path_.c_str())
+      );
+    }
+  } else {
+    std::filesystem::create_directories(path_);
+  }
+}
+
+void FrameWriter::write(const Ppu &ppu, int64_t frame) {
+  const uint8_t *colors   = ppu.frame();
+  const uint8_t *emphasis = ppu.frame_emphasis();
+  Pixel          row[WIDTH];
+  uint8_t       *dst = rgb_;
+  for (int y = 0; y < HEIGHT; y++) {
+    convert_colors(row, &colors[y * WIDTH], WIDTH, emphasis[y]);
+    for (Pixel pixel : row) {
+      *dst++ = pixel.r();
+      *dst++ = pixel.g();
+      *dst++ = pixel.b();
+    }
+  }
+
+  if (format_ == FORMAT_RAW) {
+    raw_.write((const char *)rgb_, sizeof(rgb_));
+    if (!raw_) {
+      throw std::runtime_error("failed to write frame data");
+    }
+  } else {
+    auto          file = path_ / std::format("frame_{:06}.ppm", frame);
+    std::ofstream os(file, std::ios::binary);
+    os << std::format("P6\n{} {}\n255\n", WIDTH, HEIGHT);
+    os.write((const char *)rgb_, sizeof(rgb_));
+    if (!os) {
+      throw std::runtime_error(
+          std::format("failed to write file: {}", file.c_str())
+      );
+    }
+  }
+  frames_written_++;
+}
+
+void FrameWriter::close() {
+  if (raw_.is_open()) {
+    raw_.close();
+    if (!raw_) {
+      throw std::runtime_error("failed to finish writing frame data");
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+
+class Ppu;
+
+// Writes out the PPU's frames as 24-bit RGB pictures, either as one PPM file
+// per frame in a directory, or back to back in a single raw file (e.g., to
+// pipe into a video encoder as 256x240 rgb24).
+class FrameWriter {
+public:
+  enum Format {
+    FORMAT_PPM,
+    FORMAT_RAW,
+  };
+
+  static constexpr int WIDTH  = 256;
+  static constexpr int HEIGHT = 240;
+
+  FrameWriter(const std::filesystem::path &path, Format format);
+
+  // Writes the PPU's last finished frame (see Ppu::frame), whose number is
+  // used to name the file.
+  void write(const Ppu &ppu, int64_t frame);
+
+  void close();
+
+  int64_t frames_written() const { return frames_written_; }
+
+private:
+  std::filesystem::path path_;
+  Format                format_;
+  std::ofstream         raw_;
+  int64_t               frames_written_;
+  uint8_t               rgb_[WIDTH * HEIGHT * 3];
+};
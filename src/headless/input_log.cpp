@@ -0,0 +1,103 @@
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+#include "src/emu/ppu.h"
+#include "src/headless/input_log.h"
+
+struct ButtonName {
+  std::string_view name;
+  int              flag;
+};
+
+static constexpr ButtonName BUTTON_NAMES[] = {
+    {"A", Controller::BUTTON_A},
+    {"B", Controller::BUTTON_B},
+    {"SELECT", Controller::BUTTON_SELECT},
+    {"START", Controller::BUTTON_START},
+    {"UP", Controller::BUTTON_UP},
+    {"DOWN", Controller::BUTTON_DOWN},
+    {"LEFT", Controller::BUTTON_LEFT},
+    {"RIGHT", Controller::BUTTON_RIGHT},
+};
+
+static int parse_button(std::string_view token, int line_num) {
+  for (auto &button : BUTTON_NAMES) {
+    if (token == button.name) {
+      return button.flag;
+    }
+  }
+  throw std::runtime_error(
+      std::format("input log line {}: unknown button: {}", line_num, token)
+  );
+}
+
+InputLog::InputLog(const Ppu &ppu) : ppu_(ppu), next_(0), buttons_(0) {}
+
+void InputLog::load(const std::filesystem::path &path) {
+  std::ifstream is(path);
+  if (!is) {
+    throw std::runtime_error(
+        std::format("failed to open file: {}", path.c_str())
+    );
+  }
+
+  entries_.clear();
+  next_    = 0;
+  buttons_ = 0;
+
+  std::string line;
+  for (int line_num = 1; std::getline(is, line); line_num++) {
+    if (auto comment = line.find('#'); comment != std::string::npos) {
+      line.resize(comment);
+    }
+    std::istringstream tokens(line);
+    std::string        token;
+    if (!(tokens >> token)) {
+      continue;
+    }
+
+    Entry entry;
+    try {
+      std::size_t len;
+      entry.frame = std::stoll(token, &len);
+      if (len != token.size() || entry.frame < 0) {
+        throw std::invalid_argument(token);
+      }
+    } catch (const std::logic_error &) {
+      throw std::runtime_error(
+          std::format("input log line {}: invalid frame: {}", line_num, token)
+      );
+    }
+    if (!entries_.empty() && entry.frame <= entries_.back().frame) {
+      throw std::runtime_error(
+          std::format("input log line {}: frames out of order", line_num)
+      );
+    }
+
+    entry.buttons = 0;
+    while (tokens >> token) {
+      if (token != "-") {
+        entry.buttons |= parse_button(token, line_num);
+      }
+    }
+    entries_.push_back(entry);
+  }
+}
+
+int InputLog::poll() {
+  // N.B., the PPU has been caught up to the CPU by the time the controller is
+  // written to, so this is exactly the frame the game is in.
+  seek(ppu_.frames());
+  return buttons_;
+}
+
+void InputLog::seek(int64_t frame) {
+  // N.B., the emulator only ever moves forwards, so there's no need to search.
+  while (next_ < entries_.size() && entries_[next_].frame <= frame) {
+    buttons_ = entries_[next_].buttons;
+    next_++;
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "src/emu/input.h"
+
+class Ppu;
+
+// Replays controller input recorded as text. Each line gives a frame number
+// followed by the buttons held from that frame on, e.g.:
+//
+//   0     -
+//   120   START
+//   130   -
+//   200   RIGHT A
+//
+// Frames must be in increasing order. A "-" releases all buttons, and anything
+// after a "#" is ignored. Frames are counted by the given PPU (see
+// Ppu::frames), which is looked up whenever the game polls the controller.
+class InputLog : public Controller {
+public:
+  explicit InputLog(const Ppu &ppu);
+
+  void load(const std::filesystem::path &path);
+
+  int poll() override;
+
+private:
+  void seek(int64_t frame);
+
+  struct Entry {
+    int64_t frame;
+    int     buttons;
+  };
+
+  const Ppu         &ppu_;
+  std::vector<Entry> entries_;
+  std::size_t        next_;
+  int                buttons_;
+};
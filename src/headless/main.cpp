@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "src/emu/nes.h"
+#include "src/headless/frame_writer.h"
+#include "src/headless/input_log.h"
+#include "src/headless/wav_writer.h"
+
+static constexpr int64_t CPU_HZ = 1789773;
+
+// CPU cycles to run between draining the APU. N.B., this is kept small enough
+// that even at the highest sample rate, the APU's buffer can't overflow.
+static constexpr int64_t BATCH_CYCLES = 8192;
+
+static_assert(
+    (BATCH_CYCLES * 2) * ApuBlip::MAX_SAMPLE_RATE / CPU_HZ <
+    (int64_t)ApuBuffer::CAPACITY
+);
+
+// Batch size for the last frame of a --frames run, so that it stops soon
+// after the frame is done (as in Nes::run_frames).
+static constexpr int64_t LAST_FRAME_BATCH_CYCLES = 1000;
+
+// Names of the CPU dispatchers, for --dispatch and the report.
+static constexpr const char *DISPATCH_NAMES[] = {"switch", "threaded", "jit"};
+
+static constexpr const char *USAGE =
+    "usage: teenynes_headless <rom or nsf> [out.wav] [options]\n"
+    "\n"
+    "Runs as fast as possible, then prints a JSON report of the speed.\n"
+    "\n"
+    "options:\n"
+    "  --seconds N   emulated seconds to run (default 60)\n"
+    "  --frames N    frames to run instead\n"
+    "  --cycles N    CPU cycles to run instead\n"
+    "  --input LOG   replay controller 1 input from LOG\n"
+    "  --ppm DIR     write each frame to DIR as a PPM file\n"
+    "  --raw FILE    write the frames to FILE as raw 256x240 RGB\n"
+    "  --rate HZ     sample rate (default 44100)\n"
+    "  --song N      song to play from an NSF file (default from the file)\n"
+    "  --dispatch D  CPU dispatcher: switch, threaded (default) or jit\n";
+
+struct Options {
+  std::string                rom_path;
+  std::optional<std::string> wav_path;
+  std::optional<double>      seconds;
+  std::optional<int64_t>     frames;
+  std::optional<int64_t>     cycles;
+  int                        sample_rate = 44100;
+  std::optional<std::string> input_path;
+  std::optional<std::string> frames_path;
+  FrameWriter::Format        frames_format = FrameWriter::FORMAT_PPM;
+  std::optional<int>         song;
+  Cpu::Dispatch              dispatch = Cpu::THREADED;
+};
+
+static Cpu::Dispatch parse_dispatch(std::string_view name) {
+  for (int i = 0; i < (int)std::size(DISPATCH_NAMES); i++) {
+    if (name == DISPATCH_NAMES[i]) {
+      return (Cpu::Dispatch)i;
+    }
+  }
+  throw std::runtime_error(std::format("unknown dispatcher: {}", name));
+}
+
+static Options parse_args(int argc, char **argv) {
+  Options opts;
+  int     positional = 0;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    if (arg.starts_with("--")) {
+      if (i + 1 >= argc) {
+        throw std::runtime_error(std::format("missing value for {}", arg));
+      }
+      std::string value = argv[++i];
+      if (arg == "--seconds") {
+        opts.seconds = std::stod(value);
+      } else if (arg == "--frames") {
+        opts.frames = std::stoll(value);
+      } else if (arg == "--cycles") {
+        opts.cycles = std::stoll(value);
+      } else if (arg == "--input") {
+        opts.input_path = value;
+      } else if (arg == "--ppm" || arg == "--raw") {
+        if (opts.frames_path) {
+          throw std::runtime_error("--ppm and --raw can't both be given");
+        }
+        opts.frames_path   = value;
+        opts.frames_format = arg == "--ppm" ? FrameWriter::FORMAT_PPM
+                                            : FrameWriter::FORMAT_RAW;
+      } else if (arg == "--rate") {
+        opts.sample_rate = std::stoi(value);
+      } else if (arg == "--song") {
+        opts.song = std::stoi(value);
+      } else if (arg == "--dispatch") {
+        opts.dispatch = parse_dispatch(value);
+      } else {
+        throw std::runtime_error(std::format("unknown option: {}", arg));
+      }
+    } else if (positional == 0) {
+      opts.rom_path = arg;
+      positional++;
+    } else if (positional == 1) {
+      opts.wav_path = arg;
+      positional++;
+    } else {
+      throw std::runtime_error(std::format("unexpected argument: {}", arg));
+    }
+  }
+  if (positional < 1) {
+    throw std::runtime_error("missing arguments");
+  }
+  if (!!opts.seconds + !!opts.frames + !!opts.cycles > 1) {
+    throw std::runtime_error(
+        "only one of --seconds, --frames and --cycles can be given"
+    );
+  }
+  if (!opts.frames && !opts.cycles) {
+    opts.seconds = opts.seconds.value_or(60);
+  }
+  if ((opts.seconds && *opts.seconds <= 0) ||
+      (opts.frames && *opts.frames <= 0) ||
+      (opts.cycles && *opts.cycles <= 0)) {
+    throw std::runtime_error("the length of the run must be positive");
+  }
+  return opts;
+}
+
+// Quotes s as a JSON string.
+static std::string json_string(std::string_view s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      out += std::format("\\u{:04x}", (int)c);
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static void run(const Options &opts) {
+  Nes      nes;
+  InputLog input_log(nes.ppu());
+  if (opts.input_path) {
+    input_log.load(*opts.input_path);
+  }
+  nes.input().set_controller(&input_log, 0);
+  if (std::filesystem::path(opts.rom_path).extension() == ".nsf") {
+    if (opts.frames || opts.frames_path) {
+      throw std::runtime_error("NSF files have no frames to run or write");
+    }
+    nes.load_nsf(opts.rom_path);
+    if (opts.song) {
+      // N.B., songs are numbered from 1, as in NSF players.
+      int songs = nes.nsf()->songs();
+      if (*opts.song < 1 || *opts.song > songs) {
+        throw std::runtime_error(
+            std::format("--song must be between 1 and {}", songs)
+        );
+      }
+      nes.select_song(*opts.song - 1);
+    }
+  } else if (opts.song) {
+    throw std::runtime_error("--song needs an NSF file");
+  } else {
+    nes.load_cart(opts.rom_path);
+  }
+
+  // N.B., unless frames are written out, the PPU only needs to keep the timing
+  // of VBLANK and sprite zero hits for the CPU (NSF files don't use it at all),
+  // and without a WAV file, there's no point in mixing the audio.
+  nes.ppu().set_render_level(
+      opts.frames_path ? Ppu::RENDER_FULL : Ppu::RENDER_TIMING_ONLY
+  );
+  nes.apu().set_sample_rate(opts.sample_rate);
+  nes.apu().set_audio_enabled(opts.wav_path.has_value());
+  nes.cpu().set_dispatch(opts.dispatch);
+  nes.power_on();
+
+  std::optional<WavWriter>   wav;
+  std::optional<FrameWriter> frame_writer;
+  if (opts.wav_path) {
+    wav.emplace(*opts.wav_path, opts.sample_rate);
+  }
+  if (opts.frames_path) {
+    frame_writer.emplace(*opts.frames_path, opts.frames_format);
+  }
+
+  int64_t end_cycles = std::numeric_limits<int64_t>::max();
+  if (opts.seconds) {
+    end_cycles = (int64_t)(*opts.seconds * CPU_HZ);
+  } else if (opts.cycles) {
+    end_cycles = *opts.cycles;
+  }
+  auto done = [&] {
+    return nes.cpu().cycles() >= end_cycles ||
+           (opts.frames && nes.ppu().frames() >= *opts.frames);
+  };
+
+  float samples[ApuBuffer::CAPACITY];
+  auto  start = std::chrono::steady_clock::now();
+  while (!done()) {
+    int64_t frame = nes.ppu().frames();
+    int64_t batch = BATCH_CYCLES;
+    if (opts.frames && frame + 1 >= *opts.frames) {
+      batch = LAST_FRAME_BATCH_CYCLES;
+    }
+    nes.run_until(std::min(nes.cpu().cycles() + batch, end_cycles));
+
+    // N.B., a batch is shorter than a frame, so at most one gets finished.
+    if (frame_writer && nes.ppu().frames() != frame) {
+      frame_writer->write(nes.ppu(), frame);
+    }
+    if (wav) {
+      auto &audio     = nes.audio();
+      int   available = audio.available();
+      for (int i = 0; i < available; i++) {
+        samples[i] = audio.read();
+      }
+      wav->write(samples, available);
+    }
+  }
+  if (wav) {
+    wav->close();
+  }
+  if (frame_writer) {
+    frame_writer->close();
+  }
+
+  // N.B., the dispatcher is reported as it ended up, since the JIT falls back
+  // to threaded code where it isn't supported. The switch dispatcher doesn't
+  // use the code cache at all. Idle cycles are those skipped through idle
+  // loops (see Cpu::run), averaged over frames for comparison with
+  // Nes::idle_cycles_per_frame.
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double seconds  = std::max(elapsed.count(), 1e-9);
+  auto   cycles   = nes.cpu().cycles();
+  auto   frames   = nes.ppu().frames();
+  double emulated = (double)cycles / CPU_HZ;
+  auto  &cache    = nes.cpu().code_cache_stats();
+  auto   lookups  = cache.hits + cache.misses;
+  double hit_rate = lookups ? (double)cache.hits / (double)lookups : 0;
+  auto   idle     = nes.cpu().idle_cycles();
+  auto   report   = std::format(
+      "{{\n"
+      "  \"rom\": {},\n"
+      "  \"dispatch\": {},\n"
+      "  \"frames\": {},\n"
+      "  \"cycles\": {},\n"
+      "  \"emulated_seconds\": {:.3f},\n"
+      "  \"elapsed_seconds\": {:.3f},\n"
+      "  \"frames_per_second\": {:.1f},\n"
+      "  \"cycles_per_second\": {:.0f},\n"
+      "  \"realtime\": {:.2f},\n"
+      "  \"idle_cycles\": {},\n"
+      "  \"idle_cycles_per_frame\": {:.0f},\n"
+      "  \"code_cache_hits\": {},\n"
+      "  \"code_cache_misses\": {},\n"
+      "  \"code_cache_uncached\": {},\n"
+      "  \"code_cache_hit_rate\": {:.4f},\n"
+      "  \"samples_written\": {},\n"
+      "  \"frames_written\": {}\n"
+      "}}\n",
+      json_string(opts.rom_path),
+      json_string(DISPATCH_NAMES[nes.cpu().dispatch()]),
+      frames,
+      cycles,
+      emulated,
+      elapsed.count(),
+      (double)frames / seconds,
+      (double)cycles / seconds,
+      emulated / seconds,
+      idle,
+      frames ? (double)idle / (double)frames : 0,
+      cache.hits,
+      cache.misses,
+      cache.uncached,
+      hit_rate,
+      wav ? wav->samples_written() : 0,
+      frame_writer ? frame_writer->frames_written() : 0
+  );
+  std::fputs(report.c_str(), stdout);
+}
+
+int main(int argc, char **argv) {
+  Options opts;
+  try {
+    opts = parse_args(argc, argv);
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "error: %s\n\n%s", e.what(), USAGE);
+    return 1;
+  }
+
+  try {
+    run(opts);
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "error: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
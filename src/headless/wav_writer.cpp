@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <stdexcept>
+
+#include "src/headless/wav_writer.h"
+
+static constexpr std::size_t BLOCK_SAMPLES = 1 << 16;
+
+// N.B., sample data is written straight out of memory.
+static_assert(std::endian::native == std::endian::little);
+
+WavWriter::WavWriter(const std::filesystem::path &path, int sample_rate)
+    : os_(path, std::ios::binary),
+      sample_rate_(sample_rate),
+      samples_written_(0),
+      closed_(false),
+      stopping_(false) {
+  if (!os_) {
+    throw std::runtime_error(
+        std::format("failed to open file: {}", path.c_str())
+    );
+  }
+
+  // N.B., the sizes get filled in by close().
+  write_header(0);
+  block_.reserve(BLOCK_SAMPLES);
+  writer_ = std::thread([this] { run_writer(); });
+}
+
+WavWriter::~WavWriter() {
+  // N.B., errors can't be reported from here, which is why close() exists.
+  try {
+    close();
+  } catch (...) {
+  }
+}
+
+void WavWriter::write(const float *samples, int count) {
+  for (int i = 0; i < count; i++) {
+    float x = std::clamp(samples[i], -1.0f, 1.0f);
+    block_.push_back((int16_t)std::lround(x * 32767));
+    if (block_.size() == BLOCK_SAMPLES) {
+      hand_off_block();
+    }
+  }
+  samples_written_ += count;
+}
+
+void WavWriter::close() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+
+  if (!block_.empty()) {
+    hand_off_block();
+  }
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_one();
+  writer_.join();
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+
+  int64_t data_bytes = samples_written_ * (int64_t)sizeof(int16_t);
+  if (data_bytes > std::numeric_limits<uint32_t>::max() - 36) {
+    throw std::runtime_error("WAV file too large");
+  }
+  os_.seekp(0);
+  write_header((uint32_t)data_bytes);
+  os_.close();
+  if (!os_) {
+    throw std::runtime_error("failed to finish writing WAV file");
+  }
+}
+
+void WavWriter::hand_off_block() {
+  std::vector<int16_t> block;
+  block.reserve(BLOCK_SAMPLES);
+  std::swap(block, block_);
+  {
+    std::lock_guard lock(mutex_);
+    blocks_.push_back(std::move(block));
+  }
+  cond_.notify_one();
+}
+
+void WavWriter::run_writer() {
+  try {
+    std::unique_lock lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [this] { return stopping_ || !blocks_.empty(); });
+      if (blocks_.empty()) {
+        return;
+      }
+      auto block = std::move(blocks_.front());
+      blocks_.pop_front();
+
+      lock.unlock();
+      os_.write(
+          (const char *)block.data(),
+          (std::streamsize)(block.size() * sizeof(int16_t))
+      );
+      if (!os_) {
+        throw std::runtime_error("failed to write WAV data");
+      }
+      lock.lock();
+    }
+  } catch (...) {
+    std::lock_guard lock(mutex_);
+    error_ = std::current_exception();
+  }
+}
+
+static void put_le(uint8_t *dst, uint32_t x, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    dst[i] = (uint8_t)(x >> (8 * i));
+  }
+}
+
+void WavWriter::write_header(uint32_t data_bytes) {
+  uint8_t header[44];
+  std::memcpy(&header[0], "RIFF", 4);
+  put_le(&header[4], 36 + data_bytes, 4);
+  std::memcpy(&header[8], "WAVE", 4);
+  std::memcpy(&header[12], "fmt ", 4);
+  put_le(&header[16], 16, 4);                         // chunk size
+  put_le(&header[20], 1, 2);                          // PCM
+  put_le(&header[22], 1, 2);                          // channels
+  put_le(&header[24], (uint32_t)sample_rate_, 4);     // sample rate
+  put_le(&header[28], (uint32_t)sample_rate_ * 2, 4); // byte rate
+  put_le(&header[32], 2, 2);                          // block align
+  put_le(&header[34], 16, 2);                         // bits/sample
+  std::memcpy(&header[36], "data", 4);
+  put_le(&header[40], data_bytes, 4);
+  os_.write((const char *)header, sizeof(header));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Writes mono 16-bit PCM WAV files. Samples are collected into blocks which
+// get written out by a background thread, so that the emulator never waits on
+// the disk.
+class WavWriter {
+public:
+  WavWriter(const std::filesystem::path &path, int sample_rate);
+  ~WavWriter();
+
+  void write(const float *samples, int count);
+
+  // Flushes everything written so far and finishes off the file. Rethrows any
+  // error from the background thread.
+  void close();
+
+  int64_t samples_written() const { return samples_written_; }
+
+private:
+  void run_writer();
+  void hand_off_block();
+  void write_header(uint32_t data_bytes);
+
+  std::ofstream        os_;
+  int                  sample_rate_;
+  int64_t              samples_written_;
+  std::vector<int16_t> block_;
+  bool                 closed_;
+
+  // Guards everything below, which is shared with the writer thread.
+  std::mutex                       mutex_;
+  std::condition_variable          cond_;
+  std::deque<std::vector<int16_t>> blocks_;
+  bool                             stopping_;
+  std::exception_ptr               error_;
+  std::thread                      writer_;
+};
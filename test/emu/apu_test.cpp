@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "src/emu/apu.h"
+#include "src/emu/nes.h"
+
+TEST(ApuBlip, step_response) {
+  ApuBlip   blip;
+  ApuBuffer out;
+  blip.set_sample_rate(44100);
+  blip.reset();
+  out.reset();
+
+  // The step lands 24.6 samples in, and gets spread over the 16 samples after
+  // that. Everything outside the kernel should be exact.
+  blip.add_delta(1000, ApuBlip::AMP_UNIT / 2);
+  blip.end_frame(10000, out);
+  ASSERT_EQ(246, out.available());
+  for (int i = 0; i < 246; i++) {
+    float x = out.read();
+    if (i < 24) {
+      ASSERT_EQ(0.0f, x) << i;
+    } else if (i >= 24 + 16) {
+      ASSERT_EQ(0.5f, x) << i;
+    } else {
+      ASSERT_NEAR(0.25f, x, 0.3f) << i;
+    }
+  }
+}
+
+TEST(ApuBlip, sample_rate) {
+  ApuBlip   blip;
+  ApuBuffer out;
+  blip.set_sample_rate(44100);
+  blip.reset();
+  out.reset();
+
+  // Rate changes take effect at the end of the frame.
+  int64_t samples = 0;
+  blip.set_sample_rate(48000);
+  for (int frame = 0; frame < 100; frame++) {
+    blip.end_frame(ApuBlip::MAX_FRAME_CYCLES, out);
+    samples += out.available();
+    while (out.available() > 0) {
+      out.read();
+    }
+  }
+  int64_t cycles = 100 * ApuBlip::MAX_FRAME_CYCLES;
+  int64_t expect = (cycles - ApuBlip::MAX_FRAME_CYCLES) * 48000 / 1789773 +
+                   ApuBlip::MAX_FRAME_CYCLES * 44100 / 1789773;
+  ASSERT_NEAR(expect, samples, 1);
+
+  EXPECT_THROW(blip.set_sample_rate(0), std::runtime_error);
+  EXPECT_THROW(blip.set_sample_rate(1000000), std::runtime_error);
+}
+
+static void drain(ApuBuffer &buf, std::vector<float> &samples) {
+  while (buf.available() > 0) {
+    samples.push_back(buf.read());
+  }
+}
+
+// Runs the APU only on demand, skipping the cycles between timer clocks, and
+// checks that it produces exactly the same audio, and signals interrupts at
+// exactly the same time, as stepping it cycle by cycle after every instruction.
+template <class Setup>
+static void check_lazy_matches_eager(const char *rom, Setup setup) {
+  Nes                eager, lazy, batched;
+  std::vector<float> eager_out, lazy_out, batched_out;
+  for (Nes *nes : {&eager, &lazy, &batched}) {
+    nes->load_cart(rom);
+    nes->power_on();
+    setup(*nes);
+  }
+
+  for (int64_t cycles = 100000; cycles <= 3000000; cycles += 100000) {
+    while (eager.cpu().cycles() < cycles) {
+      eager.step();
+      while (eager.apu().cycles() < eager.cpu().cycles()) {
+        eager.apu().step();
+      }
+    }
+    while (lazy.cpu().cycles() < cycles) {
+      lazy.step();
+    }
+    batched.run_until(cycles);
+    drain(eager.audio(), eager_out);
+    drain(lazy.audio(), lazy_out);
+    drain(batched.audio(), batched_out);
+
+    ASSERT_EQ(eager.cpu().cycles(), lazy.cpu().cycles());
+    ASSERT_EQ(eager.cpu().cycles(), batched.cpu().cycles());
+    ASSERT_EQ(eager.cpu().registers().PC, lazy.cpu().registers().PC);
+    ASSERT_EQ(eager.cpu().registers().PC, batched.cpu().registers().PC);
+    ASSERT_EQ(eager_out, lazy_out);
+    ASSERT_EQ(eager_out, batched_out);
+  }
+  ASSERT_GT(eager_out.size(), 0);
+}
+
+TEST(Apu, lazy_matches_eager) {
+  check_lazy_matches_eager("test_data/mmc3_1_clocking.nes", [](Nes &) {});
+
+  // Plays a looping DMC sample from $C000 while switching the bank there, so
+  // each fetch must see the bank that was mapped in at the time.
+  const uint8_t prog[] = {
+      0xa9, 0x4f,       // $0200: LDA #$4F
+      0x8d, 0x10, 0x40, // $0202: STA $4010 (looping, fastest rate)
+      0xa9, 0x00,       // $0205: LDA #$00
+      0x8d, 0x12, 0x40, // $0207: STA $4012 (from $C000)
+      0xa9, 0xff,       // $020A: LDA #$FF
+      0x8d, 0x13, 0x40, // $020C: STA $4013 (4081 bytes)
+      0xa9, 0x10,       // $020F: LDA #$10
+      0x8d, 0x15, 0x40, // $0211: STA $4015 (DMC on)
+      0xa9, 0x46,       // $0214: LDA #$46
+      0x8d, 0x00, 0x80, // $0216: STA $8000 (R6 at $C000)
+      0xe8,             // $0219: INX
+      0x8e, 0x01, 0x80, // $021A: STX $8001
+      0x88,             // $021D: DEY
+      0xd0, 0xfd,       // $021E: BNE $021D
+      0x4c, 0x14, 0x02  // $0220: JMP $0214
+  };
+  check_lazy_matches_eager("test_data/mmc3_1_clocking.nes", [&](Nes &nes) {
+    Cpu &cpu = nes.cpu();
+    for (int i = 0; i < (int)sizeof(prog); i++) {
+      cpu.poke((uint16_t)(0x200 + i), prog[i]);
+    }
+    cpu.registers().PC = 0x200;
+  });
+}
+
+TEST(Apu, lazy_ppustatus_polling) {
+  // Waits for vblank (as a game would), and then reads $4015 once per frame,
+  // counting frames in X. Only the $4015 reads should catch the APU up, with no
+  // interrupts due (frame IRQs are off and the DMC is idle).
+  const uint8_t prog[] = {
+      0xa9, 0x40,       // $0200: LDA #$40
+      0x8d, 0x17, 0x40, // $0202: STA $4017 (no frame IRQs)
+      0x2c, 0x02, 0x20, // $0205: BIT $2002
+      0x10, 0xfb,       // $0208: BPL $0205
+      0xad, 0x15, 0x40, // $020A: LDA $4015
+      0xe8,             // $020D: INX
+      0x4c, 0x05, 0x02  // $020E: JMP $0205
+  };
+
+  Nes nes;
+  nes.load_cart("test_data/nestest.nes");
+  nes.power_on();
+  nes.run_frames(2);
+
+  Cpu &cpu = nes.cpu();
+  for (int i = 0; i < (int)sizeof(prog); i++) {
+    cpu.poke((uint16_t)(0x200 + i), prog[i]);
+  }
+  cpu.registers().PC = 0x200;
+  cpu.registers().X  = 0;
+  while (cpu.registers().PC != 0x205) {
+    nes.step();
+  }
+
+  int     catch_ups  = 0;
+  int64_t apu_cycles = nes.apu().cycles();
+  while (cpu.registers().X < 10) {
+    nes.step();
+    if (nes.apu().cycles() != apu_cycles) {
+      apu_cycles = nes.apu().cycles();
+      catch_ups++;
+    }
+  }
+
+  ASSERT_EQ(10, catch_ups);
+}
+
+TEST(Apu, skipping_matches_stepping) {
+  // Plays every channel (the test ROMs hardly use them), with the triangle
+  // going ultrasonic and back, and checks that skipping the cycles between
+  // timer clocks produces exactly the same audio as stepping every cycle.
+  Nes                stepped, skipped;
+  std::vector<float> stepped_out, skipped_out;
+  for (Nes *nes : {&stepped, &skipped}) {
+    nes->load_cart("test_data/nestest.nes");
+    nes->power_on();
+
+    Apu &apu = nes->apu();
+    apu.write_4017(0x40);
+    apu.write_4000(0xbf); // pulse 1: 75% duty, constant volume 15
+    apu.write_4002(0x80);
+    apu.write_4003(0x01);
+    apu.write_4004(0x5f); // pulse 2: 50% duty, decaying, sweeping down
+    apu.write_4005(0x9a);
+    apu.write_4006(0x40);
+    apu.write_4007(0x02);
+    apu.write_4008(0xff); // triangle
+    apu.write_400A(0x40);
+    apu.write_400B(0x01);
+    apu.write_400C(0x3a); // noise
+    apu.write_400E(0x05);
+    apu.write_400F(0x08);
+    apu.write_4010(0x4f); // DMC: looping $C000-$C100 at the fastest rate
+    apu.write_4011(0x40);
+    apu.write_4012(0x00);
+    apu.write_4013(0x10);
+    apu.write_4015(0x1f);
+  }
+
+  for (int64_t cycles = 10000; cycles <= 300000; cycles += 10000) {
+    if (cycles == 100000 || cycles == 200000) {
+      // Ultrasonic triangle, and then back to an audible one.
+      uint8_t period = cycles == 100000 ? 0x00 : 0x80;
+      for (Nes *nes : {&stepped, &skipped}) {
+        nes->apu().write_400A(period);
+        nes->apu().write_400B(cycles == 100000 ? 0x08 : 0x09);
+      }
+    }
+    while (stepped.apu().cycles() < cycles) {
+      stepped.apu().step();
+    }
+    skipped.apu().run_until(cycles);
+    drain(stepped.apu().output(), stepped_out);
+    drain(skipped.apu().output(), skipped_out);
+
+    ASSERT_EQ(stepped.apu().cycles(), skipped.apu().cycles());
+    ASSERT_EQ(stepped_out, skipped_out);
+  }
+  ASSERT_GT(stepped_out.size(), 0);
+}
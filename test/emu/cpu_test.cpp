@@ -6,11 +6,14 @@
 #include <gtest/gtest.h>
 #include <iostream>
 #include <nlohmann/json.hpp>
+#include <span>
 
 #include "src/emu/apu.h"
 #include "src/emu/cart.h"
 #include "src/emu/cpu.h"
+#include "src/emu/nes.h"
 #include "src/emu/ppu.h"
+#include "test/emu/test_util.h"
 
 static bool compare_log_lines(const std::string &exp, const std::string &act) {
   if (exp.size() != act.size()) {
@@ -35,6 +38,7 @@ static std::string make_nestest_log_line(Cpu &cpu) {
   auto        out_it = std::back_inserter(out_str);
   auto       &regs   = cpu.registers();
   auto       &op     = Cpu::OP_CODES[cpu.peek(regs.PC)];
+  cpu.fetch_operand(op);
 
   std::format_to(out_it, "{:04X}  ", regs.PC);
 
@@ -196,6 +200,395 @@ TEST(Cpu, nestest) {
   ASSERT_EQ(cpu.peek(0x03), 0);
 }
 
+// Sets both CPUs up from the same random RAM and registers, with an op code at
+// PC, 16 times for every op code, and calls run(op, ram1, ram2) for each.
+template <class Run>
+static void for_each_random_op(Cpu &cpu1, Cpu &cpu2, Run run) {
+  std::vector<uint8_t> ram1(64 * 1024), ram2(64 * 1024);
+  cpu1.set_test_ram(ram1.data());
+  cpu2.set_test_ram(ram2.data());
+
+  uint32_t seed = 1;
+  auto     rand = [&]() {
+    seed = seed * 1664525 + 1013904223;
+    return (uint8_t)(seed >> 24);
+  };
+
+  for (auto &op : Cpu::OP_CODES) {
+    if (op.ins == Cpu::INVALID_INS) {
+      continue;
+    }
+    for (int i = 0; i < 16; i++) {
+      for (auto &x : ram1) {
+        x = rand();
+      }
+      ram2 = ram1;
+
+      cpu1.power_on();
+      cpu2.power_on();
+      auto &regs1 = cpu1.registers();
+      auto &regs2 = cpu2.registers();
+      regs1.PC    = (uint16_t)(rand() | (rand() << 8));
+      regs1.S     = rand();
+      regs1.A     = rand();
+      regs1.X     = rand();
+      regs1.Y     = rand();
+      regs1.P     = rand();
+      regs2       = regs1;
+      cpu1.poke(regs1.PC, op.code);
+      cpu2.poke(regs2.PC, op.code);
+
+      run(op, ram1, ram2);
+      if (testing::Test::HasFatalFailure()) {
+        return;
+      }
+    }
+  }
+}
+
+TEST(Cpu, threaded_dispatch) {
+  // Runs every op code from the same random state under both dispatchers and
+  // checks that they end up in the same state.
+  Cpu cpu1, cpu2;
+  cpu1.set_dispatch(Cpu::SWITCH);
+  cpu2.set_dispatch(Cpu::THREADED);
+
+  for_each_random_op(cpu1, cpu2, [&](auto &op, auto &ram1, auto &ram2) {
+    cpu1.step();
+    cpu2.step();
+
+    auto &regs1 = cpu1.registers();
+    auto &regs2 = cpu2.registers();
+    ASSERT_EQ(regs1.PC, regs2.PC) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(regs1.S, regs2.S) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(regs1.A, regs2.A) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(regs1.X, regs2.X) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(regs1.Y, regs2.Y) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(regs1.P, regs2.P) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(cpu1.cycles(), cpu2.cycles()) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(ram1, ram2) << Cpu::INS_NAMES[op.ins];
+  });
+}
+
+TEST(Cpu, code_cache) {
+  // Runs a ROM that switches PRG banks with and without the code cache (the
+  // switch dispatcher doesn't use it) and checks that they stay in sync.
+  Nes cached, uncached;
+  for (Nes *nes : {&cached, &uncached}) {
+    nes->load_cart("test_data/mmc3_2_details.nes");
+    nes->power_on();
+  }
+  uncached.cpu().set_dispatch(Cpu::SWITCH);
+
+  while (cached.cpu().cycles() < 1000000) {
+    cached.step();
+    uncached.step();
+
+    auto &regs1 = cached.cpu().registers();
+    auto &regs2 = uncached.cpu().registers();
+    ASSERT_EQ(regs1.PC, regs2.PC);
+    ASSERT_EQ(regs1.A, regs2.A);
+    ASSERT_EQ(regs1.P, regs2.P);
+    ASSERT_EQ(cached.cpu().cycles(), uncached.cpu().cycles());
+  }
+
+  auto &stats = cached.cpu().code_cache_stats();
+  ASSERT_GT(stats.hits, 100 * stats.misses);
+  ASSERT_EQ(uncached.cpu().code_cache_stats().hits, 0);
+}
+
+TEST(Cpu, jit_dispatch) {
+  // Runs random code from every op code under the switch dispatcher and the
+  // JIT, and checks that they end up in the same state. N.B., the test RAM is
+  // all directly mapped, so see jit_roms for I/O.
+  Cpu cpu1, cpu2;
+  cpu1.set_dispatch(Cpu::SWITCH);
+  cpu2.set_dispatch(Cpu::JIT);
+  if (cpu2.dispatch() != Cpu::JIT) {
+    GTEST_SKIP() << "no JIT on this platform";
+  }
+
+  for_each_random_op(cpu1, cpu2, [&](auto &op, auto &ram1, auto &ram2) {
+    // N.B., the random code may well run into an invalid op code.
+    int64_t cycles = cpu1.cycles() + 1000;
+    bool    threw1 = false, threw2 = false;
+    try {
+      cpu1.run(cycles);
+    } catch (const std::runtime_error &) {
+      threw1 = true;
+    }
+    try {
+      cpu2.run(cycles);
+    } catch (const std::runtime_error &) {
+      threw2 = true;
+    }
+
+    ASSERT_EQ(threw1, threw2) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(cpu1.registers(), cpu2.registers()) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(cpu1.cycles(), cpu2.cycles()) << Cpu::INS_NAMES[op.ins];
+    ASSERT_EQ(ram1, ram2) << Cpu::INS_NAMES[op.ins];
+  });
+
+  auto stats = cpu2.jit_stats();
+  ASSERT_GT(stats.runs, 10000);
+  ASSERT_GT(stats.invalidated, 1000);
+}
+
+TEST(Cpu, jit_nestest) {
+  // Runs nestest's automated tests (see nestest above) in one go, with and
+  // without the JIT.
+  Nes nes[2];
+  for (Nes &n : nes) {
+    n.load_cart("test_data/nestest.nes");
+    n.power_on();
+    n.cpu().registers().PC = 0xc000;
+  }
+  nes[0].cpu().set_dispatch(Cpu::SWITCH);
+  nes[1].cpu().set_dispatch(Cpu::JIT);
+  if (nes[1].cpu().dispatch() != Cpu::JIT) {
+    GTEST_SKIP() << "no JIT on this platform";
+  }
+
+  // N.B., the last instruction in test_data/nestest.log starts on cycle 26554.
+  for (Nes &n : nes) {
+    n.run_until(26555);
+  }
+
+  Cpu &cpu1 = nes[0].cpu(), &cpu2 = nes[1].cpu();
+  ASSERT_EQ(cpu1.registers(), cpu2.registers());
+  ASSERT_EQ(cpu1.cycles(), cpu2.cycles());
+  ASSERT_EQ(dump_ram(nes[0]), dump_ram(nes[1]));
+  ASSERT_EQ(cpu2.peek(0x02), 0);
+  ASSERT_EQ(cpu2.peek(0x03), 0);
+  ASSERT_GT(cpu2.jit_stats().runs, 1000);
+}
+
+TEST(Cpu, jit_roms) {
+  // Runs ROMs that switch banks, take IRQs and talk to the PPU and APU, with
+  // and without the JIT, and checks that the whole state matches each frame.
+  const char *roms[] = {
+      "test_data/nestest.nes",
+      "test_data/mmc3_1_clocking.nes",
+      "test_data/mmc3_2_details.nes",
+      "test_data/mmc3_3_a12_clocking.nes",
+      "test_data/mmc3_4_scanline_timing.nes",
+      "test_data/mmc3_5_mmc3.nes",
+      "test_data/mmc3_6_mmc3_alt.nes",
+  };
+
+  int64_t runs = 0;
+  for (const char *rom : roms) {
+    Nes threaded, jit;
+    for (Nes *nes : {&threaded, &jit}) {
+      nes->load_cart(rom);
+      nes->power_on();
+    }
+    jit.cpu().set_dispatch(Cpu::JIT);
+    if (jit.cpu().dispatch() != Cpu::JIT) {
+      GTEST_SKIP() << "no JIT on this platform";
+    }
+
+    std::vector<uint8_t> state1, state2;
+    for (int frame = 0; frame < 60; frame++) {
+      int64_t cycles = threaded.cpu().cycles() + CPU_CYCLES_PER_FRAME;
+      threaded.run_until(cycles);
+      jit.run_until(cycles);
+      threaded.save_state(state1);
+      jit.save_state(state2);
+      ASSERT_EQ(state1, state2) << rom << ", frame " << frame;
+    }
+    runs += jit.cpu().jit_stats().runs;
+  }
+  ASSERT_GT(runs, 10000);
+}
+
+TEST(Cpu, jit_self_modifying_code) {
+  // Counts up in code that rewrites its own operands, both earlier in its
+  // block (so that the block must be compiled again) and later in it, through
+  // a mirror of RAM (so that the block must stop right after the write).
+  const uint8_t prog[] = {
+      0xa9, 0x00,       // $0200: LDA #$00
+      0x18,             // $0202: CLC
+      0x69, 0x01,       // $0203: ADC #$01
+      0x8d, 0x01, 0x02, // $0205: STA $0201
+      0xee, 0x0c, 0x0a, // $0208: INC $0A0C (i.e., $020C)
+      0xa2, 0x00,       // $020B: LDX #$00
+      0x86, 0x10,       // $020D: STX $10
+      0x4c, 0x00, 0x02  // $020F: JMP $0200
+  };
+
+  Nes nes1, nes2;
+  for (Nes *nes : {&nes1, &nes2}) {
+    nes->load_cart("test_data/nestest.nes");
+    nes->power_on();
+
+    Cpu &cpu = nes->cpu();
+    for (int i = 0; i < (int)sizeof(prog); i++) {
+      cpu.poke((uint16_t)(0x200 + i), prog[i]);
+    }
+    cpu.poke(0x4017, 0x40); // no frame IRQs
+    cpu.registers().PC = 0x200;
+  }
+  nes1.cpu().set_dispatch(Cpu::JIT);
+  if (nes1.cpu().dispatch() != Cpu::JIT) {
+    GTEST_SKIP() << "no JIT on this platform";
+  }
+
+  for (int64_t cycles = 10000; cycles <= 100000; cycles += 10000) {
+    nes1.run_until(cycles);
+    while (nes2.cpu().cycles() < cycles) {
+      nes2.step();
+    }
+    ASSERT_EQ(nes1.cpu().registers(), nes2.cpu().registers());
+    ASSERT_EQ(nes1.cpu().cycles(), nes2.cpu().cycles());
+    ASSERT_EQ(dump_ram(nes1), dump_ram(nes2));
+  }
+
+  ASSERT_GT(nes1.cpu().registers().A, 0);
+  ASSERT_GT(nes1.cpu().jit_stats().invalidated, 1000);
+}
+
+// Runs the program at $0200 both with run() and with step(), and checks that
+// skipping its idle loop doesn't change the outcome. Halfway through, wake()
+// is called on both CPUs to end the wait.
+static void check_idle_loop(
+    std::span<const uint8_t> prog, void (*wake)(Cpu &cpu)
+) {
+  std::vector<uint8_t> ram1(64 * 1024), ram2(64 * 1024);
+  Cpu                  cpu1, cpu2;
+
+  std::copy(prog.begin(), prog.end(), ram1.begin() + 0x200);
+  ram1[0xfffa] = 0x00; // NMI vector: $0300
+  ram1[0xfffb] = 0x03;
+  ram1[0x0300] = 0xe8; // $0300: INX
+  ram1[0x0301] = 0x40; // $0301: RTI
+  ram2         = ram1;
+  cpu1.set_test_ram(ram1.data());
+  cpu2.set_test_ram(ram2.data());
+  for (Cpu *cpu : {&cpu1, &cpu2}) {
+    cpu->power_on();
+    cpu->registers().PC = 0x200;
+  }
+
+  for (int64_t cycles : {100000, 100500}) {
+    if (cycles == 100500) {
+      wake(cpu1);
+      wake(cpu2);
+    }
+    cpu1.run(cycles);
+    while (cpu2.cycles() < cycles) {
+      cpu2.step();
+    }
+    ASSERT_EQ(cpu1.registers(), cpu2.registers());
+    ASSERT_EQ(cpu1.cycles(), cpu2.cycles());
+  }
+
+  ASSERT_GT(cpu1.registers().X, 0);
+  ASSERT_GT(cpu1.idle_cycles(), 99000);
+  ASSERT_EQ(cpu2.idle_cycles(), 0);
+}
+
+TEST(Cpu, idle_loop) {
+  // Polls a RAM flag (as if waiting for an NMI handler to set it), and then
+  // counts up in X.
+  const uint8_t poll_ram[] = {
+      0xa5, 0x10,      // $0200: LDA $10
+      0xf0, 0xfc,      // $0202: BEQ $0200
+      0xe8,            // $0204: INX
+      0x4c, 0x04, 0x02 // $0205: JMP $0204
+  };
+  check_idle_loop(poll_ram, [](Cpu &cpu) { cpu.poke(0x10, 1); });
+
+  // Spins on a jump to itself until an NMI (which counts up in X).
+  const uint8_t jmp_self[] = {
+      0x4c, 0x00, 0x02 // $0200: JMP $0200
+  };
+  check_idle_loop(jmp_self, [](Cpu &cpu) { cpu.signal_NMI(); });
+}
+
+// Waits for vblank (counting frames in X) and for sprite 0 hits (counting
+// them in Y), as a game would to time a status bar split. Sprites 1-9 are all
+// on one line, so the sprite overflow flag gets set too. Skipping the waits
+// must not change the outcome.
+static void check_status_idle_loop(uint8_t ppumask) {
+  const uint8_t prog[] = {
+      0xa9, 0x40,       // $0200: LDA #$40
+      0x8d, 0x17, 0x40, // $0202: STA $4017 (no frame IRQs)
+      0x2c, 0x02, 0x20, // $0205: BIT $2002
+      0x10, 0xfb,       // $0208: BPL $0205
+      0xa9, ppumask,    // $020A: LDA #ppumask
+      0x8d, 0x01, 0x20, // $020C: STA $2001
+      0xa9, 0x03,       // $020F: LDA #$03
+      0x8d, 0x14, 0x40, // $0211: STA $4014
+      0x2c, 0x02, 0x20, // $0214: BIT $2002
+      0x30, 0x08,       // $0217: BMI $0221
+      0x50, 0xf9,       // $0219: BVC $0214
+      0xc8,             // $021B: INY
+      0x2c, 0x02, 0x20, // $021C: BIT $2002
+      0x10, 0xfb,       // $021F: BPL $021C
+      0xe8,             // $0221: INX
+      0x2c, 0x02, 0x20, // $0222: BIT $2002
+      0x70, 0xfb,       // $0225: BVS $0222
+      0x4c, 0x14, 0x02  // $0227: JMP $0214
+  };
+
+  Nes nes1, nes2;
+  for (Nes *nes : {&nes1, &nes2}) {
+    nes->load_cart("test_data/nestest.nes");
+    nes->power_on();
+    // N.B., the PPU ignores writes until it has warmed up.
+    nes->run_frames(2);
+
+    Cpu &cpu = nes->cpu();
+    for (int i = 0; i < (int)sizeof(prog); i++) {
+      cpu.poke((uint16_t)(0x200 + i), prog[i]);
+    }
+    for (int i = 0; i < 64; i++) {
+      uint8_t y = i == 0 ? 100 : i < 10 ? 150 : 0xff;
+      cpu.poke((uint16_t)(0x300 + i * 4 + 0), y);
+      cpu.poke((uint16_t)(0x300 + i * 4 + 1), 0x30);
+      cpu.poke((uint16_t)(0x300 + i * 4 + 2), 0);
+      cpu.poke((uint16_t)(0x300 + i * 4 + 3), (uint8_t)(i * 8));
+    }
+    cpu.registers().PC = 0x200;
+    cpu.registers().X  = 0;
+    cpu.registers().Y  = 0;
+
+    // N.B., tile $30 (a "0") overlaps itself, so sprite 0 hits the background.
+    Ppu &ppu = nes->ppu();
+    ppu.write_PPUCTRL(0);
+    ppu.write_PPUMASK(0);
+    ppu.read_PPUSTATUS();
+    ppu.write_PPUADDR(0x20);
+    ppu.write_PPUADDR(0x00);
+    for (int i = 0; i < 960; i++) {
+      ppu.write_PPUDATA(0x30);
+    }
+  }
+
+  for (int64_t cycles = 200000; cycles <= 1000000; cycles += 100000) {
+    nes1.run_until(cycles);
+    while (nes2.cpu().cycles() < cycles) {
+      nes2.step();
+    }
+    ASSERT_EQ(nes1.cpu().registers(), nes2.cpu().registers());
+    ASSERT_EQ(nes1.cpu().cycles(), nes2.cpu().cycles());
+    ASSERT_EQ(
+        nes1.ppu().registers().PPUSTATUS, nes2.ppu().registers().PPUSTATUS
+    );
+  }
+
+  // N.B., sprite 0 hits happen on every frame with rendering on.
+  ASSERT_GT(nes1.cpu().registers().X, 20);
+  ASSERT_EQ(nes1.cpu().registers().Y > 20, ppumask != 0);
+  ASSERT_GT(nes1.cpu().idle_cycles(), 500000);
+}
+
+TEST(Cpu, idle_loop_ppustatus) {
+  check_status_idle_loop(0b00000000); // rendering off
+  check_status_idle_loop(0b00011110); // rendering on
+}
+
 static uint16_t to_uint16_t(const nlohmann::json &json) {
   int res = json.template get<int>();
   assert(0 <= res && res <= UINT16_MAX);
@@ -2,6 +2,7 @@
 #include <string_view>
 
 #include "src/emu/game_genie.h"
+#include "src/emu/nes.h"
 
 TEST(GameGenieCode, decode_6) {
   GameGenieCode code("GOSSIP");
@@ -19,4 +20,20 @@ TEST(GameGenieCode, decode_8) {
   EXPECT_TRUE(code.applies(0x94A7, 0x03));
   EXPECT_FALSE(code.applies(0x94A7, 0x04));
   EXPECT_FALSE(code.applies(0x94A8, 0x03));
-}
\ No newline at end of file
+}
+
+TEST(GameGenieCode, patch_mapped_rom) {
+  Nes nes;
+  nes.load_cart("test_data/nestest.nes");
+  nes.power_on();
+
+  uint8_t orig = nes.cpu().peek(0xd1dd);
+  EXPECT_NE(orig, 0x14);
+
+  nes.cart().add_gg_code("GOSSIP");
+  EXPECT_EQ(nes.cpu().peek(0xd1dd), 0x14);
+  EXPECT_EQ(nes.cpu().peek(0xd1dc), nes.cart().peek_cpu(0xd1dc));
+
+  nes.cart().clear_gg_codes();
+  EXPECT_EQ(nes.cpu().peek(0xd1dd), orig);
+}
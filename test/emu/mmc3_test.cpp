@@ -79,3 +79,58 @@ TEST(Mmc3, mmc3_5_mmc3) { run_test_rom("mmc3_5_mmc3", 1000000); }
 TEST(Mmc3, DISABLED_mmc3_6_mmc3_alt) {
   run_test_rom("mmc3_6_mmc3_alt", 1000000);
 }
+
+TEST(Mmc3, run_until_matches_step) {
+  // Batched execution must see the scanline IRQs on exactly the same
+  // instruction boundaries as lockstep execution.
+  Nes stepped, batched;
+  for (Nes *nes : {&stepped, &batched}) {
+    nes->load_cart("test_data/mmc3_4_scanline_timing.nes");
+    nes->power_on();
+  }
+
+  for (int64_t cycles = 100000; cycles <= 2000000; cycles += 100000) {
+    while (stepped.cpu().cycles() < cycles) {
+      stepped.step();
+    }
+    batched.run_until(cycles);
+
+    auto &r1 = stepped.cpu().registers();
+    auto &r2 = batched.cpu().registers();
+    ASSERT_EQ(stepped.cpu().cycles(), batched.cpu().cycles());
+    ASSERT_EQ(r1.PC, r2.PC);
+    ASSERT_EQ(r1.A, r2.A);
+    ASSERT_EQ(r1.P, r2.P);
+    ASSERT_EQ(stepped.ppu().cycles(), batched.ppu().cycles());
+  }
+}
+
+static uint8_t vram_tag(uint16_t vram_addr) {
+  return (uint8_t)(vram_addr + (vram_addr >> 10));
+}
+
+TEST(Mmc3, ppu_page_mappings) {
+  // The PPU's direct page mappings must track the mapper through bank switches
+  // and mirroring changes.
+  Nes nes;
+  nes.load_cart("test_data/mmc3_2_details.nes");
+  nes.power_on();
+
+  Cart &cart = nes.cart();
+  Ppu  &ppu  = nes.ppu();
+  srand(0);
+  for (int i = 0; i < 100; i++) {
+    cart.poke_cpu(0x8000, (uint8_t)rand());
+    cart.poke_cpu(0x8001, (uint8_t)rand());
+    cart.poke_cpu(0xa000, (uint8_t)rand());
+    for (uint16_t addr = 0; addr < 0x2000; addr++) {
+      ASSERT_EQ(cart.peek_ppu(addr).value(), ppu.peek(addr));
+    }
+    for (uint16_t addr = 0x2000; addr < 0x3000; addr++) {
+      ppu.poke(addr, vram_tag(cart.peek_ppu(addr).address()));
+    }
+    for (uint16_t addr = 0x2000; addr < 0x3000; addr++) {
+      ASSERT_EQ(vram_tag(cart.peek_ppu(addr).address()), ppu.peek(addr));
+    }
+  }
+}
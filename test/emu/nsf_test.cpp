@@ -0,0 +1,90 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "src/emu/nes.h"
+
+static constexpr int64_t CPU_HZ = 1789773;
+
+// Writes a bankswitched NSF with 3 banks. INIT stores the song number to $00.
+// PLAY counts calls in $01, copies the first byte of the bank at $9000 (which
+// is $a0 + the bank number) to $02, then switches $9000 to bank $01 % 3.
+static std::filesystem::path write_test_nsf() {
+  std::vector<uint8_t> nsf(128 + 3 * 0x1000, 0);
+  std::memcpy(&nsf[0], "NESM\x1a", 5);
+  std::memcpy(&nsf[0x0e], "Test Song", 9);
+  nsf[0x05] = 1;    // version
+  nsf[0x06] = 3;    // songs
+  nsf[0x07] = 2;    // start song
+  nsf[0x09] = 0x80; // load address
+  nsf[0x0b] = 0x80; // init address
+  nsf[0x0c] = 0x10; // play address
+  nsf[0x0d] = 0x80;
+  nsf[0x6e] = 16639 & 0xff; // play period
+  nsf[0x6f] = 16639 >> 8;
+  for (int i = 0; i < 8; i++) {
+    nsf[0x70 + i] = (uint8_t)(i % 3);
+  }
+
+  uint8_t *data = &nsf[128];
+  const uint8_t init[] = {
+      0x85, 0x00, // STA $00
+      0x60,       // RTS
+  };
+  const uint8_t play[] = {
+      0xe6, 0x01,       // INC $01
+      0xad, 0x00, 0x90, // LDA $9000
+      0x85, 0x02,       // STA $02
+      0xa5, 0x01,       // LDA $01
+      0x8d, 0xf9, 0x5f, // STA $5FF9
+      0x60,             // RTS
+  };
+  std::memcpy(data, init, sizeof(init));
+  std::memcpy(data + 0x10, play, sizeof(play));
+  for (int bank = 1; bank < 3; bank++) {
+    data[bank * 0x1000] = (uint8_t)(0xa0 + bank);
+  }
+
+  auto          path = std::filesystem::temp_directory_path() / "test.nsf";
+  std::ofstream os(path, std::ios::binary);
+  os.write((const char *)nsf.data(), (std::streamsize)nsf.size());
+  return path;
+}
+
+TEST(Nsf, init_and_play) {
+  Nes nes;
+  nes.load_nsf(write_test_nsf());
+  ASSERT_EQ("Test Song", nes.nsf()->title());
+  ASSERT_EQ(3, nes.nsf()->songs());
+  ASSERT_EQ(1, nes.song());
+
+  nes.power_on();
+  nes.run_until(CPU_HZ);
+  Cpu &cpu = nes.cpu();
+  ASSERT_EQ(1, cpu.peek(0x00));
+  ASSERT_EQ(60, cpu.peek(0x01));
+  ASSERT_EQ(0xa0 + 59 % 3, cpu.peek(0x02));
+
+  // Only the CPU and APU run, and the CPU mostly idles between calls.
+  nes.audio();
+  ASSERT_EQ(0, nes.ppu().cycles());
+  ASSERT_GE(nes.apu().cycles(), CPU_HZ - 100);
+  ASSERT_GT(cpu.idle_cycles(), CPU_HZ * 9 / 10);
+}
+
+TEST(Nsf, select_song) {
+  Nes nes;
+  nes.load_nsf(write_test_nsf());
+  nes.power_on();
+  nes.run_until(CPU_HZ / 4);
+
+  nes.select_song(2);
+  nes.run_until(nes.cpu().cycles() + CPU_HZ / 2);
+  ASSERT_EQ(2, nes.cpu().peek(0x00));
+  ASSERT_EQ(30, nes.cpu().peek(0x01));
+
+  ASSERT_THROW(nes.select_song(3), std::runtime_error);
+}
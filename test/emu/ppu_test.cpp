@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include <format>
 #include <gtest/gtest.h>
 
@@ -140,3 +142,176 @@ TEST(Ppu, spr_pt_base_addr) {
   ppu.registers().PPUCTRL = 0b00001000;
   ASSERT_EQ(ppu.spr_pt_base_addr(), 0x1000);
 }
+
+// N.B., only the tiles in the lower half of nestest's first pattern table have
+// anything drawn on them.
+static uint8_t random_tile() { return (uint8_t)(0x20 + rand() % 0x60); }
+
+static void randomize_ppu(Ppu &ppu, unsigned seed) {
+  srand(seed);
+  ppu.power_on();
+  ppu.set_ready(true);
+  for (uint16_t addr = 0x2000; addr < 0x2800; addr++) {
+    ppu.poke(addr, (addr & 0x3ff) < 0x3c0 ? random_tile() : (uint8_t)rand());
+  }
+  for (uint16_t addr = 0x3f00; addr < 0x3f20; addr++) {
+    ppu.poke(addr, (uint8_t)(rand() & 0x3f));
+  }
+  ppu.write_OAMADDR(0);
+  for (int i = 0; i < 256; i++) {
+    ppu.write_OAMDATA((i & 3) == 1 ? random_tile() : (uint8_t)rand());
+  }
+  if (seed % 4 == 0) {
+    // Sprite 0 hits cannot happen at x = 255. Tile $48 flipped horizontally
+    // has its leftmost column almost completely filled in.
+    ppu.write_OAMADDR(1);
+    ppu.write_OAMDATA(0x48);
+    ppu.write_OAMDATA(0x40);
+    ppu.write_OAMDATA(0xff);
+  }
+  ppu.write_PPUCTRL((uint8_t)(rand() & 0x27));
+  ppu.write_PPUMASK((uint8_t)(rand() & 0x1e));
+  ppu.write_PPUSCROLL((uint8_t)rand());
+  ppu.write_PPUSCROLL((uint8_t)rand());
+}
+
+TEST(Ppu, scanline_renderer) {
+  Cart cart;
+  Ppu  fast, slow;
+
+  cart.load_cart("test_data/nestest.nes");
+  cart.power_on();
+  fast.set_cart(&cart);
+  slow.set_cart(&cart);
+  slow.set_scanline_renderer(false);
+
+  for (unsigned seed = 0; seed < 16; seed++) {
+    randomize_ppu(fast, seed);
+    randomize_ppu(slow, seed);
+    int64_t cycles = 0;
+    for (int i = 0; i < 64; i++) {
+      cycles += rand() % 4000;
+      fast.run_until(cycles);
+      slow.run_until(cycles);
+      ASSERT_EQ(fast.scanline(), slow.scanline());
+      ASSERT_EQ(fast.dot(), slow.dot());
+      ASSERT_EQ(fast.addr_bus(), slow.addr_bus());
+      ASSERT_EQ(fast.read_PPUSTATUS(), slow.read_PPUSTATUS());
+      const Ppu::Registers &exp = slow.registers();
+      const Ppu::Registers &act = fast.registers();
+      ASSERT_NO_FATAL_FAILURE(check_int_regs(exp, act));
+      ASSERT_EQ(exp.shift_bg_lo, act.shift_bg_lo);
+      ASSERT_EQ(exp.shift_bg_hi, act.shift_bg_hi);
+      ASSERT_EQ(exp.shift_at_lo, act.shift_at_lo);
+      ASSERT_EQ(exp.shift_at_hi, act.shift_at_hi);
+      ASSERT_EQ(0, std::memcmp(fast.frame(), slow.frame(), 256 * 240));
+      ASSERT_EQ(
+          0, std::memcmp(fast.frame_emphasis(), slow.frame_emphasis(), 240)
+      );
+
+      // Change the scroll and mask mid-frame like games do, and every so
+      // often move a sprite or change the sprite size.
+      uint8_t scroll   = (uint8_t)rand();
+      uint8_t mask     = (uint8_t)(rand() & 0xfe);
+      uint8_t oam_addr = (uint8_t)(rand() & 0xfc);
+      uint8_t spr_y    = (uint8_t)rand();
+      uint8_t ctrl     = (uint8_t)(rand() & 0x27);
+      bool    move_spr = rand() % 4 == 0;
+      bool    resize   = rand() % 8 == 0;
+      for (Ppu *ppu : {&fast, &slow}) {
+        ppu->write_PPUSCROLL(scroll);
+        ppu->write_PPUMASK(mask);
+        if (move_spr) {
+          ppu->write_OAMADDR(oam_addr);
+          ppu->write_OAMDATA(spr_y);
+        }
+        if (resize) {
+          ppu->write_PPUCTRL(ctrl);
+        }
+      }
+    }
+  }
+}
+
+TEST(Ppu, render_level) {
+  Cart cart;
+
+  cart.load_cart("test_data/nestest.nes");
+  cart.power_on();
+
+  for (bool scanline_renderer : {true, false}) {
+    Ppu full, skip, timing;
+    skip.set_render_level(Ppu::RENDER_SKIP_FRAMES, 2);
+    timing.set_render_level(Ppu::RENDER_TIMING_ONLY);
+    for (Ppu *ppu : {&full, &skip, &timing}) {
+      ppu->set_cart(&cart);
+      ppu->set_scanline_renderer(scanline_renderer);
+    }
+
+    for (unsigned seed = 0; seed < 8; seed++) {
+      for (Ppu *ppu : {&full, &skip, &timing}) {
+        randomize_ppu(*ppu, seed);
+      }
+      int64_t cycles = 0;
+      for (int i = 0; i < 64; i++) {
+        cycles += rand() % 4000;
+        for (Ppu *ppu : {&full, &skip, &timing}) {
+          ppu->run_until(cycles);
+        }
+
+        // Skipped frames must not change anything but the pixels.
+        uint8_t status = full.read_PPUSTATUS();
+        ASSERT_EQ(status, skip.read_PPUSTATUS());
+        ASSERT_EQ(status, timing.read_PPUSTATUS());
+        ASSERT_EQ(full.addr_bus(), skip.addr_bus());
+        ASSERT_EQ(full.addr_bus(), timing.addr_bus());
+        ASSERT_EQ(full.registers().v, skip.registers().v);
+        ASSERT_EQ(full.registers().v, timing.registers().v);
+        ASSERT_EQ(full.frames(), skip.frames());
+        ASSERT_EQ(full.frames(), timing.frames());
+
+        int64_t frames = full.frames();
+        ASSERT_EQ(frames, full.frames_drawn());
+        ASSERT_EQ((frames + 2) / 3, skip.frames_drawn());
+        ASSERT_EQ(0, timing.frames_drawn());
+        if (frames % 3 == 1) {
+          ASSERT_EQ(0, std::memcmp(full.frame(), skip.frame(), 256 * 240));
+        }
+
+        uint8_t mask = (uint8_t)(rand() & 0x1e);
+        for (Ppu *ppu : {&full, &skip, &timing}) {
+          ppu->write_PPUMASK(mask);
+        }
+      }
+
+      const uint8_t *frame = timing.frame();
+      ASSERT_TRUE(std::all_of(frame, frame + 256 * 240, [](uint8_t x) {
+        return x == 0;
+      }));
+    }
+  }
+}
+
+TEST(Ppu, copy) {
+  Cart cart;
+  Ppu  ppu;
+
+  cart.load_cart("test_data/nestest.nes");
+  cart.power_on();
+  ppu.set_cart(&cart);
+  randomize_ppu(ppu, 0);
+
+  // Copy in the middle of sprite evaluation, and check that the copy picks up
+  // where the original left off.
+  ppu.run_until(100 * 341 + 100);
+  Ppu copy = ppu;
+  ppu.run_until(3 * 262 * 341);
+  copy.run_until(3 * 262 * 341);
+
+  ASSERT_EQ(ppu.scanline(), copy.scanline());
+  ASSERT_EQ(ppu.dot(), copy.dot());
+  ASSERT_EQ(ppu.addr_bus(), copy.addr_bus());
+  ASSERT_EQ(ppu.registers().PPUSTATUS, copy.registers().PPUSTATUS);
+  ASSERT_NO_FATAL_FAILURE(check_int_regs(ppu.registers(), copy.registers()));
+  ASSERT_EQ(0, std::memcmp(ppu.frame(), copy.frame(), 256 * 240));
+}
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "src/emu/nes.h"
+#include "src/emu/rewind.h"
+#include "test/emu/test_util.h"
+
+namespace {
+
+// Runs the given number of frames, pushing the state after each one.
+std::vector<Snapshot> record(Nes &nes, RewindBuffer &rewind, int frames) {
+  std::vector<Snapshot> snapshots;
+  for (int i = 0; i < frames; i++) {
+    nes.run_until(nes.cpu().cycles() + CPU_CYCLES_PER_FRAME);
+    rewind.push(nes);
+    snapshots.push_back(take_snapshot(nes));
+  }
+  return snapshots;
+}
+
+} // namespace
+
+TEST(Rewind, pop_restores_states) {
+  Nes nes;
+  nes.load_cart("test_data/mmc3_1_clocking.nes");
+  nes.power_on();
+
+  RewindBuffer rewind(16 << 20, 10);
+  auto         snapshots = record(nes, rewind, 45);
+  ASSERT_EQ(45, rewind.size());
+
+  // Running on after stepping back must push states as usual.
+  for (int i = 0; i < 12; i++) {
+    ASSERT_TRUE(rewind.pop(nes));
+    ASSERT_EQ(snapshots.back(), take_snapshot(nes));
+    snapshots.pop_back();
+  }
+  auto more = record(nes, rewind, 5);
+  snapshots.insert(snapshots.end(), more.begin(), more.end());
+
+  while (!snapshots.empty()) {
+    ASSERT_TRUE(rewind.pop(nes));
+    ASSERT_EQ(snapshots.back(), take_snapshot(nes));
+    snapshots.pop_back();
+  }
+  EXPECT_FALSE(rewind.pop(nes));
+}
+
+TEST(Rewind, budget) {
+  // Only room for a few keyframe intervals, so the oldest states must be
+  // dropped to make room, and whatever is left must still decode. The ring
+  // wraps around at a different point for each run.
+  constexpr int64_t BUDGET = 20000;
+  for (int frames = 60; frames < 64; frames++) {
+    Nes nes;
+    nes.load_cart("test_data/mmc3_1_clocking.nes");
+    nes.power_on();
+
+    RewindBuffer rewind(BUDGET, 4);
+    auto         snapshots = record(nes, rewind, frames);
+    auto         stats     = rewind.stats();
+    EXPECT_LE(stats.bytes_used, BUDGET);
+    ASSERT_GT(rewind.size(), 4);
+    ASSERT_LT(rewind.size(), frames);
+
+    for (int i = 0; i < stats.states; i++) {
+      ASSERT_TRUE(rewind.pop(nes));
+      ASSERT_EQ(snapshots.back(), take_snapshot(nes));
+      snapshots.pop_back();
+    }
+    EXPECT_FALSE(rewind.pop(nes));
+  }
+}
+
+TEST(Rewind, states_of_varying_sizes) {
+  // Pushes after batches that end at all sorts of scanlines, as the app's
+  // timer does, so that each state holds a different number of drawn rows.
+  // None of them may be mistaken for a different cart.
+  Nes nes;
+  nes.load_cart("test_data/mmc3_5_mmc3.nes");
+  nes.power_on();
+
+  RewindBuffer          rewind(16 << 20, 10);
+  std::vector<Snapshot> snapshots;
+  for (int i = 0; i < 60; i++) {
+    nes.run_until(nes.cpu().cycles() + 1790 + (i * 7919) % 28000);
+    rewind.push(nes);
+    snapshots.push_back(take_snapshot(nes));
+  }
+  ASSERT_EQ(60, rewind.size());
+
+  while (!snapshots.empty()) {
+    ASSERT_TRUE(rewind.pop(nes));
+    ASSERT_EQ(snapshots.back(), take_snapshot(nes));
+    snapshots.pop_back();
+  }
+  EXPECT_FALSE(rewind.pop(nes));
+}
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "src/emu/nes.h"
+#include "src/emu/run_ahead.h"
+#include "test/emu/test_util.h"
+
+namespace {
+
+struct Frame {
+  Snapshot           snapshot;
+  std::vector<float> audio;
+};
+
+Frame run_frame(Nes &nes) {
+  nes.run_frames(1);
+
+  Frame frame;
+  frame.snapshot = take_snapshot(nes, true);
+  auto &audio    = nes.audio();
+  while (audio.available() > 0) {
+    frame.audio.push_back(audio.read());
+  }
+  return frame;
+}
+
+} // namespace
+
+TEST(RunAhead, shows_future_frames) {
+  // Running ahead must show the frame from N frames later, and otherwise leave
+  // no trace: the system, and its audio, carry on exactly as without it.
+  for (int frames = 1; frames <= 3; frames++) {
+    Nes reference, nes;
+    for (Nes *n : {&reference, &nes}) {
+      n->load_cart("test_data/mmc3_5_mmc3.nes");
+      n->power_on();
+    }
+
+    std::vector<Frame> expected;
+    for (int i = 0; i < 40 + frames; i++) {
+      expected.push_back(run_frame(reference));
+    }
+
+    RunAhead run_ahead;
+    run_ahead.set_frames(frames);
+    for (int i = 0; i < 40; i++) {
+      Frame frame = run_frame(nes);
+      ASSERT_EQ(expected[i].snapshot.cycles, frame.snapshot.cycles);
+      ASSERT_EQ(expected[i].snapshot.ram, frame.snapshot.ram);
+      ASSERT_EQ(expected[i].audio, frame.audio);
+
+      run_ahead.run(nes);
+      std::vector<uint8_t> shown(
+          nes.ppu().frame(), nes.ppu().frame() + 256 * 240
+      );
+      ASSERT_EQ(expected[i + frames].snapshot.frame, shown) << "frame " << i;
+    }
+  }
+}
+
+TEST(RunAhead, keeps_settings) {
+  // Running ahead must leave audio off, and the render level as it was, for
+  // callers that have turned them down (e.g., headless runs).
+  Nes nes;
+  nes.load_cart("test_data/mmc3_5_mmc3.nes");
+  nes.apu().set_audio_enabled(false);
+  nes.ppu().set_render_level(Ppu::RENDER_TIMING_ONLY);
+  nes.power_on();
+
+  RunAhead run_ahead;
+  run_ahead.set_frames(2);
+  for (int i = 0; i < 5; i++) {
+    nes.run_frames(1);
+    run_ahead.run(nes);
+    ASSERT_FALSE(nes.apu().audio_enabled());
+    ASSERT_EQ(Ppu::RENDER_TIMING_ONLY, nes.ppu().render_level());
+  }
+}
@@ -0,0 +1,146 @@
+#include <cstring>
+#include <format>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "src/emu/nes.h"
+#include "test/emu/test_util.h"
+
+namespace {
+
+std::vector<Snapshot> run_frames(Nes &nes, int frames) {
+  std::vector<Snapshot> snapshots;
+  for (int i = 0; i < frames; i++) {
+    nes.run_until(nes.cpu().cycles() + CPU_CYCLES_PER_FRAME);
+    snapshots.push_back(take_snapshot(nes, true));
+  }
+  return snapshots;
+}
+
+void expect_same(
+    const std::vector<Snapshot> &a, const std::vector<Snapshot> &b
+) {
+  ASSERT_EQ(a.size(), b.size());
+  for (std::size_t i = 0; i < a.size(); i++) {
+    ASSERT_EQ(a[i].cycles, b[i].cycles) << "frame " << i;
+    ASSERT_EQ(a[i].PC, b[i].PC) << "frame " << i;
+    ASSERT_EQ(a[i].ram, b[i].ram) << "frame " << i;
+    ASSERT_EQ(a[i].frame, b[i].frame) << "frame " << i;
+  }
+}
+
+struct Trace {
+  std::vector<uint16_t> PCs;
+  Snapshot              end;
+};
+
+Trace run_trace(Nes &nes, int64_t cycles) {
+  Trace   trace;
+  int64_t end = nes.cpu().cycles() + cycles;
+  while (nes.cpu().cycles() < end) {
+    trace.PCs.push_back(nes.cpu().registers().PC);
+    nes.step();
+  }
+  trace.end = run_frames(nes, 1)[0];
+  return trace;
+}
+
+void check_replays(std::string_view rom) {
+  // The ROMs' tests are over within a million cycles, so saving every so often
+  // lands states in the middle of them.
+  Nes nes, other;
+  for (Nes *n : {&nes, &other}) {
+    n->load_cart(std::format("test_data/{}.nes", rom));
+    n->power_on();
+  }
+
+  std::vector<uint8_t> state;
+  for (int64_t cycles = 10000; cycles < 1000000; cycles += 50000) {
+    nes.run_until(cycles);
+    nes.save_state(state);
+    auto original = run_trace(nes, 10000);
+
+    nes.load_state(state);
+    auto replayed = run_trace(nes, 10000);
+    ASSERT_EQ(original.PCs, replayed.PCs) << "saved at " << cycles;
+    expect_same({original.end}, {replayed.end});
+
+    // Loading into a different system works just the same.
+    other.load_state(state);
+    replayed = run_trace(other, 10000);
+    ASSERT_EQ(original.PCs, replayed.PCs) << "saved at " << cycles;
+    expect_same({original.end}, {replayed.end});
+  }
+}
+
+} // namespace
+
+TEST(State, load_replays_exactly) {
+  // Running on from a loaded state must retrace the original run, down to the
+  // mapper's scanline IRQs.
+  check_replays("mmc3_1_clocking");
+  check_replays("mmc3_3_a12_clocking");
+  check_replays("mmc3_5_mmc3");
+}
+
+TEST(State, mapper_registers) {
+  // Loading must restore the mapper's registers and redo its mappings, even
+  // when the registers were never touched in the system being loaded into.
+  Nes nes, other;
+  for (Nes *n : {&nes, &other}) {
+    n->load_cart("test_data/mmc3_2_details.nes");
+    n->power_on();
+  }
+
+  std::vector<uint8_t> state;
+  srand(0);
+  for (int i = 0; i < 100; i++) {
+    for (uint16_t addr = 0x8000; addr != 0; addr += 0x2000) {
+      nes.cart().poke_cpu(addr, (uint8_t)rand());
+      nes.cart().poke_cpu(addr + 1, (uint8_t)rand());
+    }
+    nes.save_state(state);
+    other.load_state(state);
+
+    ASSERT_EQ(
+        nes.cart().ppu_cycles_until_irq(), other.cart().ppu_cycles_until_irq()
+    );
+    for (int i = 0x6000; i < 0x10000; i++) {
+      auto addr = (uint16_t)i;
+      ASSERT_EQ(nes.cpu().peek(addr), other.cpu().peek(addr));
+    }
+    for (uint16_t addr = 0; addr < 0x3000; addr++) {
+      ASSERT_EQ(nes.ppu().peek(addr), other.ppu().peek(addr));
+    }
+  }
+}
+
+TEST(State, bad_states_are_rejected) {
+  Nes nes;
+  nes.load_cart("test_data/mmc3_1_clocking.nes");
+  nes.power_on();
+  run_frames(nes, 10);
+
+  std::vector<uint8_t> state;
+  nes.save_state(state);
+
+  auto truncated = state;
+  truncated.pop_back();
+  EXPECT_THROW(nes.load_state(truncated), std::runtime_error);
+
+  auto garbage = state;
+  std::memset(garbage.data(), 0xff, 4);
+  EXPECT_THROW(nes.load_state(garbage), std::runtime_error);
+
+  Nes other;
+  other.load_cart("test_data/mmc3_2_details.nes");
+  other.power_on();
+  EXPECT_THROW(other.load_state(state), std::runtime_error);
+
+  // A rejected state must leave the system untouched.
+  auto before = run_frames(nes, 1);
+  nes.load_state(state);
+  EXPECT_THROW(nes.load_state(truncated), std::runtime_error);
+  expect_same(before, run_frames(nes, 1));
+}
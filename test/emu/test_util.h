@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "src/emu/nes.h"
+
+// Helpers shared by the tests that run whole systems and compare the results.
+
+// What runs that should match are compared on: where the CPU is, what's in
+// its RAM and, if asked for, the last frame drawn.
+struct Snapshot {
+  int64_t              cycles;
+  uint16_t             PC;
+  std::vector<uint8_t> ram;
+  std::vector<uint8_t> frame; // empty unless asked for
+
+  bool operator==(const Snapshot &) const = default;
+};
+
+inline std::vector<uint8_t> dump_ram(Nes &nes) {
+  std::vector<uint8_t> ram;
+  for (uint16_t addr = 0; addr < 0x800; addr++) {
+    ram.push_back(nes.cpu().peek(addr));
+  }
+  return ram;
+}
+
+inline Snapshot take_snapshot(Nes &nes, bool with_frame = false) {
+  Snapshot s;
+  s.cycles = nes.cpu().cycles();
+  s.PC     = nes.cpu().registers().PC;
+  s.ram    = dump_ram(nes);
+  if (with_frame) {
+    s.frame.assign(nes.ppu().frame(), nes.ppu().frame() + 256 * 240);
+  }
+  return s;
+}